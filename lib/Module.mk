@@ -51,7 +51,14 @@ endif
 
 LIBCSOURCES := $(MODULE_DIR)/data.c $(MODULE_DIR)/general.c \
                $(MODULE_DIR)/error.c $(MODULE_DIR)/access.c \
-               $(MODULE_DIR)/init.c $(MODULE_DIR)/sysfs.c
+               $(MODULE_DIR)/init.c $(MODULE_DIR)/sysfs.c \
+               $(MODULE_DIR)/sampler.c $(MODULE_DIR)/stats.c \
+               $(MODULE_DIR)/cache.c $(MODULE_DIR)/uring.c \
+               $(MODULE_DIR)/async.c $(MODULE_DIR)/subscribe.c \
+               $(MODULE_DIR)/alarm.c $(MODULE_DIR)/alloc.c \
+               $(MODULE_DIR)/handle.c $(MODULE_DIR)/compute.c \
+               $(MODULE_DIR)/breaker.c $(MODULE_DIR)/trace.c \
+               $(MODULE_DIR)/profile.c $(MODULE_DIR)/virtual.c
 
 LIBOTHEROBJECTS := $(MODULE_DIR)/conf-parse.o $(MODULE_DIR)/conf-lex.o
 LIBSHOBJECTS := $(LIBCSOURCES:.c=.lo) $(LIBOTHEROBJECTS:.o=.lo)
@@ -59,11 +66,12 @@ LIBSTOBJECTS := $(LIBCSOURCES:.c=.ao) $(LIBOTHEROBJECTS:.o=.ao)
 LIBEXTRACLEAN := $(MODULE_DIR)/conf-parse.h $(MODULE_DIR)/conf-parse.c \
                  $(MODULE_DIR)/conf-lex.c
 
-LIBHEADERFILES := $(MODULE_DIR)/error.h $(MODULE_DIR)/sensors.h
+LIBHEADERFILES := $(MODULE_DIR)/error.h $(MODULE_DIR)/sensors.h \
+                  $(MODULE_DIR)/sensors.hpp
 
 # How to create the shared library
 $(MODULE_DIR)/$(LIBSHLIBNAME): $(LIBSHOBJECTS)
-	$(CC) -shared $(LDFLAGS) -Wl,-soname,$(LIBSHSONAME) -o $@ $^ -lc -lm
+	$(CC) -shared $(LDFLAGS) -Wl,-soname,$(LIBSHSONAME) -o $@ $^ -lc -lm -lpthread
 
 $(MODULE_DIR)/$(LIBSHSONAME): $(MODULE_DIR)/$(LIBSHLIBNAME)
 	$(RM) $@
@@ -80,9 +88,10 @@ $(MODULE_DIR)/$(LIBSTLIBNAME): $(LIBSTOBJECTS)
 
 # Depencies for non-C sources
 $(MODULE_DIR)/conf-lex.c: $(MODULE_DIR)/conf-lex.l $(MODULE_DIR)/general.h \
-                          $(MODULE_DIR)/data.h $(MODULE_DIR)/conf-parse.h
+                          $(MODULE_DIR)/data.h $(MODULE_DIR)/conf-parse.h \
+                          $(MODULE_DIR)/conf.h
 $(MODULE_DIR)/conf-parse.c: $(MODULE_DIR)/conf-parse.y $(MODULE_DIR)/general.h \
-                            $(MODULE_DIR)/data.h
+                            $(MODULE_DIR)/data.h $(MODULE_DIR)/conf.h
 $(MODULE_DIR)/conf-parse.h: $(MODULE_DIR)/conf-parse.c
 
 # Include all dependency files
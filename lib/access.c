@@ -22,23 +22,34 @@
 #include <stdlib.h>
 #include <string.h>
 #include <math.h>
+#include <pthread.h>
 #include "access.h"
 #include "sensors.h"
 #include "data.h"
 #include "error.h"
+#include "alloc.h"
 #include "sysfs.h"
+#include "stats.h"
+#include "probes.h"
+#include "cache.h"
+#include "general.h"
+#include "compute.h"
+#include "trace.h"
+#include "virtual.h"
 
 /* We watch the recursion depth for variables only, as an easy way to
    detect cycles. */
 #define DEPTH_MAX	8
 
+struct snapshot;
+
 static int sensors_eval_expr(const sensors_chip_features *chip_features,
-			     const sensors_expr *expr,
-			     double val, int depth, double *result);
+			     const sensors_expr *expr, double val, int depth,
+			     struct snapshot *snap, double *result);
 
 /* Compare two chips name descriptions, to see whether they could match.
    Return 0 if it does not match, return 1 if it does match. */
-static int sensors_match_chip(const sensors_chip_name *chip1,
+int sensors_match_chip(const sensors_chip_name *chip1,
 		       const sensors_chip_name *chip2)
 {
 	if ((chip1->prefix != SENSORS_CHIP_NAME_PREFIX_ANY) &&
@@ -90,17 +101,38 @@ sensors_for_all_config_chips(const sensors_chip_name *name,
 	return NULL;
 }
 
-/* Look up a chip in the intern chip list, and return a pointer to it.
-   Do not modify the struct the return value points to! Returns NULL if
-   not found.*/
-static const sensors_chip_features *
+static pthread_mutex_t load_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* Enumerate the features of a chip found by lazy discovery. A chip which
+   can't be read any longer is left without features. */
+void sensors_load_chip(sensors_chip_features *chip)
+{
+	pthread_mutex_lock(&load_lock);
+	if (!chip->loaded) {
+		sensors_read_sysfs_features(chip);
+		sensors_build_chip_compute_graph(chip);
+		__atomic_store_n(&chip->loaded, 1, __ATOMIC_RELEASE);
+	}
+	pthread_mutex_unlock(&load_lock);
+}
+
+/* Look up a chip in the intern chip list, and return a pointer to it,
+   with its features enumerated. Do not modify the struct the return
+   value points to! Returns NULL if not found.*/
+const sensors_chip_features *
 sensors_lookup_chip(const sensors_chip_name *name)
 {
+	sensors_chip_features *chip;
 	int i;
 
-	for (i = 0; i < sensors_proc_chips_count; i++)
-		if (sensors_match_chip(&sensors_proc_chips[i].chip, name))
-			return &sensors_proc_chips[i];
+	for (i = 0; i < sensors_proc_chips_count; i++) {
+		chip = &sensors_proc_chips[i];
+		if (!sensors_match_chip(&chip->chip, name))
+			continue;
+		if (!__atomic_load_n(&chip->loaded, __ATOMIC_ACQUIRE))
+			sensors_load_chip(chip);
+		return chip;
+	}
 
 	return NULL;
 }
@@ -133,7 +165,7 @@ sensors_lookup_feature_nr(const sensors_chip_features *chip, int feat_nr)
 /* Look up a subfeature by name, and return a pointer to it.
    Do not modify the struct the return value points to! Returns NULL if 
    not found.*/
-static const sensors_subfeature *
+const sensors_subfeature *
 sensors_lookup_subfeature_name(const sensors_chip_features *chip,
 			       const char *name)
 {
@@ -168,6 +200,7 @@ char *sensors_get_label(const sensors_chip_name *name,
 {
 	char *label;
 	const sensors_chip *chip;
+	const sensors_chip_features *features;
 	char buf[PATH_MAX];
 	FILE *f;
 	int i;
@@ -182,6 +215,22 @@ char *sensors_get_label(const sensors_chip_name *name,
 				goto sensors_get_label_exit;
 			}
 
+	/* Virtual chips have no _label sysfs files */
+	if (!name->path) {
+		label = feature->name;
+		goto sensors_get_label_exit;
+	}
+
+	/* When replaying, the _label sysfs files are part of the trace */
+	if (sensors_trace_mode == SENSORS_TRACE_REPLAY) {
+		features = sensors_lookup_chip(name);
+		label = features ? sensors_trace_get_label(features, feature) :
+			NULL;
+		if (!label)
+			label = feature->name;
+		goto sensors_get_label_exit;
+	}
+
 	/* No user specified label, check for a _label sysfs file */
 	snprintf(buf, PATH_MAX, "%s/%s_label", name->path, feature->name);
 	
@@ -206,6 +255,32 @@ sensors_get_label_exit:
 	return label;
 }
 
+/* Look up the interval at which a feature should be sampled, or the
+   chip if feature is NULL. An interval statement for the feature wins
+   over one for the whole chip. Returns the interval in milliseconds, 0
+   if none is configured, or <0 on failure. */
+int sensors_get_interval(const sensors_chip_name *name,
+			 const sensors_feature *feature)
+{
+	const sensors_chip *chip;
+	const char *fname;
+	int i, pass;
+
+	if (sensors_chip_name_has_wildcards(name))
+		return -SENSORS_ERR_WILDCARDS;
+
+	for (pass = feature ? 0 : 1; pass < 2; pass++) {
+		for (chip = NULL; (chip = sensors_for_all_config_chips(name, chip));)
+			for (i = chip->intervals_count - 1; i >= 0; i--) {
+				fname = chip->intervals[i].name;
+				if (pass ? !fname :
+				    fname && !strcmp(feature->name, fname))
+					return chip->intervals[i].value;
+			}
+	}
+	return 0;
+}
+
 /* Looks up whether a feature should be ignored. Returns
    1 if it should be ignored, 0 if not. */
 static int sensors_get_ignored(const sensors_chip_name *name,
@@ -221,57 +296,508 @@ static int sensors_get_ignored(const sensors_chip_name *name,
 	return 0;
 }
 
+/* Evaluate the expression of a compute or set statement for subfeature
+   name, accounting for it. Variables are taken from snap if not NULL. */
+static int eval_stmt(const sensors_chip_features *chip_features,
+		     const char *name, const sensors_expr *expr, double val,
+		     int depth, struct snapshot *snap, double *result)
+{
+	unsigned long long start;
+	int res;
+
+	SENSORS_PROBE2(eval_entry, chip_features->chip.prefix, name);
+	start = sensors_stats_begin();
+	res = sensors_eval_expr(chip_features, expr, val, depth, snap, result);
+	sensors_stats_end(chip_features - sensors_proc_chips,
+			  SENSORS_STATS_EVAL, start, res);
+	SENSORS_PROBE4(eval_return, chip_features->chip.prefix, name,
+		       res ? 0 : SENSORS_PROBE_VALUE(*result), res);
+	return res;
+}
+
+int sensors_eval_stmt(const sensors_chip_features *chip_features,
+		      const char *name, const sensors_expr *expr,
+		      double val, int depth, double *result)
+{
+	return eval_stmt(chip_features, name, expr, val, depth, NULL, result);
+}
+
+/* Find the compute statement which applies to a subfeature, if any. The
+   last matching statement of the configuration file wins. */
+const sensors_compute *
+sensors_lookup_compute(const sensors_chip_features *chip_features,
+		       const sensors_subfeature *subfeature)
+{
+	const sensors_feature *feature;
+	const sensors_chip *chip;
+	int i;
+
+	if (!(subfeature->flags & SENSORS_COMPUTE_MAPPING))
+		return NULL;
+
+	feature = sensors_lookup_feature_nr(chip_features, subfeature->mapping);
+	for (chip = NULL;
+	     (chip = sensors_for_all_config_chips(&chip_features->chip, chip));)
+		for (i = 0; i < chip->computes_count; i++)
+			if (!strcmp(feature->name, chip->computes[i].name))
+				return &chip->computes[i];
+	return NULL;
+}
+
+/* Find the expression of the compute statement which applies to a
+   subfeature, in the compute graph once it is built. to_proc selects the
+   expression used for writing. */
+static const sensors_expr *
+sensors_lookup_compute_expr(const sensors_chip_features *chip_features,
+			    const sensors_subfeature *subfeature, int to_proc)
+{
+	const sensors_compute_node *node;
+	const sensors_compute *compute;
+
+	if ((node = sensors_get_compute_node(chip_features,
+					     subfeature->number)))
+		return to_proc ? node->to_proc : node->from_proc;
+
+	if (!(compute = sensors_lookup_compute(chip_features, subfeature)))
+		return NULL;
+	return to_proc ? compute->to_proc : compute->from_proc;
+}
+
+/* Find a readable subfeature of a certain chip, and the compute statement
+   which applies to it, if any. Note that chip should not contain wildcard
+   values! This function will return 0 on success, and <0 on failure. */
+static int sensors_lookup_read(const sensors_chip_name *name, int subfeat_nr,
+			       const sensors_chip_features **chip_features,
+			       const sensors_subfeature **subfeature,
+			       const sensors_expr **expr)
+{
+	if (sensors_chip_name_has_wildcards(name))
+		return -SENSORS_ERR_WILDCARDS;
+	if (!(*chip_features = sensors_lookup_chip(name)))
+		return -SENSORS_ERR_NO_ENTRY;
+	if (!(*subfeature = sensors_lookup_subfeature_nr(*chip_features,
+							 subfeat_nr)))
+		return -SENSORS_ERR_NO_ENTRY;
+	if (!((*subfeature)->flags & SENSORS_MODE_R))
+		return -SENSORS_ERR_ACCESS_R;
+
+	/* Apply compute statement if it exists */
+	*expr = sensors_lookup_compute_expr(*chip_features, *subfeature, 0);
+
+	return 0;
+}
+
+/* The values of the subfeatures involved in a read: those requested, and
+   those their compute statements refer to, directly or not. Each raw
+   value is read once, all together, and the compute statements are then
+   evaluated in dependency order, so each subfeature is evaluated once
+   too, and its value shared by all the expressions which refer to it.
+   The raw value of a subfeature of a virtual chip is that of its feature
+   statement, over the final values of the subfeatures it aggregates,
+   which are part of the snapshot too. The subfeatures of the chips whose
+   compute graph isn't built have no node, and their compute statements
+   are evaluated directly, reading what they refer to on their own. */
+struct snapshot_slot {
+	const sensors_chip_features *chip;
+	const sensors_subfeature *subfeature;
+	const sensors_compute_node *node;	/* NULL if not built */
+	double value;
+	int err;
+	int read;		/* value was read already */
+	int virtual;		/* subfeature of a virtual chip */
+};
+
+/* Snapshots have room for every compute node, so that reads don't
+   allocate: they are taken from a free list, and given back, emptied,
+   once read. sensors_init() and the sampler reserve them, sized for the
+   chips known then; more are only allocated when more threads read at
+   once, and they grow when chips are loaded later on. */
+struct snapshot {
+	struct snapshot *next;	/* In the free list */
+	struct snapshot_slot *slots;
+	int count;
+	int size;		/* Compute nodes there is room for */
+	int *index;		/* Slot of each compute node, -1 if none */
+	sensors_attr_read *reads;
+	int *map;
+	sensors_attr_work work;
+};
+
+static struct snapshot *free_snapshots;
+static int snapshots_count;
+static pthread_mutex_t snapshots_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* Make room for the compute nodes of the chips loaded so far */
+static void snapshot_grow(struct snapshot *snap)
+{
+	int i, size = sensors_compute_nodes_count();
+
+	if (size <= snap->size)
+		return;
+
+	snap->slots = sensors_realloc(snap->slots,
+				      size * sizeof(struct snapshot_slot));
+	snap->index = sensors_realloc(snap->index, size * sizeof(int));
+	snap->reads = sensors_realloc(snap->reads,
+				      size * sizeof(sensors_attr_read));
+	snap->map = sensors_realloc(snap->map, size * sizeof(int));
+	if (!snap->slots || !snap->index || !snap->reads || !snap->map)
+		sensors_fatal_error(__func__, "Out of memory");
+	sensors_attr_work_grow(&snap->work, size);
+	for (i = snap->size; i < size; i++)
+		snap->index[i] = -1;
+	snap->size = size;
+}
+
+static struct snapshot *snapshot_get(void)
+{
+	struct snapshot *snap;
+
+	pthread_mutex_lock(&snapshots_lock);
+	if ((snap = free_snapshots))
+		free_snapshots = snap->next;
+	else
+		snapshots_count++;
+	pthread_mutex_unlock(&snapshots_lock);
+
+	if (!snap && !(snap = sensors_calloc(1, sizeof(struct snapshot))))
+		sensors_fatal_error(__func__, "Out of memory");
+	snapshot_grow(snap);
+	return snap;
+}
+
+static void snapshot_put(struct snapshot *snap)
+{
+	const struct snapshot_slot *slot;
+	int i;
+
+	for (i = 0; i < snap->count; i++) {
+		slot = &snap->slots[i];
+		snap->index[sensors_compute_node_index(slot->chip,
+				slot->subfeature->number)] = -1;
+	}
+	snap->count = 0;
+
+	pthread_mutex_lock(&snapshots_lock);
+	snap->next = free_snapshots;
+	free_snapshots = snap;
+	pthread_mutex_unlock(&snapshots_lock);
+}
+
+void sensors_reserve_snapshots(int count)
+{
+	struct snapshot *snap;
+
+	pthread_mutex_lock(&snapshots_lock);
+	for (; snapshots_count < count; snapshots_count++) {
+		if (!(snap = sensors_calloc(1, sizeof(struct snapshot))))
+			sensors_fatal_error(__func__, "Out of memory");
+		snap->next = free_snapshots;
+		free_snapshots = snap;
+	}
+	for (snap = free_snapshots; snap; snap = snap->next)
+		snapshot_grow(snap);
+	pthread_mutex_unlock(&snapshots_lock);
+}
+
+void sensors_free_snapshots(void)
+{
+	struct snapshot *snap;
+
+	pthread_mutex_lock(&snapshots_lock);
+	while ((snap = free_snapshots)) {
+		free_snapshots = snap->next;
+		sensors_attr_work_free(&snap->work);
+		sensors_free(snap->map);
+		sensors_free(snap->reads);
+		sensors_free(snap->index);
+		sensors_free(snap->slots);
+		sensors_free(snap);
+	}
+	snapshots_count = 0;
+	pthread_mutex_unlock(&snapshots_lock);
+}
+
+/* Add a subfeature, and those it depends on, to the snapshot. Returns
+   its slot. */
+static int snapshot_add(struct snapshot *snap,
+			const sensors_chip_features *chip,
+			const sensors_subfeature *subfeature)
+{
+	const sensors_virtual_aggregate *aggregates;
+	const sensors_compute_node *node;
+	struct snapshot_slot *slot;
+	int i, j, n, count;
+
+	n = sensors_compute_node_index(chip, subfeature->number);
+	if (n >= snap->size)
+		snapshot_grow(snap);
+	if (snap->index[n] >= 0)
+		return snap->index[n];
+
+	slot = &snap->slots[snap->count];
+	slot->chip = chip;
+	slot->subfeature = subfeature;
+	slot->node = node = sensors_get_compute_node(chip, subfeature->number);
+	slot->err = subfeature->flags & SENSORS_MODE_R ? 0 :
+		    -SENSORS_ERR_ACCESS_R;
+	slot->virtual = sensors_chip_is_virtual(chip);
+	slot->read = slot->virtual;
+	snap->index[n] = snap->count;
+	n = snap->count++;
+
+	/* slot moves if the snapshot grows */
+	if (slot->err)
+		return n;
+	for (i = 0; node && i < node->deps_count; i++)
+		snapshot_add(snap, chip, &chip->subfeature[node->deps[i]]);
+	if (sensors_chip_is_virtual(chip)) {
+		count = sensors_get_virtual_aggregates(chip, subfeature->number,
+						       &aggregates);
+		for (i = 0; i < count; i++)
+			for (j = 0; j < aggregates[i].inputs_count; j++)
+				snapshot_add(snap, aggregates[i].inputs[j].chip,
+					     aggregates[i].inputs[j].subfeature);
+	}
+	return n;
+}
+
+/* Read the raw values which aren't read yet, from the value cache or all
+   at once from the hardware */
+static void snapshot_read(struct snapshot *snap)
+{
+	struct snapshot_slot *slot;
+	sensors_attr_read *reads = snap->reads;
+	unsigned long long ts;
+	int *map = snap->map, i, n;
+
+	for (i = 0, n = 0; i < snap->count; i++) {
+		slot = &snap->slots[i];
+		if (slot->err || slot->read)
+			continue;
+		if (sensors_cache_lookup(slot->chip, slot->subfeature,
+					 &slot->value))
+			continue;
+		reads[n].chip = slot->chip;
+		reads[n].subfeature = slot->subfeature;
+		map[n++] = i;
+	}
+
+	ts = sensors_monotonic_ns();
+	sensors_read_sysfs_attrs(reads, n, &snap->work);
+	for (i = 0; i < n; i++) {
+		slot = &snap->slots[map[i]];
+		slot->err = reads[i].err;
+		slot->value = reads[i].value;
+		if (!reads[i].err)
+			sensors_cache_store(reads[i].chip, reads[i].subfeature,
+					    reads[i].value, ts);
+	}
+}
+
+/* Apply the compute statements of the subfeatures of virtual chips or
+   of the others, lowest rank first, so that the values the expressions
+   refer to are final when they are evaluated */
+static void snapshot_eval_ranks(struct snapshot *snap, int virtual)
+{
+	struct snapshot_slot *slot;
+	int i, rank, max = 0;
+
+	for (i = 0; i < snap->count; i++) {
+		slot = &snap->slots[i];
+		if (slot->err || slot->virtual != virtual || !slot->node)
+			continue;
+		if (slot->node->rank < 0)
+			slot->err = -SENSORS_ERR_RECURSION;
+		else if (slot->node->rank > max)
+			max = slot->node->rank;
+	}
+
+	for (rank = 1; rank <= max; rank++)
+		for (i = 0; i < snap->count; i++) {
+			slot = &snap->slots[i];
+			if (slot->err || slot->virtual != virtual ||
+			    !slot->node || slot->node->rank != rank)
+				continue;
+			slot->err = eval_stmt(slot->chip,
+					      slot->subfeature->name,
+					      slot->node->from_proc,
+					      slot->value, 0, snap,
+					      &slot->value);
+		}
+}
+
+/* Apply the compute statements of the subfeatures without node, of
+   virtual chips or of the others. What they refer to isn't part of the
+   snapshot, so it is read on its own. */
+static void snapshot_eval_direct(struct snapshot *snap, int virtual)
+{
+	struct snapshot_slot *slot;
+	const sensors_expr *expr;
+	int i;
+
+	for (i = 0; i < snap->count; i++) {
+		slot = &snap->slots[i];
+		if (slot->err || slot->virtual != virtual || slot->node)
+			continue;
+		expr = sensors_lookup_compute_expr(slot->chip,
+						   slot->subfeature, 0);
+		if (expr)
+			slot->err = eval_stmt(slot->chip,
+					      slot->subfeature->name, expr,
+					      slot->value, 0, NULL,
+					      &slot->value);
+	}
+}
+
+/* Virtual chips only aggregate the subfeatures of other chips, so these
+   are final before any virtual value is computed */
+static void snapshot_eval(struct snapshot *snap)
+{
+	struct snapshot_slot *slot;
+	int i;
+
+	snapshot_eval_direct(snap, 0);
+	snapshot_eval_ranks(snap, 0);
+	for (i = 0; i < snap->count; i++) {
+		slot = &snap->slots[i];
+		if (slot->err || !slot->virtual)
+			continue;
+		slot->err = eval_stmt(slot->chip, slot->subfeature->name,
+				      sensors_get_virtual_expr(slot->chip,
+						slot->subfeature->number),
+				      0, 0, snap, &slot->value);
+	}
+	snapshot_eval_direct(snap, 1);
+	snapshot_eval_ranks(snap, 1);
+}
+
+static int snapshot_value(struct snapshot *snap,
+			  const sensors_chip_features *chip,
+			  const sensors_subfeature *subfeature, double *result)
+{
+	const struct snapshot_slot *slot;
+	int n;
+
+	n = sensors_compute_node_index(chip, subfeature->number);
+	if (n >= snap->size || snap->index[n] < 0)
+		return -SENSORS_ERR_NO_ENTRY;
+	slot = &snap->slots[snap->index[n]];
+	if (slot->err)
+		return slot->err;
+	*result = slot->value;
+	return 0;
+}
+
+/* Read the values of count subfeatures as one snapshot. If timestamp is
+   not NULL, the first value is read on its own, and timestamp set to the
+   time it was read from the hardware. Returns the first error. */
+static int get_values(sensors_value_request *reqs, int count,
+		      unsigned long long *timestamp)
+{
+	const sensors_chip_features *chip_features;
+	const sensors_subfeature *subfeature;
+	const sensors_expr *expr;
+	struct snapshot_slot *slot;
+	struct snapshot *snap;
+	int one, *slots, i, res = 0;
+
+	/* Single reads, the sampler's among them, don't allocate */
+	if (count == 1)
+		slots = &one;
+	else if (!(slots = sensors_malloc(count * sizeof(int))))
+		sensors_fatal_error(__func__, "Out of memory");
+	snap = snapshot_get();
+
+	for (i = 0; i < count; i++) {
+		reqs[i].err = sensors_lookup_read(reqs[i].name,
+						  reqs[i].subfeat_nr,
+						  &chip_features, &subfeature,
+						  &expr);
+		slots[i] = reqs[i].err ? -1 :
+			   snapshot_add(snap, chip_features, subfeature);
+	}
+
+	if (timestamp && slots[0] >= 0) {
+		slot = &snap->slots[slots[0]];
+		if (slot->virtual) {
+			/* Its inputs are read just below */
+			*timestamp = sensors_monotonic_ns();
+		} else {
+			slot->err = sensors_read_subfeature(slot->chip,
+							    slot->subfeature,
+							    &slot->value,
+							    timestamp);
+			slot->read = 1;
+		}
+	}
+	snapshot_read(snap);
+	snapshot_eval(snap);
+
+	for (i = 0; i < count; i++) {
+		if (slots[i] >= 0) {
+			slot = &snap->slots[slots[i]];
+			reqs[i].err = slot->err;
+			reqs[i].value = slot->value;
+		}
+		if (reqs[i].err && !res)
+			res = reqs[i].err;
+	}
+
+	snapshot_put(snap);
+	if (slots != &one)
+		sensors_free(slots);
+	return res;
+}
+
 /* Read the value of a subfeature of a certain chip. Note that chip should not
    contain wildcard values! This function will return 0 on success, and <0
    on failure. */
 static int __sensors_get_value(const sensors_chip_name *name, int subfeat_nr,
-			       int depth, double *result)
+			       int depth, double *result,
+			       unsigned long long *timestamp)
 {
 	const sensors_chip_features *chip_features;
 	const sensors_subfeature *subfeature;
-	const sensors_expr *expr = NULL;
+	const sensors_compute_node *node;
+	const sensors_expr *expr;
+	sensors_value_request req;
+	unsigned long long ts;
 	double val;
-	int res, i;
+	int res;
 
 	if (depth >= DEPTH_MAX)
 		return -SENSORS_ERR_RECURSION;
-	if (sensors_chip_name_has_wildcards(name))
-		return -SENSORS_ERR_WILDCARDS;
-	if (!(chip_features = sensors_lookup_chip(name)))
-		return -SENSORS_ERR_NO_ENTRY;
-	if (!(subfeature = sensors_lookup_subfeature_nr(chip_features,
-							subfeat_nr)))
-		return -SENSORS_ERR_NO_ENTRY;
-	if (!(subfeature->flags & SENSORS_MODE_R))
-		return -SENSORS_ERR_ACCESS_R;
+	if ((res = sensors_lookup_read(name, subfeat_nr, &chip_features,
+				       &subfeature, &expr)))
+		return res;
 
-	/* Apply compute statement if it exists */
-	if (subfeature->flags & SENSORS_COMPUTE_MAPPING) {
-		const sensors_feature *feature;
-		const sensors_chip *chip;
-
-		feature = sensors_lookup_feature_nr(chip_features,
-					subfeature->mapping);
-
-		chip = NULL;
-		while (!expr &&
-		       (chip = sensors_for_all_config_chips(name, chip)))
-			for (i = 0; i < chip->computes_count; i++) {
-				if (!strcmp(feature->name,
-					    chip->computes[i].name)) {
-					expr = chip->computes[i].from_proc;
-					break;
-				}
-			}
+	/* Compute statements which refer to other subfeatures are evaluated
+	   over a snapshot, so that each subfeature is read only once, and so
+	   are virtual chips */
+	if (sensors_chip_is_virtual(chip_features) ||
+	    (expr && (node = sensors_get_compute_node(chip_features,
+						      subfeat_nr)) &&
+	     node->deps_count)) {
+		req.name = name;
+		req.subfeat_nr = subfeat_nr;
+		if ((res = get_values(&req, 1, &ts)))
+			return res;
+		if (timestamp)
+			*timestamp = ts;
+		*result = req.value;
+		return 0;
 	}
 
-	res = sensors_read_sysfs_attr(name, subfeature, &val);
+	res = sensors_read_subfeature(chip_features, subfeature, &val, &ts);
 	if (res)
 		return res;
+	if (timestamp)
+		*timestamp = ts;
 	if (!expr)
 		*result = val;
-	else if ((res = sensors_eval_expr(chip_features, expr, val, depth,
-					  result)))
+	else if ((res = sensors_eval_stmt(chip_features, subfeature->name,
+					  expr, val, depth, result)))
 		return res;
 	return 0;
 }
@@ -279,19 +805,49 @@ static int __sensors_get_value(const sensors_chip_name *name, int subfeat_nr,
 int sensors_get_value(const sensors_chip_name *name, int subfeat_nr,
 		      double *result)
 {
-	return __sensors_get_value(name, subfeat_nr, 0, result);
+	int res;
+
+	res = __sensors_get_value(name, subfeat_nr, 0, result, NULL);
+	if (res)
+		SENSORS_PROBE2(error, __func__, res);
+	return res;
+}
+
+int sensors_get_value_timestamp(const sensors_chip_name *name, int subfeat_nr,
+				double *result, unsigned long long *timestamp)
+{
+	int res;
+
+	res = __sensors_get_value(name, subfeat_nr, 0, result, timestamp);
+	if (res)
+		SENSORS_PROBE2(error, __func__, res);
+	return res;
+}
+
+int sensors_get_values(sensors_value_request *reqs, int count)
+{
+	int res;
+
+	if (count <= 0)
+		return 0;
+
+	res = get_values(reqs, count, NULL);
+	if (res)
+		SENSORS_PROBE2(error, __func__, res);
+	return res;
 }
 
 /* Set the value of a subfeature of a certain chip. Note that chip should not
    contain wildcard values! This function will return 0 on success, and <0
    on failure. */
-int sensors_set_value(const sensors_chip_name *name, int subfeat_nr,
-		      double value)
+static int __sensors_set_value(const sensors_chip_name *name, int subfeat_nr,
+			       double value)
 {
 	const sensors_chip_features *chip_features;
 	const sensors_subfeature *subfeature;
-	const sensors_expr *expr = NULL;
-	int i, res;
+	const sensors_expr *expr;
+	unsigned long long start;
+	int res;
 	double to_write;
 
 	if (sensors_chip_name_has_wildcards(name))
@@ -305,31 +861,29 @@ int sensors_set_value(const sensors_chip_name *name, int subfeat_nr,
 		return -SENSORS_ERR_ACCESS_W;
 
 	/* Apply compute statement if it exists */
-	if (subfeature->flags & SENSORS_COMPUTE_MAPPING) {
-		const sensors_feature *feature;
-		const sensors_chip *chip;
-
-		feature = sensors_lookup_feature_nr(chip_features,
-					subfeature->mapping);
-
-		chip = NULL;
-		while (!expr &&
-		       (chip = sensors_for_all_config_chips(name, chip)))
-			for (i = 0; i < chip->computes_count; i++) {
-				if (!strcmp(feature->name,
-					    chip->computes[i].name)) {
-					expr = chip->computes[i].to_proc;
-					break;
-				}
-			}
-	}
-
 	to_write = value;
-	if (expr)
-		if ((res = sensors_eval_expr(chip_features, expr,
-					     value, 0, &to_write)))
+	if ((expr = sensors_lookup_compute_expr(chip_features, subfeature, 1)))
+		if ((res = sensors_eval_stmt(chip_features, subfeature->name,
+					     expr, value, 0, &to_write)))
 			return res;
-	return sensors_write_sysfs_attr(name, subfeature, to_write);
+
+	start = sensors_stats_begin();
+	res = sensors_write_sysfs_attr(name, subfeature, to_write);
+	sensors_stats_end(chip_features - sensors_proc_chips,
+			  SENSORS_STATS_WRITE, start, res);
+	sensors_cache_invalidate_subfeature(chip_features, subfeature);
+	return res;
+}
+
+int sensors_set_value(const sensors_chip_name *name, int subfeat_nr,
+		      double value)
+{
+	int res;
+
+	res = __sensors_set_value(name, subfeat_nr, value);
+	if (res)
+		SENSORS_PROBE2(error, __func__, res);
+	return res;
 }
 
 const sensors_chip_name *sensors_get_detected_chips(const sensors_chip_name
@@ -347,7 +901,7 @@ const sensors_chip_name *sensors_get_detected_chips(const sensors_chip_name
 
 const char *sensors_get_adapter_name(const sensors_bus_id *bus)
 {
-	int i;
+	const sensors_bus *proc_bus;
 
 	/* bus types with a single instance */
 	switch (bus->type) {
@@ -370,11 +924,11 @@ const char *sensors_get_adapter_name(const sensors_bus_id *bus)
 	}
 
 	/* bus types with several instances */
-	for (i = 0; i < sensors_proc_bus_count; i++)
-		if (sensors_proc_bus[i].bus.type == bus->type &&
-		    sensors_proc_bus[i].bus.nr == bus->nr)
-			return sensors_proc_bus[i].adapter;
-	return NULL;
+	if (sensors_read_sysfs_bus())
+		return NULL;
+	proc_bus = sensors_lookup_bus_id(&sensors_proc_bus_index,
+					 sensors_proc_bus, bus);
+	return proc_bus ? proc_bus->adapter : NULL;
 }
 
 const sensors_feature *
@@ -434,10 +988,56 @@ sensors_get_subfeature(const sensors_chip_name *name,
 	return NULL;	/* No such subfeature */
 }
 
+/* Evaluate an aggregate of the final values of snap. The subfeatures
+   which can't be read are left out, as long as one can. */
+static int eval_aggregate(const sensors_chip_features *chip_features,
+			  const sensors_expr *expr, struct snapshot *snap,
+			  double *result)
+{
+	const sensors_virtual_aggregate *aggregate;
+	const sensors_virtual_input *input;
+	double value, acc = 0;
+	int i, n = 0, res, err = -SENSORS_ERR_NO_ENTRY;
+
+	if (!snap || !sensors_chip_is_virtual(chip_features) ||
+	    !(aggregate = sensors_lookup_virtual_aggregate(chip_features,
+							   expr)))
+		return -SENSORS_ERR_NO_ENTRY;
+
+	for (i = 0; i < aggregate->inputs_count; i++) {
+		input = &aggregate->inputs[i];
+		if ((res = snapshot_value(snap, input->chip, input->subfeature,
+					  &value))) {
+			err = res;
+			continue;
+		}
+		switch (expr->data.aggregate.op) {
+		case sensors_max:
+			if (!n || value > acc)
+				acc = value;
+			break;
+		case sensors_min:
+			if (!n || value < acc)
+				acc = value;
+			break;
+		case sensors_avg:
+		case sensors_sum:
+			acc += value;
+			break;
+		}
+		n++;
+	}
+	if (!n)
+		return err;
+
+	*result = expr->data.aggregate.op == sensors_avg ? acc / n : acc;
+	return 0;
+}
+
 /* Evaluate an expression */
-int sensors_eval_expr(const sensors_chip_features *chip_features,
-		      const sensors_expr *expr,
-		      double val, int depth, double *result)
+static int sensors_eval_expr(const sensors_chip_features *chip_features,
+			     const sensors_expr *expr, double val, int depth,
+			     struct snapshot *snap, double *result)
 {
 	double res1, res2;
 	int res;
@@ -455,16 +1055,21 @@ int sensors_eval_expr(const sensors_chip_features *chip_features,
 		if (!(subfeature = sensors_lookup_subfeature_name(chip_features,
 							    expr->data.var)))
 			return -SENSORS_ERR_NO_ENTRY;
+		if (snap)
+			return snapshot_value(snap, chip_features, subfeature,
+					      result);
 		return __sensors_get_value(&chip_features->chip,
 					   subfeature->number, depth + 1,
-					   result);
+					   result, NULL);
 	}
+	if (expr->kind == sensors_kind_aggregate)
+		return eval_aggregate(chip_features, expr, snap, result);
 	if ((res = sensors_eval_expr(chip_features, expr->data.subexpr.sub1,
-				     val, depth, &res1)))
+				     val, depth, snap, &res1)))
 		return res;
 	if (expr->data.subexpr.sub2 &&
 	    (res = sensors_eval_expr(chip_features, expr->data.subexpr.sub2,
-				     val, depth, &res2)))
+				     val, depth, snap, &res2)))
 		return res;
 	switch (expr->data.subexpr.op) {
 	case sensors_add:
@@ -522,7 +1127,8 @@ static int sensors_do_this_chip_sets(const sensors_chip_name *name)
 				continue;
 			}
 
-			res = sensors_eval_expr(chip_features,
+			res = sensors_eval_stmt(chip_features,
+						chip->sets[i].name,
 						chip->sets[i].value, 0,
 						0, &value);
 			if (res) {
@@ -557,5 +1163,7 @@ int sensors_do_chip_sets(const sensors_chip_name *name)
 		if (this_res)
 			res = this_res;
 	}
+	if (res)
+		SENSORS_PROBE2(error, __func__, res);
 	return res;
 }
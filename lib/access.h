@@ -25,9 +25,47 @@
 #include "sensors.h"
 #include "data.h"
 
+/* Compare two chips name descriptions, to see whether they could match.
+   Return 0 if it does not match, return 1 if it does match. */
+int sensors_match_chip(const sensors_chip_name *chip1,
+		       const sensors_chip_name *chip2);
+
 /* Check whether the chip name is an 'absolute' name, which can only match
    one chip, or whether it has wildcards. Returns 0 if it is absolute, 1
    if there are wildcards. */
 int sensors_chip_name_has_wildcards(const sensors_chip_name *chip);
 
+/* Enumerate the features of a chip found by lazy discovery, if not done
+   yet. A chip which can't be read any longer is left without features. */
+void sensors_load_chip(sensors_chip_features *chip);
+
+/* Look up a chip in the intern chip list, and return a pointer to it.
+   Returns NULL if not found. */
+const sensors_chip_features *
+sensors_lookup_chip(const sensors_chip_name *name);
+
+/* Look up a subfeature of a chip by name. Returns NULL if not found. */
+const sensors_subfeature *
+sensors_lookup_subfeature_name(const sensors_chip_features *chip,
+			       const char *name);
+
+/* Find the compute statement which applies to a subfeature. Returns NULL
+   if there is none. */
+const sensors_compute *
+sensors_lookup_compute(const sensors_chip_features *chip_features,
+		       const sensors_subfeature *subfeature);
+
+/* Evaluate the expression of a compute or set statement for subfeature
+   name, accounting for it. depth is the recursion depth, 0 for
+   statements not evaluated as part of another. */
+int sensors_eval_stmt(const sensors_chip_features *chip_features,
+		      const char *name, const sensors_expr *expr,
+		      double val, int depth, double *result);
+
+/* Make sure there are count snapshots to read with, sized for the chips
+   known so far, so that as many threads can read at once without
+   allocating. Free them all; called by sensors_cleanup(). */
+void sensors_reserve_snapshots(int count);
+void sensors_free_snapshots(void);
+
 #endif /* def LIB_SENSORS_ACCESS_H */
@@ -0,0 +1,280 @@
+/*
+    alarm.c - Part of libsensors, a Linux library for reading sensor data.
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+    MA 02110-1301 USA.
+*/
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include "sensors.h"
+#include "data.h"
+#include "error.h"
+#include "alloc.h"
+#include "general.h"
+#include "access.h"
+#include "sysfs.h"
+#include "stats.h"
+#include "breaker.h"
+#include "alarm.h"
+
+/* Drivers which get alarms from interrupts notify the attribute files,
+   which then report POLLPRI. All watched files are in one epoll set, so
+   the application only has one descriptor to wait on. There is no way
+   to know which drivers do this, so the files which never notified are
+   also read on a timer, which is part of the epoll set as well. Once a
+   file has notified, it is trusted to always do so, and when all files
+   are trusted, the timer is stopped and nothing happens until the
+   hardware reports something. */
+
+struct alarm_watch {
+	const sensors_chip_features *chip;
+	const sensors_subfeature *subfeature;
+	int fd;
+	int notifies;		/* Notified at least once */
+	int pending;		/* Changed since last reported */
+	int err;		/* Result of the last read */
+	double value;		/* Last value read successfully */
+};
+
+static struct alarm_watch *watches;
+static int watches_count, watches_max;
+
+static int epoll_fd = -1, timer_fd = -1;
+static unsigned int poll_interval = 1000;	/* ms */
+static pthread_mutex_t alarm_lock = PTHREAD_MUTEX_INITIALIZER;
+
+#define TIMER_TAG	UINT32_MAX
+
+/* Called with alarm_lock held */
+static int alarm_setup(void)
+{
+	struct epoll_event ev;
+
+	if (epoll_fd >= 0)
+		return 0;
+
+	epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+	timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+	ev.events = EPOLLIN;
+	ev.data.u32 = TIMER_TAG;
+	if (epoll_fd < 0 || timer_fd < 0 ||
+	    epoll_ctl(epoll_fd, EPOLL_CTL_ADD, timer_fd, &ev) < 0) {
+		if (timer_fd >= 0)
+			close(timer_fd);
+		if (epoll_fd >= 0)
+			close(epoll_fd);
+		epoll_fd = timer_fd = -1;
+		return -SENSORS_ERR_KERNEL;
+	}
+	return 0;
+}
+
+/* Run the timer if some files must be polled. Called with alarm_lock
+   held. */
+static void alarm_update_timer(void)
+{
+	struct itimerspec its = { { 0, 0 }, { 0, 0 } };
+	int i;
+
+	for (i = 0; i < watches_count && watches[i].notifies; i++)
+		;
+	if (i < watches_count && poll_interval) {
+		its.it_interval.tv_sec = poll_interval / 1000;
+		its.it_interval.tv_nsec = (poll_interval % 1000) * 1000000;
+		its.it_value = its.it_interval;
+	}
+	timerfd_settime(timer_fd, 0, &its, NULL);
+}
+
+/* Called with alarm_lock held */
+static void alarm_read(struct alarm_watch *w)
+{
+	unsigned long long start;
+	double value;
+	int err;
+
+	if (sensors_breaker_check(w->chip - sensors_proc_chips))
+		return;
+	start = sensors_stats_begin();
+	err = sensors_read_sysfs_fd(w->chip, w->subfeature, w->fd, &value);
+	sensors_stats_end(w->chip - sensors_proc_chips, SENSORS_STATS_READ,
+			  start, err);
+	sensors_breaker_report(w->chip - sensors_proc_chips, err);
+
+	/* Changes are relative to the last successful read */
+	if (!err && (w->err || value != w->value)) {
+		w->value = value;
+		w->pending = 1;
+	}
+	w->err = err;
+}
+
+int sensors_watch_alarm(const sensors_chip_name *name, int subfeat_nr)
+{
+	const sensors_chip_features *chip;
+	struct alarm_watch w;
+	struct epoll_event ev;
+	int i, res;
+
+	if (sensors_chip_name_has_wildcards(name))
+		return -SENSORS_ERR_WILDCARDS;
+	if (!(chip = sensors_lookup_chip(name)))
+		return -SENSORS_ERR_NO_ENTRY;
+	if (subfeat_nr < 0 || subfeat_nr >= chip->subfeature_count)
+		return -SENSORS_ERR_NO_ENTRY;
+	if (!(chip->subfeature[subfeat_nr].flags & SENSORS_MODE_R))
+		return -SENSORS_ERR_ACCESS_R;
+
+	pthread_mutex_lock(&alarm_lock);
+	res = 0;
+	for (i = 0; i < watches_count; i++)
+		if (watches[i].chip == chip &&
+		    watches[i].subfeature->number == subfeat_nr)
+			goto exit_unlock;
+	if ((res = alarm_setup()))
+		goto exit_unlock;
+
+	w.chip = chip;
+	w.subfeature = &chip->subfeature[subfeat_nr];
+	w.notifies = w.pending = 0;
+	w.fd = sensors_open_sysfs_attr(&chip->chip, w.subfeature,
+				       SENSORS_MODE_R);
+	if (w.fd < 0) {
+		res = -SENSORS_ERR_KERNEL;
+		goto exit_unlock;
+	}
+
+	/* The first read is the reference, it is not reported */
+	w.err = sensors_read_sysfs_fd(chip, w.subfeature, w.fd, &w.value);
+
+	/* Files which can't be waited on, are only polled */
+	ev.events = EPOLLPRI | EPOLLET;
+	ev.data.u32 = watches_count;
+	epoll_ctl(epoll_fd, EPOLL_CTL_ADD, w.fd, &ev);
+
+	sensors_add_array_el(&w, &watches, &watches_count, &watches_max,
+			     sizeof(struct alarm_watch));
+	alarm_update_timer();
+
+exit_unlock:
+	pthread_mutex_unlock(&alarm_lock);
+	return res;
+}
+
+int sensors_set_alarm_poll_interval(unsigned int interval)
+{
+	int res;
+
+	pthread_mutex_lock(&alarm_lock);
+	poll_interval = interval;
+	if (!(res = alarm_setup()))
+		alarm_update_timer();
+	pthread_mutex_unlock(&alarm_lock);
+
+	return res;
+}
+
+int sensors_alarm_fd(void)
+{
+	int res;
+
+	pthread_mutex_lock(&alarm_lock);
+	res = alarm_setup();
+	if (!res)
+		res = epoll_fd;
+	pthread_mutex_unlock(&alarm_lock);
+
+	return res;
+}
+
+int sensors_get_alarm_changes(sensors_alarm_change *changes, int max)
+{
+	struct epoll_event evs[16];
+	struct alarm_watch *w;
+	uint64_t expirations;
+	int i, n, timer = 0, trusted = 0;
+
+	pthread_mutex_lock(&alarm_lock);
+	if (epoll_fd < 0) {
+		pthread_mutex_unlock(&alarm_lock);
+		return 0;
+	}
+
+	do {
+		n = epoll_wait(epoll_fd, evs, 16, 0);
+		for (i = 0; i < n; i++) {
+			if (evs[i].data.u32 == TIMER_TAG) {
+				timer = 1;
+				continue;
+			}
+			w = &watches[evs[i].data.u32];
+			if (!w->notifies) {
+				w->notifies = 1;
+				trusted = 1;
+			}
+			alarm_read(w);
+		}
+	} while (n == 16);
+
+	if (timer) {
+		if (read(timer_fd, &expirations, sizeof(expirations)) < 0) {
+			/* Already read, nothing to do */
+		}
+		for (i = 0; i < watches_count; i++)
+			if (!watches[i].notifies)
+				alarm_read(&watches[i]);
+	}
+	if (trusted)
+		alarm_update_timer();
+
+	for (i = 0, n = 0; i < watches_count && n < max; i++) {
+		w = &watches[i];
+		if (!w->pending)
+			continue;
+		w->pending = 0;
+		changes[n].name = &w->chip->chip;
+		changes[n].subfeat_nr = w->subfeature->number;
+		changes[n].value = w->value;
+		n++;
+	}
+	pthread_mutex_unlock(&alarm_lock);
+
+	return n;
+}
+
+void sensors_alarm_cleanup(void)
+{
+	int i;
+
+	pthread_mutex_lock(&alarm_lock);
+	for (i = 0; i < watches_count; i++)
+		close(watches[i].fd);
+	sensors_free(watches);
+	watches = NULL;
+	watches_count = watches_max = 0;
+
+	if (epoll_fd >= 0) {
+		close(timer_fd);
+		close(epoll_fd);
+		epoll_fd = timer_fd = -1;
+	}
+	poll_interval = 1000;
+	pthread_mutex_unlock(&alarm_lock);
+}
@@ -0,0 +1,184 @@
+/*
+    alloc.c - Part of libsensors, a Linux library for reading sensor data.
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+    MA 02110-1301 USA.
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include "sensors.h"
+#include "error.h"
+#include "alloc.h"
+
+/* All the memory of the library goes through these functions, so that
+   the application can provide its own allocator. The number of blocks
+   held is always tracked, so that the allocator can't be replaced while
+   blocks obtained from the previous one are still around. Accounting,
+   per phase of the thread doing the allocation, is optional. */
+
+static void *default_malloc(size_t size, void *ctx)
+{
+	(void)ctx; /* hide warning */
+	return malloc(size);
+}
+
+static void *default_realloc(void *ptr, size_t size, void *ctx)
+{
+	(void)ctx; /* hide warning */
+	return realloc(ptr, size);
+}
+
+static void default_free(void *ptr, void *ctx)
+{
+	(void)ctx; /* hide warning */
+	free(ptr);
+}
+
+static sensors_allocator allocator = {
+	default_malloc, default_realloc, default_free, NULL
+};
+
+static long alloc_blocks;		/* Currently held */
+static int alloc_accounting;
+static sensors_alloc_stats alloc_stats[SENSORS_ALLOC_PHASES];
+static __thread int alloc_phase;	/* SENSORS_ALLOC_RUNTIME */
+
+static void alloc_account(int allocs, int frees, size_t bytes)
+{
+	sensors_alloc_stats *stats = &alloc_stats[alloc_phase];
+
+	if (allocs) {
+		__atomic_add_fetch(&stats->allocs, 1, __ATOMIC_RELAXED);
+		__atomic_add_fetch(&stats->bytes, bytes, __ATOMIC_RELAXED);
+	}
+	if (frees)
+		__atomic_add_fetch(&stats->frees, 1, __ATOMIC_RELAXED);
+}
+
+void *sensors_malloc(size_t size)
+{
+	void *ptr;
+
+	ptr = allocator.malloc(size, allocator.ctx);
+	if (ptr) {
+		__atomic_add_fetch(&alloc_blocks, 1, __ATOMIC_RELAXED);
+		if (alloc_accounting)
+			alloc_account(1, 0, size);
+	}
+	return ptr;
+}
+
+void *sensors_calloc(size_t nmemb, size_t size)
+{
+	void *ptr;
+
+	if (size && nmemb > (size_t)-1 / size)
+		return NULL;
+	ptr = sensors_malloc(nmemb * size);
+	if (ptr)
+		memset(ptr, 0, nmemb * size);
+	return ptr;
+}
+
+void *sensors_realloc(void *ptr, size_t size)
+{
+	void *res;
+
+	res = allocator.realloc(ptr, size, allocator.ctx);
+	if (res) {
+		if (!ptr)
+			__atomic_add_fetch(&alloc_blocks, 1, __ATOMIC_RELAXED);
+		if (alloc_accounting)
+			alloc_account(1, ptr != NULL, size);
+	}
+	return res;
+}
+
+void sensors_free(void *ptr)
+{
+	if (!ptr)
+		return;
+	allocator.free(ptr, allocator.ctx);
+	__atomic_sub_fetch(&alloc_blocks, 1, __ATOMIC_RELAXED);
+	if (alloc_accounting)
+		alloc_account(0, 1, 0);
+}
+
+char *sensors_strndup(const char *s, size_t n)
+{
+	size_t len = strnlen(s, n);
+	char *res;
+
+	res = sensors_malloc(len + 1);
+	if (res) {
+		memcpy(res, s, len);
+		res[len] = '\0';
+	}
+	return res;
+}
+
+char *sensors_strdup(const char *s)
+{
+	return sensors_strndup(s, (size_t)-1);
+}
+
+int sensors_alloc_set_phase(int phase)
+{
+	int old = alloc_phase;
+
+	alloc_phase = phase;
+	return old;
+}
+
+int sensors_set_allocator(const sensors_allocator *a)
+{
+	if (__atomic_load_n(&alloc_blocks, __ATOMIC_RELAXED))
+		return -SENSORS_ERR_BUSY;
+
+	if (a) {
+		allocator = *a;
+	} else {
+		allocator.malloc = default_malloc;
+		allocator.realloc = default_realloc;
+		allocator.free = default_free;
+		allocator.ctx = NULL;
+	}
+	return 0;
+}
+
+void sensors_set_alloc_accounting(int enable)
+{
+	alloc_accounting = enable;
+}
+
+int sensors_get_alloc_stats(int phase, sensors_alloc_stats *stats)
+{
+	const sensors_alloc_stats *s;
+
+	if (phase < 0 || phase >= SENSORS_ALLOC_PHASES)
+		return -SENSORS_ERR_NO_ENTRY;
+
+	s = &alloc_stats[phase];
+	stats->allocs = __atomic_load_n(&s->allocs, __ATOMIC_RELAXED);
+	stats->frees = __atomic_load_n(&s->frees, __ATOMIC_RELAXED);
+	stats->bytes = __atomic_load_n(&s->bytes, __ATOMIC_RELAXED);
+	return 0;
+}
+
+void sensors_reset_alloc_stats(void)
+{
+	memset(alloc_stats, 0, sizeof(alloc_stats));
+}
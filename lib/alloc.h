@@ -0,0 +1,39 @@
+/*
+    alloc.h - Part of libsensors, a Linux library for reading sensor data.
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+    MA 02110-1301 USA.
+*/
+
+#ifndef LIB_SENSORS_ALLOC_H
+#define LIB_SENSORS_ALLOC_H
+
+#include <stddef.h>
+
+/* The library allocates all its memory with these, which use the
+   allocator set by sensors_set_allocator(). Memory handed over to the
+   application, to be freed with free(), must not come from here. */
+void *sensors_malloc(size_t size);
+void *sensors_calloc(size_t nmemb, size_t size);
+void *sensors_realloc(void *ptr, size_t size);
+void sensors_free(void *ptr);
+char *sensors_strdup(const char *s);
+char *sensors_strndup(const char *s, size_t n);
+
+/* Account the allocations of the calling thread to another phase.
+   Returns the previous phase, to be restored afterwards. */
+int sensors_alloc_set_phase(int phase);
+
+#endif /* def LIB_SENSORS_ALLOC_H */
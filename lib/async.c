@@ -0,0 +1,346 @@
+/*
+    async.c - Part of libsensors, a Linux library for reading sensor data.
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+    MA 02110-1301 USA.
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/eventfd.h>
+#include "sensors.h"
+#include "error.h"
+#include "alloc.h"
+#include "async.h"
+
+/* Asynchronous reads are queued, and performed by a small pool of
+   worker threads with sensors_get_values(). Workers only ever touch a
+   private copy of the requests, and of the chip names they point to;
+   the results are copied back to the caller's requests by
+   sensors_async_dispatch(), from the caller's thread, right before the
+   callback is called. This way a read can be cancelled at any time, even
+   while a worker is performing it, and the caller may free its requests
+   and chip names as soon as the cancellation returns.
+
+   A read goes from the submission queue to a worker, then to the
+   completion queue, where it stays until dispatched. The eventfd is
+   signaled each time a read enters the completion queue. */
+
+#define ASYNC_THREADS	4
+#define ASYNC_PENDING	64	/* Reads submitted but not dispatched yet */
+
+struct async_read {
+	struct async_read *next;
+	int id;
+	int cancelled;			/* Only set while running */
+	int count;
+	int err;			/* Result of sensors_get_values() */
+	sensors_value_request *reqs;	/* The caller's */
+	sensors_value_request *work;	/* Ours, for the workers */
+	sensors_chip_name *names;	/* Those work points to */
+	sensors_read_callback callback;
+	void *data;
+};
+
+struct async_queue {
+	struct async_read *head, *tail;
+};
+
+static struct async_queue submitted, completed;
+static struct async_read *running[ASYNC_THREADS];
+static int pending_count;
+static int next_id = 1;
+
+static pthread_t workers[ASYNC_THREADS];
+static int workers_count, workers_stopping;
+static int async_fd = -1;
+
+static pthread_mutex_t async_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t async_cond = PTHREAD_COND_INITIALIZER;
+
+static void async_push(struct async_queue *queue, struct async_read *job)
+{
+	job->next = NULL;
+	if (queue->tail)
+		queue->tail->next = job;
+	else
+		queue->head = job;
+	queue->tail = job;
+}
+
+static struct async_read *async_pop(struct async_queue *queue)
+{
+	struct async_read *job = queue->head;
+
+	if (job) {
+		queue->head = job->next;
+		if (!queue->head)
+			queue->tail = NULL;
+	}
+	return job;
+}
+
+/* Remove the read with the given id from a queue, return it or NULL */
+static struct async_read *async_unlink(struct async_queue *queue, int id)
+{
+	struct async_read *job, *prev = NULL;
+
+	for (job = queue->head; job; prev = job, job = job->next) {
+		if (job->id != id)
+			continue;
+		if (prev)
+			prev->next = job->next;
+		else
+			queue->head = job->next;
+		if (queue->tail == job)
+			queue->tail = prev;
+		return job;
+	}
+	return NULL;
+}
+
+static void async_free(struct async_read *job)
+{
+	int i;
+
+	for (i = 0; i < job->count; i++) {
+		sensors_free(job->names[i].prefix);
+		sensors_free(job->names[i].path);
+	}
+	sensors_free(job->names);
+	sensors_free(job->work);
+	sensors_free(job);
+}
+
+static char *async_strdup(const char *s)
+{
+	char *copy;
+
+	if (!s)
+		return NULL;
+	if (!(copy = sensors_strdup(s)))
+		sensors_fatal_error(__func__, "Out of memory");
+	return copy;
+}
+
+static void *async_worker(void *arg)
+{
+	struct async_read **slot = arg;
+	struct async_read *job;
+	uint64_t one = 1;
+	int err;
+
+	pthread_mutex_lock(&async_lock);
+	for (;;) {
+		while (!workers_stopping && !submitted.head)
+			pthread_cond_wait(&async_cond, &async_lock);
+		if (workers_stopping)
+			break;
+
+		job = async_pop(&submitted);
+		*slot = job;
+		pthread_mutex_unlock(&async_lock);
+
+		err = sensors_get_values(job->work, job->count);
+
+		pthread_mutex_lock(&async_lock);
+		*slot = NULL;
+		if (job->cancelled) {
+			async_free(job);
+			pending_count--;
+			continue;
+		}
+		job->err = err;
+		async_push(&completed, job);
+		if (write(async_fd, &one, sizeof(one)) < 0) {
+			/* Counter overflow, it is readable anyway */
+		}
+	}
+	pthread_mutex_unlock(&async_lock);
+
+	return NULL;
+}
+
+/* Called with async_lock held */
+static int async_setup(void)
+{
+	if (async_fd < 0) {
+		async_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+		if (async_fd < 0)
+			return -SENSORS_ERR_KERNEL;
+	}
+
+	workers_stopping = 0;
+	while (workers_count < ASYNC_THREADS) {
+		if (pthread_create(&workers[workers_count], NULL, async_worker,
+				   &running[workers_count]))
+			break;
+		workers_count++;
+	}
+	return workers_count ? 0 : -SENSORS_ERR_KERNEL;
+}
+
+int sensors_read_async(sensors_value_request *reqs, int count,
+		       sensors_read_callback callback, void *data)
+{
+	struct async_read *job;
+	int i, res;
+
+	if (count <= 0 || !callback)
+		return -SENSORS_ERR_NO_ENTRY;
+
+	pthread_mutex_lock(&async_lock);
+	if (pending_count >= ASYNC_PENDING) {
+		res = -SENSORS_ERR_BUSY;
+		goto exit_unlock;
+	}
+	if ((res = async_setup()))
+		goto exit_unlock;
+
+	job = sensors_calloc(1, sizeof(struct async_read));
+	if (!job)
+		sensors_fatal_error(__func__, "Out of memory");
+	job->work = sensors_malloc(count * sizeof(sensors_value_request));
+	job->names = sensors_calloc(count, sizeof(sensors_chip_name));
+	if (!job->work || !job->names)
+		sensors_fatal_error(__func__, "Out of memory");
+	memcpy(job->work, reqs, count * sizeof(sensors_value_request));
+	for (i = 0; i < count; i++) {
+		if (!reqs[i].name)
+			continue;
+		job->names[i] = *reqs[i].name;
+		job->names[i].prefix = async_strdup(reqs[i].name->prefix);
+		job->names[i].path = async_strdup(reqs[i].name->path);
+		job->work[i].name = &job->names[i];
+	}
+	job->count = count;
+	job->reqs = reqs;
+	job->callback = callback;
+	job->data = data;
+
+	job->id = res = next_id;
+	next_id = next_id == INT_MAX ? 1 : next_id + 1;
+
+	async_push(&submitted, job);
+	pending_count++;
+	pthread_cond_signal(&async_cond);
+
+exit_unlock:
+	pthread_mutex_unlock(&async_lock);
+	return res;
+}
+
+int sensors_async_fd(void)
+{
+	int res;
+
+	pthread_mutex_lock(&async_lock);
+	if (async_fd < 0)
+		async_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	res = async_fd < 0 ? -SENSORS_ERR_KERNEL : async_fd;
+	pthread_mutex_unlock(&async_lock);
+
+	return res;
+}
+
+int sensors_async_dispatch(void)
+{
+	struct async_read *done, *job;
+	uint64_t events;
+	int i, n = 0;
+
+	pthread_mutex_lock(&async_lock);
+	if (async_fd >= 0 && read(async_fd, &events, sizeof(events)) < 0) {
+		/* Nothing signaled, there may still be reads left over
+		   from a previous call */
+	}
+	done = completed.head;
+	completed.head = completed.tail = NULL;
+	for (job = done; job; job = job->next)
+		pending_count--;
+	pthread_mutex_unlock(&async_lock);
+
+	/* Callbacks may submit or cancel reads, so don't hold the lock */
+	while ((job = done)) {
+		done = job->next;
+		for (i = 0; i < job->count; i++) {
+			job->reqs[i].value = job->work[i].value;
+			job->reqs[i].err = job->work[i].err;
+		}
+		job->callback(job->reqs, job->count, job->err, job->data);
+		async_free(job);
+		n++;
+	}
+
+	return n;
+}
+
+int sensors_async_cancel(int id)
+{
+	struct async_read *job;
+	int i;
+
+	pthread_mutex_lock(&async_lock);
+	if ((job = async_unlink(&submitted, id)) ||
+	    (job = async_unlink(&completed, id))) {
+		async_free(job);
+		pending_count--;
+		goto exit_found;
+	}
+	for (i = 0; i < workers_count; i++) {
+		if (running[i] && running[i]->id == id) {
+			/* The worker will free it when done */
+			running[i]->cancelled = 1;
+			goto exit_found;
+		}
+	}
+	pthread_mutex_unlock(&async_lock);
+	return -SENSORS_ERR_NO_ENTRY;
+
+exit_found:
+	pthread_mutex_unlock(&async_lock);
+	return 0;
+}
+
+void sensors_async_cleanup(void)
+{
+	struct async_read *job;
+	int i;
+
+	pthread_mutex_lock(&async_lock);
+	workers_stopping = 1;
+	pthread_cond_broadcast(&async_cond);
+	pthread_mutex_unlock(&async_lock);
+
+	/* Workers finish the read they are performing first */
+	for (i = 0; i < workers_count; i++)
+		pthread_join(workers[i], NULL);
+	workers_count = 0;
+
+	while ((job = async_pop(&submitted)))
+		async_free(job);
+	while ((job = async_pop(&completed)))
+		async_free(job);
+	pending_count = 0;
+
+	if (async_fd >= 0) {
+		close(async_fd);
+		async_fd = -1;
+	}
+}
@@ -0,0 +1,205 @@
+/*
+    breaker.c - Part of libsensors, a Linux library for reading sensor data.
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+    MA 02110-1301 USA.
+*/
+
+#include <stdlib.h>
+#include <pthread.h>
+#include "sensors.h"
+#include "data.h"
+#include "error.h"
+#include "alloc.h"
+#include "general.h"
+#include "breaker.h"
+
+/* A wedged I2C device only fails a read once the bus driver times out,
+   which can take a second or more, and a chip has dozens of attributes.
+   Each chip has a breaker, which opens after a number of consecutive I/O
+   errors; reads then fail at once, except for a single probe now and
+   then, with an exponential backoff, to find out when the chip is back.
+   Other errors (missing or unreadable attribute) tell nothing about the
+   device, and are taken as a sign of life.
+
+   The state only changes on errors, so the lock is never taken while
+   chips work: the fast paths only load the state and failure count. */
+
+struct chip_breaker {
+	int state;			/* SENSORS_BREAKER_* */
+	int failures;
+	unsigned int backoff;		/* ms */
+	unsigned long long retry;	/* ns, when the next probe may go */
+	unsigned long long trips;
+	unsigned long long rejected;
+};
+
+static struct chip_breaker *breakers;	/* One per detected chip */
+static pthread_mutex_t breaker_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static unsigned int breaker_threshold = 3;
+static unsigned int breaker_backoff = 1000;
+static unsigned int breaker_max_backoff = 60000;
+
+void sensors_breakers_init(void)
+{
+	breakers = sensors_calloc(sensors_proc_chips_count ?
+				  sensors_proc_chips_count : 1,
+				  sizeof(struct chip_breaker));
+	if (!breakers)
+		sensors_fatal_error(__func__, "Out of memory");
+}
+
+void sensors_breakers_cleanup(void)
+{
+	sensors_free(breakers);
+	breakers = NULL;
+}
+
+/* Called with breaker_lock held */
+static void breaker_close(struct chip_breaker *b)
+{
+	__atomic_store_n(&b->failures, 0, __ATOMIC_RELAXED);
+	__atomic_store_n(&b->state, SENSORS_BREAKER_CLOSED, __ATOMIC_RELAXED);
+	b->backoff = 0;
+}
+
+int sensors_set_breaker(unsigned int threshold, unsigned int backoff,
+			unsigned int max_backoff)
+{
+	int i;
+
+	if (threshold && (!backoff || max_backoff < backoff))
+		return -SENSORS_ERR_NO_ENTRY;
+
+	pthread_mutex_lock(&breaker_lock);
+	__atomic_store_n(&breaker_threshold, threshold, __ATOMIC_RELAXED);
+	breaker_backoff = backoff;
+	breaker_max_backoff = max_backoff;
+	if (!threshold && breakers)
+		for (i = 0; i < sensors_proc_chips_count; i++)
+			breaker_close(&breakers[i]);
+	pthread_mutex_unlock(&breaker_lock);
+	return 0;
+}
+
+int sensors_breaker_check(int chip)
+{
+	struct chip_breaker *b;
+	int res = 0;
+
+	if (!breakers)
+		return 0;
+	b = &breakers[chip];
+	if (__atomic_load_n(&b->state, __ATOMIC_RELAXED) ==
+	    SENSORS_BREAKER_CLOSED)
+		return 0;
+
+	pthread_mutex_lock(&breaker_lock);
+	if (b->state == SENSORS_BREAKER_OPEN &&
+	    sensors_monotonic_ns() >= b->retry) {
+		/* This read is the probe */
+		__atomic_store_n(&b->state, SENSORS_BREAKER_PROBING,
+				 __ATOMIC_RELAXED);
+	} else if (b->state != SENSORS_BREAKER_CLOSED) {
+		b->rejected++;
+		res = -SENSORS_ERR_BREAKER;
+	}
+	pthread_mutex_unlock(&breaker_lock);
+
+	return res;
+}
+
+/* Called with breaker_lock held */
+static void breaker_open(struct chip_breaker *b, unsigned int backoff)
+{
+	b->backoff = backoff;
+	b->retry = sensors_monotonic_ns() + backoff * 1000000ULL;
+	__atomic_store_n(&b->state, SENSORS_BREAKER_OPEN, __ATOMIC_RELAXED);
+}
+
+void sensors_breaker_report(int chip, int err)
+{
+	struct chip_breaker *b;
+	unsigned int threshold;
+
+	if (!breakers)
+		return;
+	b = &breakers[chip];
+
+	if (err != -SENSORS_ERR_IO) {
+		if (__atomic_load_n(&b->state, __ATOMIC_RELAXED) ==
+		    SENSORS_BREAKER_CLOSED &&
+		    !__atomic_load_n(&b->failures, __ATOMIC_RELAXED))
+			return;
+
+		pthread_mutex_lock(&breaker_lock);
+		breaker_close(b);
+		pthread_mutex_unlock(&breaker_lock);
+		return;
+	}
+
+	threshold = __atomic_load_n(&breaker_threshold, __ATOMIC_RELAXED);
+	if (!threshold)
+		return;
+
+	pthread_mutex_lock(&breaker_lock);
+	__atomic_store_n(&b->failures, b->failures + 1, __ATOMIC_RELAXED);
+	if (b->state == SENSORS_BREAKER_PROBING) {
+		breaker_open(b, b->backoff < breaker_max_backoff / 2 ?
+				b->backoff * 2 : breaker_max_backoff);
+	} else if (b->state == SENSORS_BREAKER_CLOSED &&
+		   b->failures >= (int)threshold) {
+		b->trips++;
+		breaker_open(b, breaker_backoff);
+	}
+	pthread_mutex_unlock(&breaker_lock);
+}
+
+void sensors_breaker_add_stats(int chip, sensors_breaker_stats *stats)
+{
+	const struct chip_breaker *b;
+
+	if (!breakers)
+		return;
+	b = &breakers[chip];
+
+	pthread_mutex_lock(&breaker_lock);
+	if (b->state > stats->state)
+		stats->state = b->state;
+	if (b->failures > stats->failures)
+		stats->failures = b->failures;
+	if (b->state != SENSORS_BREAKER_CLOSED &&
+	    b->backoff > stats->backoff)
+		stats->backoff = b->backoff;
+	stats->trips += b->trips;
+	stats->rejected += b->rejected;
+	pthread_mutex_unlock(&breaker_lock);
+}
+
+void sensors_breaker_reset_stats(void)
+{
+	int i;
+
+	if (!breakers)
+		return;
+
+	pthread_mutex_lock(&breaker_lock);
+	for (i = 0; i < sensors_proc_chips_count; i++) {
+		breakers[i].trips = 0;
+		breakers[i].rejected = 0;
+	}
+	pthread_mutex_unlock(&breaker_lock);
+}
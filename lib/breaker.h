@@ -0,0 +1,43 @@
+/*
+    breaker.h - Part of libsensors, a Linux library for reading sensor data.
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+    MA 02110-1301 USA.
+*/
+
+#ifndef LIB_SENSORS_BREAKER_H
+#define LIB_SENSORS_BREAKER_H
+
+#include "sensors.h"
+
+/* Set up a breaker for each detected chip, and free them before the chip
+   list goes away */
+void sensors_breakers_init(void);
+void sensors_breakers_cleanup(void);
+
+/* Called before reading from chip number chip (an index into
+   sensors_proc_chips). Returns -SENSORS_ERR_BREAKER if the read must
+   not be attempted, 0 otherwise. */
+int sensors_breaker_check(int chip);
+
+/* Called with the result of each read which sensors_breaker_check()
+   let through */
+void sensors_breaker_report(int chip, int err);
+
+/* Merge the state of chip into stats, for sensors_get_stats() */
+void sensors_breaker_add_stats(int chip, sensors_breaker_stats *stats);
+void sensors_breaker_reset_stats(void);
+
+#endif /* def LIB_SENSORS_BREAKER_H */
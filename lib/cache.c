@@ -0,0 +1,563 @@
+/*
+    cache.c - Part of libsensors, a Linux library for reading sensor data.
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+    MA 02110-1301 USA.
+*/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <limits.h>
+#include <unistd.h>
+#include <pthread.h>
+#include "sensors.h"
+#include "data.h"
+#include "error.h"
+#include "alloc.h"
+#include "general.h"
+#include "sysfs.h"
+#include "stats.h"
+#include "breaker.h"
+#include "cache.h"
+
+/* Most drivers only refresh their values every second or two, so reading
+   the same attribute more often returns the same value, at the price of
+   a bus transaction in some cases. The value cache keeps the raw value
+   of each subfeature for a per-chip time to live. While a value is being
+   read from sysfs, other threads asking for it wait for that read and
+   share its result instead of reading again.
+
+   Limits and settings only change when written, so they can be cached
+   for good (SENSORS_CACHE_STATIC), and most alarms then follow from them
+   and the input value (SENSORS_CACHE_SOFT_ALARMS). */
+
+#define CACHE_EMPTY	0
+#define CACHE_VALID	1
+#define CACHE_READING	2
+
+#define CACHE_FOREVER	(~0ULL)
+
+/* Inputs read longer ago than this aren't used to derive alarms */
+#define SOFT_ALARM_AGE	1000000000ULL	/* ns */
+
+struct cache_entry {
+	unsigned long long timestamp;
+	double value;
+	int err;			/* Result of the last read */
+	int state;
+	int invalid;			/* Invalidated while reading */
+};
+
+struct chip_cache {
+	pthread_mutex_t lock;
+	pthread_cond_t done;		/* Signaled when a read completes */
+	unsigned long long ttl;		/* ns, 0 if not caching */
+	struct cache_entry *entries;	/* One per subfeature, allocated on
+					   first use */
+	signed char *unmapped;		/* One per feature: 1 if it has limits
+					   not known to libsensors, -1 if not,
+					   0 if not checked yet */
+};
+
+/* One per detected chip, NULL if the cache is disabled */
+static struct chip_cache *chip_caches;
+static int chip_caches_count;
+static int cache_ttl_enabled;
+static int cache_flags;
+
+static int read_sysfs(const sensors_chip_features *chip,
+		      const sensors_subfeature *subfeature,
+		      double *value, unsigned long long *timestamp)
+{
+	int err;
+
+	*timestamp = sensors_stats_begin();
+	if ((err = sensors_breaker_check(chip - sensors_proc_chips)))
+		return err;
+	err = sensors_read_sysfs_attr(chip, subfeature, value);
+	sensors_stats_end(chip - sensors_proc_chips, SENSORS_STATS_READ,
+			  *timestamp, err);
+	sensors_breaker_report(chip - sensors_proc_chips, err);
+	return err;
+}
+
+/* Called with the cache locked */
+static struct cache_entry *get_entry(struct chip_cache *cache,
+				     const sensors_chip_features *chip,
+				     const sensors_subfeature *subfeature)
+{
+	if (!cache->entries) {
+		cache->entries = sensors_calloc(chip->subfeature_count ?
+						chip->subfeature_count : 1,
+						sizeof(struct cache_entry));
+		if (!cache->entries)
+			sensors_fatal_error(__func__, "Out of memory");
+	}
+	return &cache->entries[subfeature->number];
+}
+
+/* Returns the cache of a chip, or NULL if the subfeature isn't cached,
+   and sets ttl to its time to live. With soft alarms, the values read
+   are recorded even if they aren't cached (ttl is 0). */
+static struct chip_cache *get_chip_cache(const sensors_chip_features *chip,
+					 const sensors_subfeature *subfeature,
+					 unsigned long long *ttl)
+{
+	struct chip_cache *cache;
+
+	if (!chip_caches)
+		return NULL;
+	cache = &chip_caches[chip - sensors_proc_chips];
+	if ((cache_flags & SENSORS_CACHE_STATIC) &&
+	    (subfeature->flags & SENSORS_STATIC_VALUE))
+		*ttl = CACHE_FOREVER;
+	else
+		*ttl = __atomic_load_n(&cache->ttl, __ATOMIC_RELAXED);
+	return *ttl || (cache_flags & SENSORS_CACHE_SOFT_ALARMS) ? cache : NULL;
+}
+
+static int entry_fresh(const struct cache_entry *entry, unsigned long long ttl)
+{
+	return entry->state == CACHE_VALID &&
+	       (ttl == CACHE_FOREVER ||
+		sensors_monotonic_ns() - entry->timestamp < ttl);
+}
+
+/* The limits each alarm compares the input of its feature against */
+static const struct alarm_limit {
+	sensors_subfeature_type alarm;
+	sensors_subfeature_type limit;
+	int below;			/* Low limit */
+} alarm_limits[] = {
+	{ SENSORS_SUBFEATURE_IN_ALARM, SENSORS_SUBFEATURE_IN_MIN, 1 },
+	{ SENSORS_SUBFEATURE_IN_ALARM, SENSORS_SUBFEATURE_IN_MAX, 0 },
+	{ SENSORS_SUBFEATURE_IN_MIN_ALARM, SENSORS_SUBFEATURE_IN_MIN, 1 },
+	{ SENSORS_SUBFEATURE_IN_MAX_ALARM, SENSORS_SUBFEATURE_IN_MAX, 0 },
+	{ SENSORS_SUBFEATURE_FAN_ALARM, SENSORS_SUBFEATURE_FAN_MIN, 1 },
+	{ SENSORS_SUBFEATURE_TEMP_ALARM, SENSORS_SUBFEATURE_TEMP_MIN, 1 },
+	{ SENSORS_SUBFEATURE_TEMP_ALARM, SENSORS_SUBFEATURE_TEMP_MAX, 0 },
+	{ SENSORS_SUBFEATURE_TEMP_ALARM, SENSORS_SUBFEATURE_TEMP_CRIT, 0 },
+	{ SENSORS_SUBFEATURE_TEMP_MIN_ALARM, SENSORS_SUBFEATURE_TEMP_MIN, 1 },
+	{ SENSORS_SUBFEATURE_TEMP_MAX_ALARM, SENSORS_SUBFEATURE_TEMP_MAX, 0 },
+	{ SENSORS_SUBFEATURE_TEMP_CRIT_ALARM, SENSORS_SUBFEATURE_TEMP_CRIT, 0 },
+	{ SENSORS_SUBFEATURE_CURR_ALARM, SENSORS_SUBFEATURE_CURR_MIN, 1 },
+	{ SENSORS_SUBFEATURE_CURR_ALARM, SENSORS_SUBFEATURE_CURR_MAX, 0 },
+	{ SENSORS_SUBFEATURE_CURR_MIN_ALARM, SENSORS_SUBFEATURE_CURR_MIN, 1 },
+	{ SENSORS_SUBFEATURE_CURR_MAX_ALARM, SENSORS_SUBFEATURE_CURR_MAX, 0 },
+};
+
+#define ALARM_LIMITS	(int)(sizeof(alarm_limits) / sizeof(alarm_limits[0]))
+
+static int has_limits(sensors_subfeature_type alarm)
+{
+	int i;
+
+	for (i = 0; i < ALARM_LIMITS; i++)
+		if (alarm_limits[i].alarm == alarm)
+			return 1;
+	return 0;
+}
+
+/* The limit attributes of the sysfs interface an alarm may be raised on.
+   Not all of them are known to libsensors (lcrit and emergency aren't,
+   nor the crit limit of voltages and currents), and an alarm can't be
+   derived without all of its limits. */
+static const char *const limit_attrs[] = {
+	"min", "max", "lcrit", "crit", "emergency", NULL
+};
+
+/* Tell whether a feature has limit attributes in sysfs which it has no
+   subfeature for */
+static int has_unmapped_limits(const sensors_chip_features *chip,
+			       const sensors_feature *feature)
+{
+	char n[NAME_MAX];
+	const char *const *attr;
+	int i, mapped;
+
+	if (!chip->chip.path)
+		return 1;
+
+	for (attr = limit_attrs; *attr; attr++) {
+		snprintf(n, NAME_MAX, "%s_%s", feature->name, *attr);
+		mapped = 0;
+		for (i = feature->first_subfeature;
+		     i < chip->subfeature_count &&
+		     chip->subfeature[i].mapping == feature->number; i++)
+			if (!strcmp(chip->subfeature[i].name, n))
+				mapped = 1;
+		if (mapped)
+			continue;
+
+		snprintf(n, NAME_MAX, "%s/%s_%s", chip->chip.path,
+			 feature->name, *attr);
+		if (!access(n, F_OK))
+			return 1;
+	}
+	return 0;
+}
+
+/* Find another subfeature of the same feature */
+static const sensors_subfeature *
+get_sibling(const sensors_chip_features *chip,
+	    const sensors_subfeature *subfeature, sensors_subfeature_type type)
+{
+	int i;
+
+	for (i = chip->feature[subfeature->mapping].first_subfeature;
+	     i < chip->subfeature_count &&
+	     chip->subfeature[i].mapping == subfeature->mapping; i++)
+		if (chip->subfeature[i].type == type)
+			return &chip->subfeature[i];
+	return NULL;
+}
+
+/* Derive an alarm which was clear on its last hardware read from the
+   limits and the last input value, if the input is within all limits.
+   Returns 1 if it did, 0 if the hardware must be read. The comparisons
+   are done on the raw values, the way the hardware does them; the alarm
+   is read from the hardware at the limit itself, and whenever it may
+   also be raised on a limit libsensors doesn't know about. */
+static int soft_alarm(const sensors_chip_features *chip,
+		      const sensors_subfeature *subfeature,
+		      double *value, unsigned long long *timestamp)
+{
+	struct chip_cache *cache;
+	struct cache_entry *entry;
+	const sensors_subfeature *input, *limit;
+	unsigned long long ts, ttl;
+	double in, lim;
+	int i, ok, unmapped, found = 0;
+
+	if (!(cache_flags & SENSORS_CACHE_SOFT_ALARMS) ||
+	    !has_limits(subfeature->type) ||
+	    !(input = get_sibling(chip, subfeature, subfeature->type & ~0xFF)))
+		return 0;
+	cache = &chip_caches[chip - sensors_proc_chips];
+
+	pthread_mutex_lock(&cache->lock);
+	entry = get_entry(cache, chip, subfeature);
+	ok = entry->state == CACHE_VALID && entry->value == 0;
+	entry = get_entry(cache, chip, input);
+	ok = ok && entry_fresh(entry, SOFT_ALARM_AGE);
+	in = entry->value;
+	ts = entry->timestamp;
+	if (!cache->unmapped) {
+		cache->unmapped = sensors_calloc(chip->feature_count ?
+						 chip->feature_count : 1, 1);
+		if (!cache->unmapped)
+			sensors_fatal_error(__func__, "Out of memory");
+	}
+	unmapped = cache->unmapped[subfeature->mapping];
+	pthread_mutex_unlock(&cache->lock);
+	if (!ok)
+		return 0;
+
+	/* Only the alarms of the whole feature (in0_alarm, temp1_alarm...)
+	   can be raised on other limits. Checked once per feature, outside
+	   of the lock. */
+	if ((subfeature->type & 0xFF) == 0x80) {
+		if (!unmapped) {
+			unmapped = has_unmapped_limits(chip,
+				&chip->feature[subfeature->mapping]) ? 1 : -1;
+			pthread_mutex_lock(&cache->lock);
+			cache->unmapped[subfeature->mapping] = unmapped;
+			pthread_mutex_unlock(&cache->lock);
+		}
+		if (unmapped > 0)
+			return 0;
+	}
+
+	for (i = 0; i < ALARM_LIMITS; i++) {
+		if (alarm_limits[i].alarm != subfeature->type ||
+		    !(limit = get_sibling(chip, subfeature,
+					  alarm_limits[i].limit)))
+			continue;
+		if (sensors_read_subfeature(chip, limit, &lim, &ttl))
+			return 0;
+		if (alarm_limits[i].below ? in <= lim : in >= lim)
+			return 0;
+		found = 1;
+	}
+	if (!found)
+		return 0;
+
+	*value = 0;
+	*timestamp = ts;
+	return 1;
+}
+
+int sensors_read_subfeature(const sensors_chip_features *chip,
+			    const sensors_subfeature *subfeature,
+			    double *value, unsigned long long *timestamp)
+{
+	struct chip_cache *cache;
+	struct cache_entry *entry;
+	unsigned long long ts, ttl;
+	double val;
+	int err;
+
+	if (!(cache = get_chip_cache(chip, subfeature, &ttl)))
+		return read_sysfs(chip, subfeature, value, timestamp);
+	if (soft_alarm(chip, subfeature, value, timestamp))
+		return 0;
+
+	pthread_mutex_lock(&cache->lock);
+	entry = get_entry(cache, chip, subfeature);
+
+	if (entry->state == CACHE_READING) {
+		/* Someone else is reading, share the result */
+		while (entry->state == CACHE_READING)
+			pthread_cond_wait(&cache->done, &cache->lock);
+		goto exit_unlock;
+	}
+
+	if (entry_fresh(entry, ttl))
+		goto exit_unlock;
+
+	entry->state = CACHE_READING;
+	entry->invalid = 0;
+	pthread_mutex_unlock(&cache->lock);
+
+	err = read_sysfs(chip, subfeature, &val, &ts);
+
+	pthread_mutex_lock(&cache->lock);
+	entry->err = err;
+	if (!err) {
+		entry->value = val;
+		entry->timestamp = ts;
+	}
+	entry->state = err || entry->invalid ? CACHE_EMPTY : CACHE_VALID;
+	pthread_cond_broadcast(&cache->done);
+
+exit_unlock:
+	err = entry->err;
+	if (!err) {
+		*value = entry->value;
+		*timestamp = entry->timestamp;
+	}
+	pthread_mutex_unlock(&cache->lock);
+	return err;
+}
+
+int sensors_cache_lookup(const sensors_chip_features *chip,
+			 const sensors_subfeature *subfeature, double *value)
+{
+	struct chip_cache *cache;
+	struct cache_entry *entry;
+	unsigned long long ttl, ts;
+	int hit = 0;
+
+	if (!(cache = get_chip_cache(chip, subfeature, &ttl)))
+		return 0;
+	if (soft_alarm(chip, subfeature, value, &ts))
+		return 1;
+
+	pthread_mutex_lock(&cache->lock);
+	entry = get_entry(cache, chip, subfeature);
+	if (entry_fresh(entry, ttl)) {
+		*value = entry->value;
+		hit = 1;
+	}
+	pthread_mutex_unlock(&cache->lock);
+
+	return hit;
+}
+
+void sensors_cache_store(const sensors_chip_features *chip,
+			 const sensors_subfeature *subfeature, double value,
+			 unsigned long long timestamp)
+{
+	struct chip_cache *cache;
+	struct cache_entry *entry;
+	unsigned long long ttl;
+
+	if (!(cache = get_chip_cache(chip, subfeature, &ttl)))
+		return;
+
+	pthread_mutex_lock(&cache->lock);
+	entry = get_entry(cache, chip, subfeature);
+	/* If a read is in progress, its result will be recorded instead */
+	if (entry->state != CACHE_READING) {
+		entry->value = value;
+		entry->timestamp = timestamp;
+		entry->err = 0;
+		entry->state = CACHE_VALID;
+	}
+	pthread_mutex_unlock(&cache->lock);
+}
+
+/* Called with the cache locked */
+static void invalidate_entry(struct cache_entry *entry)
+{
+	if (entry->state == CACHE_READING)
+		entry->invalid = 1;	/* The value read may be outdated */
+	else
+		entry->state = CACHE_EMPTY;
+}
+
+void sensors_cache_invalidate_subfeature(const sensors_chip_features *chip,
+					 const sensors_subfeature *subfeature)
+{
+	struct chip_cache *cache;
+
+	if (!chip_caches)
+		return;
+	cache = &chip_caches[chip - sensors_proc_chips];
+
+	pthread_mutex_lock(&cache->lock);
+	invalidate_entry(get_entry(cache, chip, subfeature));
+	pthread_mutex_unlock(&cache->lock);
+}
+
+int sensors_cache_invalidate(const sensors_chip_name *name)
+{
+	const sensors_chip_name *chip;
+	struct chip_cache *cache;
+	int i, nr = 0;
+
+	if (!chip_caches)
+		return 0;
+
+	while ((chip = sensors_get_detected_chips(name, &nr))) {
+		/* nr is the index of the chip, plus one */
+		cache = &chip_caches[nr - 1];
+		pthread_mutex_lock(&cache->lock);
+		if (cache->entries)
+			for (i = 0; i < sensors_proc_chips[nr - 1].subfeature_count;
+			     i++)
+				invalidate_entry(&cache->entries[i]);
+		pthread_mutex_unlock(&cache->lock);
+	}
+
+	return 0;
+}
+
+static void alloc_chip_caches(void)
+{
+	int i;
+
+	chip_caches = sensors_calloc(sensors_proc_chips_count,
+				     sizeof(struct chip_cache));
+	if (!chip_caches)
+		sensors_fatal_error(__func__, "Out of memory");
+	chip_caches_count = sensors_proc_chips_count;
+
+	for (i = 0; i < chip_caches_count; i++) {
+		pthread_mutex_init(&chip_caches[i].lock, NULL);
+		pthread_cond_init(&chip_caches[i].done, NULL);
+	}
+}
+
+static void free_chip_caches(void)
+{
+	int i;
+
+	if (!chip_caches)
+		return;
+
+	for (i = 0; i < chip_caches_count; i++) {
+		pthread_mutex_destroy(&chip_caches[i].lock);
+		pthread_cond_destroy(&chip_caches[i].done);
+		sensors_free(chip_caches[i].entries);
+		sensors_free(chip_caches[i].unmapped);
+	}
+	sensors_free(chip_caches);
+	chip_caches = NULL;
+	chip_caches_count = 0;
+}
+
+int sensors_cache_enable(unsigned int ttl)
+{
+	const sensors_chip_features *chip;
+	unsigned int interval;
+	int i;
+
+	/* Start afresh */
+	free_chip_caches();
+	if (!sensors_proc_chips_count)
+		return 0;
+	alloc_chip_caches();
+	cache_ttl_enabled = 1;
+
+	for (i = 0; i < chip_caches_count; i++) {
+		chip = &sensors_proc_chips[i];
+
+		/* The driver knows best how often its values change */
+		interval = sensors_read_sysfs_update_interval(&chip->chip);
+		chip_caches[i].ttl = (unsigned long long)(interval ? interval :
+							  ttl) * 1000000ULL;
+	}
+
+	return 0;
+}
+
+int sensors_cache_set_ttl(const sensors_chip_name *name, unsigned int ttl)
+{
+	const sensors_chip_name *chip;
+	int nr = 0, found = 0;
+
+	if (!cache_ttl_enabled)
+		return -SENSORS_ERR_NO_ENTRY;
+
+	while ((chip = sensors_get_detected_chips(name, &nr))) {
+		/* nr is the index of the chip, plus one */
+		__atomic_store_n(&chip_caches[nr - 1].ttl,
+				 (unsigned long long)ttl * 1000000ULL,
+				 __ATOMIC_RELAXED);
+		found = 1;
+	}
+
+	return found ? 0 : -SENSORS_ERR_NO_ENTRY;
+}
+
+void sensors_cache_disable(void)
+{
+	int i;
+
+	cache_ttl_enabled = 0;
+	if (!cache_flags) {
+		free_chip_caches();
+		return;
+	}
+
+	/* Keep the static values */
+	for (i = 0; i < chip_caches_count; i++)
+		chip_caches[i].ttl = 0;
+}
+
+int sensors_cache_set_flags(int flags)
+{
+	if (flags & ~(SENSORS_CACHE_STATIC | SENSORS_CACHE_SOFT_ALARMS))
+		return -SENSORS_ERR_NO_ENTRY;
+	if (flags & SENSORS_CACHE_SOFT_ALARMS)
+		flags |= SENSORS_CACHE_STATIC;
+
+	cache_flags = flags;
+	if (flags && !chip_caches && sensors_proc_chips_count)
+		alloc_chip_caches();
+	else if (!flags && !cache_ttl_enabled)
+		free_chip_caches();
+
+	return 0;
+}
+
+void sensors_cache_cleanup(void)
+{
+	free_chip_caches();
+	cache_ttl_enabled = 0;
+	cache_flags = 0;
+}
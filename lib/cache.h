@@ -0,0 +1,51 @@
+/*
+    cache.h - Part of libsensors, a Linux library for reading sensor data.
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+    MA 02110-1301 USA.
+*/
+
+#ifndef LIB_SENSORS_CACHE_H
+#define LIB_SENSORS_CACHE_H
+
+#include "data.h"
+
+/* Read the raw value of a subfeature, from the value cache if it is
+   enabled for this chip and the cached value is recent enough, from
+   sysfs otherwise. timestamp is set to the time of the sysfs read.
+   Returns 0 on success, <0 on failure. */
+int sensors_read_subfeature(const sensors_chip_features *chip,
+			    const sensors_subfeature *subfeature,
+			    double *value, unsigned long long *timestamp);
+
+/* For batched reads: return 1 and fill value if the cache holds a
+   recent enough value for the subfeature, 0 otherwise. */
+int sensors_cache_lookup(const sensors_chip_features *chip,
+			 const sensors_subfeature *subfeature, double *value);
+
+/* For batched reads: record the value just read from sysfs at time
+   timestamp. Does nothing if the cache is disabled for this chip. */
+void sensors_cache_store(const sensors_chip_features *chip,
+			 const sensors_subfeature *subfeature, double value,
+			 unsigned long long timestamp);
+
+/* Drop the cached value of a subfeature, after it was written */
+void sensors_cache_invalidate_subfeature(const sensors_chip_features *chip,
+					 const sensors_subfeature *subfeature);
+
+/* Disable the cache and reset the caching modes */
+void sensors_cache_cleanup(void);
+
+#endif /* def LIB_SENSORS_CACHE_H */
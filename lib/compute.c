@@ -0,0 +1,188 @@
+/*
+    compute.c - Part of libsensors, a Linux library for reading sensor data.
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+    MA 02110-1301 USA.
+*/
+
+#include <stdlib.h>
+#include "sensors.h"
+#include "data.h"
+#include "error.h"
+#include "alloc.h"
+#include "general.h"
+#include "access.h"
+#include "compute.h"
+
+/* Each subfeature of each detected chip has a node, chip i's in
+   chip_nodes[i], which holds the compute statement applying to it and the
+   subfeatures its expression refers to. The graph is built once the
+   configuration is loaded, so reads don't have to search the
+   configuration for compute statements, and values can be evaluated in
+   dependency order, each read only once. With lazy discovery, the nodes
+   of a chip are only built once its features are enumerated. */
+
+static sensors_compute_node **chip_nodes;	/* NULL if not built */
+
+/* Add the subfeatures the variables of expr refer to, once each */
+static void collect_deps(const sensors_chip_features *chip,
+			 const sensors_expr *expr, sensors_compute_node *node,
+			 int *deps_max)
+{
+	const sensors_subfeature *subfeature;
+	int i;
+
+	switch (expr->kind) {
+	case sensors_kind_var:
+		/* Unknown variables fail at evaluation time */
+		subfeature = sensors_lookup_subfeature_name(chip,
+							    expr->data.var);
+		if (!subfeature)
+			return;
+		for (i = 0; i < node->deps_count; i++)
+			if (node->deps[i] == subfeature->number)
+				return;
+		sensors_add_array_el(&subfeature->number, &node->deps,
+				     &node->deps_count, deps_max, sizeof(int));
+		return;
+	case sensors_kind_sub:
+		collect_deps(chip, expr->data.subexpr.sub1, node, deps_max);
+		if (expr->data.subexpr.sub2)
+			collect_deps(chip, expr->data.subexpr.sub2, node,
+				     deps_max);
+		return;
+	default:
+		return;
+	}
+}
+
+#define RANK_UNKNOWN	(-2)
+#define RANK_VISITING	(-3)
+
+/* Nodes without compute statement come first, with rank 0, then each
+   node comes after all those it depends on. Nodes which are part of a
+   cycle, or depend on one, get rank -1. */
+static int compute_rank(sensors_compute_node *nodes, int nr)
+{
+	sensors_compute_node *node = &nodes[nr];
+	int i, rank, max = 0;
+
+	if (node->rank == RANK_VISITING)
+		return -1;
+	if (node->rank != RANK_UNKNOWN)
+		return node->rank;
+
+	node->rank = RANK_VISITING;
+	for (i = 0; i < node->deps_count; i++) {
+		rank = compute_rank(nodes, node->deps[i]);
+		if (rank < 0) {
+			max = -1;
+			break;
+		}
+		if (rank > max)
+			max = rank;
+	}
+	node->rank = max < 0 ? -1 : node->from_proc ? max + 1 : 0;
+
+	return node->rank;
+}
+
+void sensors_build_chip_compute_graph(const sensors_chip_features *chip)
+{
+	const sensors_compute *compute;
+	sensors_compute_node *nodes, *node;
+	int j, deps_max;
+
+	if (!chip_nodes)
+		return;
+
+	nodes = sensors_calloc(chip->subfeature_count ?
+			       chip->subfeature_count : 1,
+			       sizeof(sensors_compute_node));
+	if (!nodes)
+		sensors_fatal_error(__func__, "Out of memory");
+
+	for (j = 0; j < chip->subfeature_count; j++) {
+		node = &nodes[j];
+		node->rank = RANK_UNKNOWN;
+		compute = sensors_lookup_compute(chip, &chip->subfeature[j]);
+		if (!compute)
+			continue;
+		node->from_proc = compute->from_proc;
+		node->to_proc = compute->to_proc;
+		deps_max = 0;
+		collect_deps(chip, compute->from_proc, node, &deps_max);
+	}
+	for (j = 0; j < chip->subfeature_count; j++)
+		compute_rank(nodes, j);
+
+	chip_nodes[chip - sensors_proc_chips] = nodes;
+}
+
+void sensors_build_compute_graph(void)
+{
+	int i;
+
+	chip_nodes = sensors_calloc(sensors_proc_chips_count ?
+				    sensors_proc_chips_count : 1,
+				    sizeof(sensors_compute_node *));
+	if (!chip_nodes)
+		sensors_fatal_error(__func__, "Out of memory");
+
+	for (i = 0; i < sensors_proc_chips_count; i++)
+		if (sensors_proc_chips[i].loaded)
+			sensors_build_chip_compute_graph(&sensors_proc_chips[i]);
+}
+
+void sensors_free_compute_graph(void)
+{
+	sensors_compute_node *nodes;
+	int i, j;
+
+	if (!chip_nodes)
+		return;
+
+	for (i = 0; i < sensors_proc_chips_count; i++) {
+		if (!(nodes = chip_nodes[i]))
+			continue;
+		for (j = 0; j < sensors_proc_chips[i].subfeature_count; j++)
+			sensors_free(nodes[j].deps);
+		sensors_free(nodes);
+	}
+	sensors_free(chip_nodes);
+	chip_nodes = NULL;
+}
+
+const sensors_compute_node *
+sensors_get_compute_node(const sensors_chip_features *chip, int subfeat_nr)
+{
+	sensors_compute_node *nodes;
+
+	if (!chip_nodes || !(nodes = chip_nodes[chip - sensors_proc_chips]))
+		return NULL;
+	return &nodes[subfeat_nr];
+}
+
+int sensors_compute_node_index(const sensors_chip_features *chip,
+			       int subfeat_nr)
+{
+	return chip->subfeature_base + subfeat_nr;
+}
+
+int sensors_compute_nodes_count(void)
+{
+	return __atomic_load_n(&sensors_proc_subfeatures_count,
+			       __ATOMIC_RELAXED);
+}
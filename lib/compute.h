@@ -0,0 +1,53 @@
+/*
+    compute.h - Part of libsensors, a Linux library for reading sensor data.
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+    MA 02110-1301 USA.
+*/
+
+#ifndef LIB_SENSORS_COMPUTE_H
+#define LIB_SENSORS_COMPUTE_H
+
+#include "data.h"
+
+/* The compute statement of a subfeature, and the subfeatures (of the same
+   chip) which its from_proc expression refers to */
+typedef struct sensors_compute_node {
+	const sensors_expr *from_proc;	/* NULL if no compute statement */
+	const sensors_expr *to_proc;
+	int *deps;			/* Subfeature numbers */
+	int deps_count;
+	int rank;			/* Evaluation order, -1 in a cycle */
+} sensors_compute_node;
+
+/* Build the graph once the chips are detected and the configuration is
+   loaded, and free it before either goes away */
+void sensors_build_compute_graph(void);
+void sensors_free_compute_graph(void);
+
+/* Add the nodes of a chip loaded after the graph was built */
+void sensors_build_chip_compute_graph(const sensors_chip_features *chip);
+
+/* Returns NULL if the graph isn't built */
+const sensors_compute_node *
+sensors_get_compute_node(const sensors_chip_features *chip, int subfeat_nr);
+
+/* Index of a subfeature among those of all loaded chips, below
+   sensors_compute_nodes_count(), which grows as chips get loaded */
+int sensors_compute_node_index(const sensors_chip_features *chip,
+			       int subfeat_nr);
+int sensors_compute_nodes_count(void);
+
+#endif /* def LIB_SENSORS_COMPUTE_H */
@@ -24,23 +24,35 @@
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
+#include <limits.h>
 
 #include "data.h"
 #include "general.h"
 #include "error.h"
+#include "alloc.h"
 #include "conf.h"
 #include "access.h"
 #include "init.h"
+#include "sysfs.h"
 
-static void sensors_yyerror(const char *err);
+/* The parser stack, if it grows, comes from the library allocator too */
+#define YYMALLOC sensors_malloc
+#define YYFREE sensors_free
+
+static void sensors_yyerror(sensors_parse_state *state, void *scanner,
+			    const char *err);
+static void before_first_chip(sensors_parse_state *state, const char *err);
 static sensors_expr *malloc_expr(void);
+static int expr_has_kind(const sensors_expr *expr, sensors_expr_kind kind);
+static int check_interval(sensors_parse_state *state, void *scanner,
+			  double value);
 
-static sensors_chip *current_chip = NULL;
+#define current_chip (state->current_chip)
 
 #define bus_add_el(el) sensors_add_array_el(el,\
-                                      &sensors_config_busses,\
-                                      &sensors_config_busses_count,\
-                                      &sensors_config_busses_max,\
+                                      &state->busses,\
+                                      &state->busses_count,\
+                                      &state->busses_max,\
                                       sizeof(sensors_bus))
 #define label_add_el(el) sensors_add_array_el(el,\
                                         &current_chip->labels,\
@@ -62,10 +74,20 @@ static sensors_chip *current_chip = NULL;
                                           &current_chip->ignores_count,\
                                           &current_chip->ignores_max,\
                                           sizeof(sensors_ignore));
+#define feature_add_el(el) sensors_add_array_el(el,\
+                                          &current_chip->features,\
+                                          &current_chip->features_count,\
+                                          &current_chip->features_max,\
+                                          sizeof(sensors_virtual_feature));
+#define interval_add_el(el) sensors_add_array_el(el,\
+                                           &current_chip->intervals,\
+                                           &current_chip->intervals_count,\
+                                           &current_chip->intervals_max,\
+                                           sizeof(sensors_interval));
 #define chip_add_el(el) sensors_add_array_el(el,\
-                                       &sensors_config_chips,\
-                                       &sensors_config_chips_count,\
-                                       &sensors_config_chips_max,\
+                                       &state->chips,\
+                                       &state->chips_count,\
+                                       &state->chips_max,\
                                        sizeof(sensors_chip));
 
 #define fits_add_el(el,list) sensors_add_array_el(el,\
@@ -76,6 +98,11 @@ static sensors_chip *current_chip = NULL;
 
 %}
 
+%define api.pure
+%parse-param {sensors_parse_state *state}
+%parse-param {void *scanner}
+%lex-param {void *scanner}
+
 %union {
   double value;
   char *name;
@@ -87,6 +114,11 @@ static sensors_chip *current_chip = NULL;
   sensors_config_line line;
 }  
 
+%{
+/* This is defined in conf-lex.l */
+int sensors_yylex(YYSTYPE *lvalp, void *scanner);
+%}
+
 %left <nothing> '-' '+'
 %left <nothing> '*' '/'
 %left <nothing> NEG
@@ -100,6 +132,9 @@ static sensors_chip *current_chip = NULL;
 %token <line> CHIP
 %token <line> COMPUTE
 %token <line> IGNORE
+%token <line> VIRTUAL
+%token <line> FEATURE
+%token <line> INTERVAL
 %token <value> FLOAT
 %token <name> NAME
 %token <nothing> ERROR
@@ -126,6 +161,9 @@ line:	  bus_statement EOL
 	| chip_statement EOL
 	| compute_statement EOL
 	| ignore_statement EOL
+	| virtual_statement EOL
+	| feature_statement EOL
+	| interval_statement EOL
 	| error	EOL
 ;
 
@@ -140,12 +178,8 @@ bus_statement:	  BUS bus_id adapter_name
 
 label_statement:	  LABEL function_name string
 			  { sensors_label new_el;
-			    if (!current_chip) {
-			      sensors_yyerror("Label statement before first chip statement");
-			      free($2);
-			      free($3);
-			      YYERROR;
-			    }
+			    if (current_chip == &state->leading)
+			      before_first_chip(state, "Label statement before first chip statement");
 			    new_el.line = $1;
 			    new_el.name = $2;
 			    new_el.value = $3;
@@ -155,12 +189,14 @@ label_statement:	  LABEL function_name string
 
 set_statement:	  SET function_name expression
 		  { sensors_set new_el;
-		    if (!current_chip) {
-		      sensors_yyerror("Set statement before first chip statement");
-		      free($2);
+		    if (expr_has_kind($3, sensors_kind_aggregate)) {
+		      sensors_yyerror(state, scanner, "Aggregate outside of a feature statement");
+		      sensors_free($2);
 		      sensors_free_expr($3);
 		      YYERROR;
 		    }
+		    if (current_chip == &state->leading)
+		      before_first_chip(state, "Set statement before first chip statement");
 		    new_el.line = $1;
 		    new_el.name = $2;
 		    new_el.value = $3;
@@ -170,13 +206,16 @@ set_statement:	  SET function_name expression
 
 compute_statement:	  COMPUTE function_name expression ',' expression
 			  { sensors_compute new_el;
-			    if (!current_chip) {
-			      sensors_yyerror("Compute statement before first chip statement");
-			      free($2);
+			    if (expr_has_kind($3, sensors_kind_aggregate) ||
+			        expr_has_kind($5, sensors_kind_aggregate)) {
+			      sensors_yyerror(state, scanner, "Aggregate outside of a feature statement");
+			      sensors_free($2);
 			      sensors_free_expr($3);
 			      sensors_free_expr($5);
 			      YYERROR;
 			    }
+			    if (current_chip == &state->leading)
+			      before_first_chip(state, "Compute statement before first chip statement");
 			    new_el.line = $1;
 			    new_el.name = $2;
 			    new_el.from_proc = $3;
@@ -187,35 +226,112 @@ compute_statement:	  COMPUTE function_name expression ',' expression
 
 ignore_statement:	IGNORE function_name
 			{ sensors_ignore new_el;
-			  if (!current_chip) {
-			    sensors_yyerror("Ignore statement before first chip statement");
-			    free($2);
+			  if (current_chip == &state->leading)
+			    before_first_chip(state, "Ignore statement before first chip statement");
+			  new_el.line = $1;
+			  new_el.name = $2;
+			  ignore_add_el(&new_el);
+			}
+;
+
+feature_statement:	FEATURE function_name expression
+			{ sensors_virtual_feature new_el;
+			  if (!current_chip->virtual) {
+			    sensors_yyerror(state, scanner, "Feature statement outside of a virtual chip block");
+			    sensors_free($2);
+			    sensors_free_expr($3);
+			    YYERROR;
+			  }
+			  if (!sensors_subfeature_name_is_virtual($2)) {
+			    sensors_yyerror(state, scanner, "Invalid virtual feature name");
+			    sensors_free($2);
+			    sensors_free_expr($3);
+			    YYERROR;
+			  }
+			  if (expr_has_kind($3, sensors_kind_var) ||
+			      expr_has_kind($3, sensors_kind_source)) {
+			    sensors_yyerror(state, scanner, "Feature expressions can only use aggregates");
+			    sensors_free($2);
+			    sensors_free_expr($3);
 			    YYERROR;
 			  }
 			  new_el.line = $1;
 			  new_el.name = $2;
-			  ignore_add_el(&new_el);
+			  new_el.value = $3;
+			  feature_add_el(&new_el);
 			}
 ;
 
+interval_statement:	  INTERVAL FLOAT
+			  { sensors_interval new_el;
+			    if (check_interval(state, scanner, $2))
+			      YYERROR;
+			    if (current_chip == &state->leading)
+			      before_first_chip(state, "Interval statement before first chip statement");
+			    new_el.line = $1;
+			    new_el.name = NULL;
+			    new_el.value = $2 * 1000 + 0.5;
+			    interval_add_el(&new_el);
+			  }
+			| INTERVAL function_name FLOAT
+			  { sensors_interval new_el;
+			    if (check_interval(state, scanner, $3)) {
+			      sensors_free($2);
+			      YYERROR;
+			    }
+			    if (current_chip == &state->leading)
+			      before_first_chip(state, "Interval statement before first chip statement");
+			    new_el.line = $1;
+			    new_el.name = $2;
+			    new_el.value = $3 * 1000 + 0.5;
+			    interval_add_el(&new_el);
+			  }
+;
+
 chip_statement:	  CHIP chip_name_list
 		  { sensors_chip new_el;
 		    new_el.line = $1;
+		    new_el.virtual = 0;
 		    new_el.labels = NULL;
 		    new_el.sets = NULL;
 		    new_el.computes = NULL;
 		    new_el.ignores = NULL;
+		    new_el.features = NULL;
+		    new_el.intervals = NULL;
 		    new_el.labels_count = new_el.labels_max = 0;
 		    new_el.sets_count = new_el.sets_max = 0;
 		    new_el.computes_count = new_el.computes_max = 0;
 		    new_el.ignores_count = new_el.ignores_max = 0;
+		    new_el.features_count = new_el.features_max = 0;
+		    new_el.intervals_count = new_el.intervals_max = 0;
 		    new_el.chips = $2;
 		    chip_add_el(&new_el);
-		    current_chip = sensors_config_chips + 
-		                   sensors_config_chips_count - 1;
+		    current_chip = state->chips + state->chips_count - 1;
 		  }
 ;
 
+virtual_statement:	  VIRTUAL NAME
+			  { sensors_chip new_el;
+			    sensors_chip_name name;
+			    if (!$2[0] || strpbrk($2, "-*")) {
+			      sensors_yyerror(state, scanner, "Invalid virtual chip name");
+			      sensors_free($2);
+			      YYERROR;
+			    }
+			    name.prefix = $2;
+			    name.bus.type = SENSORS_BUS_TYPE_VIRTUAL;
+			    name.bus.nr = SENSORS_BUS_NR_ANY;
+			    name.addr = 0;
+			    name.path = NULL;
+			    memset(&new_el, 0, sizeof(new_el));
+			    new_el.line = $1;
+			    new_el.virtual = 1;
+			    fits_add_el(&name, new_el.chips);
+			    chip_add_el(&new_el);
+			    current_chip = state->chips + state->chips_count - 1;
+			  }
+;
+
 chip_name_list:	  chip_name
 		  { 
 		    $$.fits = NULL;
@@ -293,13 +409,46 @@ expression:	  FLOAT
 		    $$->data.subexpr.sub1 = $2;
 		    $$->data.subexpr.sub2 = NULL;
 		  }
+		| NAME '(' NAME ',' NAME ')'
+		  { sensors_aggregate_op op;
+		    int res = 0;
+		    if (!strcmp($1, "max"))
+		      op = sensors_max;
+		    else if (!strcmp($1, "min"))
+		      op = sensors_min;
+		    else if (!strcmp($1, "avg"))
+		      op = sensors_avg;
+		    else if (!strcmp($1, "sum"))
+		      op = sensors_sum;
+		    else
+		      res = 1;
+		    sensors_free($1);
+		    if (res) {
+		      sensors_yyerror(state, scanner, "Unknown aggregate function");
+		      sensors_free($3);
+		      sensors_free($5);
+		      YYERROR;
+		    }
+		    $$ = malloc_expr();
+		    res = sensors_parse_chip_name($3, &$$->data.aggregate.chip);
+		    sensors_free($3);
+		    if (res) {
+		      sensors_yyerror(state, scanner, "Parse error in chip name");
+		      sensors_free($$);
+		      sensors_free($5);
+		      YYERROR;
+		    }
+		    $$->kind = sensors_kind_aggregate;
+		    $$->data.aggregate.op = op;
+		    $$->data.aggregate.pattern = $5;
+		  }
 ;
 
 bus_id:		  NAME
 		  { int res = sensors_parse_bus_id($1,&$$);
-		    free($1);
+		    sensors_free($1);
 		    if (res) {
-                      sensors_yyerror("Parse error in bus id");
+                      sensors_yyerror(state, scanner, "Parse error in bus id");
 		      YYERROR;
                     }
 		  }
@@ -319,9 +468,9 @@ string:	  NAME
 
 chip_name:	  NAME
 		  { int res = sensors_parse_chip_name($1,&$$); 
-		    free($1);
+		    sensors_free($1);
 		    if (res) {
-		      sensors_yyerror("Parse error in chip name");
+		      sensors_yyerror(state, scanner, "Parse error in chip name");
 		      YYERROR;
 		    }
 		  }
@@ -329,18 +478,68 @@ chip_name:	  NAME
 
 %%
 
-void sensors_yyerror(const char *err)
+/* Errors are kept with the file's partial configuration, and reported
+   when it is merged */
+static void add_error(sensors_parse_state *state, const char *err,
+		      int deferred)
+{
+  sensors_parse_error_rec rec;
+
+  rec.err = sensors_strdup(err);
+  if (!rec.err)
+    sensors_fatal_error(__func__, "Out of memory");
+  rec.lineno = state->lineno;
+  rec.deferred = deferred;
+  sensors_add_array_el(&rec, &state->errors, &state->errors_count,
+                       &state->errors_max, sizeof(sensors_parse_error_rec));
+}
+
+void sensors_yyerror(sensors_parse_state *state, void *scanner,
+		     const char *err)
 {
-  if (sensors_lex_error[0]) {
-    sensors_parse_error_wfn(sensors_lex_error, sensors_yyfilename, sensors_yylineno);
-    sensors_lex_error[0] = '\0';
+  (void)scanner;
+  if (state->lex_error[0]) {
+    add_error(state, state->lex_error, 0);
+    state->lex_error[0] = '\0';
   } else
-    sensors_parse_error_wfn(err, sensors_yyfilename, sensors_yylineno);
+    add_error(state, err, 0);
+}
+
+/* Statements before the first chip statement of a file belong to the
+   last chip statement of the previous files. Whether there is one is
+   only known once the file is merged, so is the error. */
+void before_first_chip(sensors_parse_state *state, const char *err)
+{
+  add_error(state, err, 1);
+}
+
+/* Check whether an expression, or one of its subexpressions, is of a
+   given kind */
+int expr_has_kind(const sensors_expr *expr, sensors_expr_kind kind)
+{
+  if (expr->kind == kind)
+    return 1;
+  if (expr->kind != sensors_kind_sub)
+    return 0;
+  return expr_has_kind(expr->data.subexpr.sub1, kind) ||
+         (expr->data.subexpr.sub2 &&
+          expr_has_kind(expr->data.subexpr.sub2, kind));
+}
+
+/* Intervals are given in seconds, and kept in milliseconds. Report an
+   interval too short or too long to be kept, and return non-zero. */
+int check_interval(sensors_parse_state *state, void *scanner, double value)
+{
+  if (value * 1000 + 0.5 < 1 || value * 1000 > INT_MAX) {
+    sensors_yyerror(state, scanner, "Invalid interval");
+    return 1;
+  }
+  return 0;
 }
 
-sensors_expr *malloc_expr(void)
+static sensors_expr *malloc_expr(void)
 {
-  sensors_expr *res = malloc(sizeof(sensors_expr));
+  sensors_expr *res = sensors_malloc(sizeof(sensors_expr));
   if (! res)
     sensors_fatal_error(__func__, "Allocating a new expression");
   return res;
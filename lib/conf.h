@@ -21,14 +21,47 @@
 #ifndef LIB_SENSORS_CONF_H
 #define LIB_SENSORS_CONF_H
 
-/* This is defined in conf-lex.l */
-int sensors_yylex(void);
-extern char sensors_lex_error[];
-extern const char *sensors_yyfilename;
-extern int sensors_yylineno;
-extern FILE *sensors_yyin;
+#include "data.h"
+
+/* An error found while parsing, reported once the file is merged.
+   Deferred errors are only reported if no previous file has a chip
+   statement. */
+typedef struct sensors_parse_error_rec {
+	char *err;
+	int lineno;
+	int deferred;
+} sensors_parse_error_rec;
+
+/* Everything the scanner and the parser need to parse one configuration
+   file, so that several files can be parsed at the same time. The file's
+   chip and bus statements go to its own partial configuration, which is
+   merged into the global one afterwards. */
+typedef struct sensors_parse_state {
+	const char *filename;
+	int lineno;
+	char lex_error[100];
+
+	/* Quoted string being scanned */
+	char *buffer;
+	int buffer_count;
+	int buffer_max;
+
+	sensors_chip *chips;
+	int chips_count;
+	int chips_max;
+	sensors_chip *current_chip;
+	sensors_chip leading;	/* Statements before the first chip one */
+
+	sensors_bus *busses;
+	int busses_count;
+	int busses_max;
+
+	sensors_parse_error_rec *errors;
+	int errors_count;
+	int errors_max;
+} sensors_parse_state;
 
 /* This is defined in conf-parse.y */
-int sensors_yyparse(void);
+int sensors_yyparse(sensors_parse_state *state, void *scanner);
 
 #endif /* LIB_SENSORS_CONF_H */
@@ -19,16 +19,15 @@
     MA 02110-1301 USA.
 */
 
-/* this define needed for strndup() */
-#define _GNU_SOURCE
-
 #include <stdlib.h>
 #include <string.h>
 
 #include "access.h"
 #include "error.h"
+#include "alloc.h"
 #include "data.h"
 #include "sensors.h"
+#include "sysfs.h"
 #include "../version.h"
 
 const char *libsensors_version = LM_VERSION;
@@ -49,14 +48,19 @@ int sensors_config_busses_max = 0;
 sensors_chip_features *sensors_proc_chips = NULL;
 int sensors_proc_chips_count = 0;
 int sensors_proc_chips_max = 0;
+int sensors_proc_subfeatures_count = 0;
 
 sensors_bus *sensors_proc_bus = NULL;
 int sensors_proc_bus_count = 0;
 int sensors_proc_bus_max = 0;
 
+/* The adapter list is only read from sysfs when first needed */
+sensors_bus_index sensors_proc_bus_index = { NULL, NULL, 0 };
+int sensors_proc_bus_loaded = 0;
+
 void sensors_free_chip_name(sensors_chip_name *chip)
 {
-	free(chip->prefix);
+	sensors_free(chip->prefix);
 }
 
 /*
@@ -84,6 +88,9 @@ int sensors_parse_chip_name(const char *name, sensors_chip_name *res)
 {
 	char *dash;
 
+	/* Configuration chip names have no sysfs path */
+	res->path = NULL;
+
 	/* First, the prefix. It's either "*" or a real chip name. */
 	if (!strncmp(name, "*-", 2)) {
 		res->prefix = SENSORS_CHIP_NAME_PREFIX_ANY;
@@ -91,7 +98,7 @@ int sensors_parse_chip_name(const char *name, sensors_chip_name *res)
 	} else {
 		if (!(dash = strchr(name, '-')))
 			return -SENSORS_ERR_CHIP_NAME;
-		res->prefix = strndup(name, dash - name);
+		res->prefix = sensors_strndup(name, dash - name);
 		if (!res->prefix)
 			sensors_fatal_error(__func__,
 					    "Allocating name prefix");
@@ -161,7 +168,7 @@ int sensors_parse_chip_name(const char *name, sensors_chip_name *res)
 	return 0;
 
 ERROR:
-	free(res->prefix);
+	sensors_free(res->prefix);
 	return -SENSORS_ERR_CHIP_NAME;
 }
 
@@ -213,16 +220,116 @@ int sensors_parse_bus_id(const char *name, sensors_bus_id *bus)
 	return 0;
 }
 
+/* FNV-1a, good enough for the short adapter names we deal with */
+static unsigned int hash_adapter(const char *adapter)
+{
+	unsigned int hash = 2166136261U;
+
+	while (*adapter) {
+		hash ^= (unsigned char)*adapter++;
+		hash *= 16777619U;
+	}
+	return hash;
+}
+
+static unsigned int hash_bus_id(const sensors_bus_id *bus)
+{
+	return ((unsigned int)(unsigned short)bus->type << 16 |
+		(unsigned short)bus->nr) * 2654435761U;
+}
+
+void sensors_index_busses(sensors_bus_index *index,
+			  const sensors_bus *busses, int count)
+{
+	int i, size;
+	unsigned int slot;
+
+	/* Keep the load factor at or below 1/2 */
+	for (size = 16; size < 2 * count; size <<= 1)
+		;
+	index->by_id = sensors_malloc(size * sizeof(int));
+	index->by_adapter = sensors_malloc(size * sizeof(int));
+	if (!index->by_id || !index->by_adapter)
+		sensors_fatal_error(__func__, "Out of memory");
+	memset(index->by_id, 0xff, size * sizeof(int));
+	memset(index->by_adapter, 0xff, size * sizeof(int));
+	index->size = size;
+
+	/* Linear probing; an entry which duplicates the key of an earlier
+	   one is not inserted */
+	for (i = 0; i < count; i++) {
+		for (slot = hash_bus_id(&busses[i].bus) & (size - 1);
+		     index->by_id[slot] >= 0; slot = (slot + 1) & (size - 1))
+			if (busses[index->by_id[slot]].bus.type ==
+			    busses[i].bus.type &&
+			    busses[index->by_id[slot]].bus.nr ==
+			    busses[i].bus.nr)
+				break;
+		if (index->by_id[slot] < 0)
+			index->by_id[slot] = i;
+
+		for (slot = hash_adapter(busses[i].adapter) & (size - 1);
+		     index->by_adapter[slot] >= 0;
+		     slot = (slot + 1) & (size - 1))
+			if (!strcmp(busses[index->by_adapter[slot]].adapter,
+				    busses[i].adapter))
+				break;
+		if (index->by_adapter[slot] < 0)
+			index->by_adapter[slot] = i;
+	}
+}
+
+void sensors_free_bus_index(sensors_bus_index *index)
+{
+	sensors_free(index->by_id);
+	sensors_free(index->by_adapter);
+	index->by_id = index->by_adapter = NULL;
+	index->size = 0;
+}
+
+const sensors_bus *sensors_lookup_bus_id(const sensors_bus_index *index,
+					 const sensors_bus *busses,
+					 const sensors_bus_id *bus)
+{
+	unsigned int slot;
+
+	if (!index->size)
+		return NULL;
+
+	for (slot = hash_bus_id(bus) & (index->size - 1);
+	     index->by_id[slot] >= 0; slot = (slot + 1) & (index->size - 1))
+		if (busses[index->by_id[slot]].bus.type == bus->type &&
+		    busses[index->by_id[slot]].bus.nr == bus->nr)
+			return &busses[index->by_id[slot]];
+	return NULL;
+}
+
+const sensors_bus *sensors_lookup_bus_adapter(const sensors_bus_index *index,
+					      const sensors_bus *busses,
+					      const char *adapter)
+{
+	unsigned int slot;
+
+	if (!index->size)
+		return NULL;
+
+	for (slot = hash_adapter(adapter) & (index->size - 1);
+	     index->by_adapter[slot] >= 0;
+	     slot = (slot + 1) & (index->size - 1))
+		if (!strcmp(busses[index->by_adapter[slot]].adapter, adapter))
+			return &busses[index->by_adapter[slot]];
+	return NULL;
+}
+
 static int sensors_substitute_chip(sensors_chip_name *name,
+				   const sensors_bus_index *config_index,
 				   const char *filename, int lineno)
 {
-	int i, j;
-	for (i = 0; i < sensors_config_busses_count; i++)
-		if (sensors_config_busses[i].bus.type == name->bus.type &&
-		    sensors_config_busses[i].bus.nr == name->bus.nr)
-			break;
+	const sensors_bus *config_bus, *proc_bus;
 
-	if (i == sensors_config_busses_count) {
+	config_bus = sensors_lookup_bus_id(config_index,
+					   sensors_config_busses, &name->bus);
+	if (!config_bus) {
 		sensors_parse_error_wfn("Undeclared bus id referenced",
 					filename, lineno);
 		name->bus.nr = SENSORS_BUS_NR_IGNORE;
@@ -230,12 +337,12 @@ static int sensors_substitute_chip(sensors_chip_name *name,
 	}
 
 	/* Compare the adapter names */
-	for (j = 0; j < sensors_proc_bus_count; j++) {
-		if (!strcmp(sensors_config_busses[i].adapter,
-			    sensors_proc_bus[j].adapter)) {
-			name->bus.nr = sensors_proc_bus[j].bus.nr;
-			return 0;
-		}
+	proc_bus = sensors_lookup_bus_adapter(&sensors_proc_bus_index,
+					      sensors_proc_bus,
+					      config_bus->adapter);
+	if (proc_bus) {
+		name->bus.nr = proc_bus->bus.nr;
+		return 0;
 	}
 
 	/* We did not find a matching bus name, simply ignore this chip
@@ -246,14 +353,23 @@ static int sensors_substitute_chip(sensors_chip_name *name,
 
 /* Bus substitution is on a per-configuration file basis, so we keep
    memory (in sensors_config_chips_subst) of which chip entries have been
-   already substituted. */
+   already substituted. The i2c adapters are only enumerated if the
+   configuration file declares at least one bus. */
 int sensors_substitute_busses(void)
 {
 	int err, i, j, lineno;
 	sensors_chip_name_list *chips;
+	sensors_bus_index config_index = { NULL, NULL, 0 };
 	const char *filename;
 	int res = 0;
 
+	if (sensors_config_busses_count) {
+		if ((res = sensors_read_sysfs_bus()))
+			return res;
+		sensors_index_busses(&config_index, sensors_config_busses,
+				     sensors_config_busses_count);
+	}
+
 	for (i = sensors_config_chips_subst;
 	     i < sensors_config_chips_count; i++) {
 		filename = sensors_config_chips[i].line.filename;
@@ -266,11 +382,13 @@ int sensors_substitute_busses(void)
 				continue;
 
 			err = sensors_substitute_chip(&chips->fits[j],
+						      &config_index,
 						      filename, lineno);
 			if (err)
 				res = err;
 		}
 	}
 	sensors_config_chips_subst = sensors_config_chips_count;
+	sensors_free_bus_index(&config_index);
 	return res;
 }
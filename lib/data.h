@@ -35,14 +35,20 @@ typedef enum sensors_operation {
 	sensors_negate, sensors_exp, sensors_log,
 } sensors_operation;
 
+/* Kinds of aggregate functions recognized */
+typedef enum sensors_aggregate_op {
+	sensors_max, sensors_min, sensors_avg, sensors_sum
+} sensors_aggregate_op;
+
 /* An expression can have several forms */
 typedef enum sensors_expr_kind {
 	sensors_kind_val, sensors_kind_source, sensors_kind_var,
-	sensors_kind_sub
+	sensors_kind_sub, sensors_kind_aggregate
 } sensors_expr_kind;
 
 /* An expression. It is either a floating point value, a variable name,
-   an operation on subexpressions, or the special value 'sub' } */
+   an operation on subexpressions, an aggregate of the subfeatures of
+   other chips, or the special value 'sub' } */
 struct sensors_expr;
 
 typedef struct sensors_subexpr {
@@ -51,12 +57,21 @@ typedef struct sensors_subexpr {
 	struct sensors_expr *sub2;
 } sensors_subexpr;
 
+/* The subfeatures whose name matches pattern (a shell wildcard
+   pattern), of the chips matching chip */
+typedef struct sensors_aggregate {
+	sensors_aggregate_op op;
+	sensors_chip_name chip;
+	char *pattern;
+} sensors_aggregate;
+
 typedef struct sensors_expr {
 	sensors_expr_kind kind;
 	union {
 		double val;
 		char *var;
 		sensors_subexpr subexpr;
+		sensors_aggregate aggregate;
 	} data;
 } sensors_expr;
 
@@ -97,6 +112,23 @@ typedef struct sensors_ignore {
 	sensors_config_line line;
 } sensors_ignore;
 
+/* Config file feature declaration, in a virtual chip block: a
+   subfeature name, combined with the expression giving its value */
+typedef struct sensors_virtual_feature {
+	char *name;
+	sensors_expr *value;
+	sensors_config_line line;
+} sensors_virtual_feature;
+
+/* Config file interval declaration: the interval, in milliseconds, at
+   which a feature, or all the features of a chip if name is NULL,
+   should be sampled */
+typedef struct sensors_interval {
+	char *name;
+	unsigned int value;
+	sensors_config_line line;
+} sensors_interval;
+
 /* A list of chip names, used to represent a config file chips declaration */
 typedef struct sensors_chip_name_list {
 	sensors_chip_name *fits;
@@ -104,9 +136,12 @@ typedef struct sensors_chip_name_list {
 	int fits_max;
 } sensors_chip_name_list;
 
-/* A config file chip block */
+/* A config file chip block. A virtual chip block declares a chip of its
+   own, its only name, whose subfeatures are those of its feature
+   statements. */
 typedef struct sensors_chip {
 	sensors_chip_name_list chips;
+	int virtual;
 	sensors_label *labels;
 	int labels_count;
 	int labels_max;
@@ -119,6 +154,12 @@ typedef struct sensors_chip {
 	sensors_ignore *ignores;
 	int ignores_count;
 	int ignores_max;
+	sensors_virtual_feature *features;
+	int features_count;
+	int features_max;
+	sensors_interval *intervals;
+	int intervals_count;
+	int intervals_max;
 	sensors_config_line line;
 } sensors_chip;
 
@@ -130,13 +171,18 @@ typedef struct sensors_bus {
 	sensors_config_line line;
 } sensors_bus;
 
-/* Internal data about all features and subfeatures of a chip */
+/* Internal data about all features and subfeatures of a chip. With lazy
+   discovery, the features are only enumerated when the chip is first
+   looked up, see sensors_lookup_chip(). */
 typedef struct sensors_chip_features {
 	struct sensors_chip_name chip;
 	struct sensors_feature *feature;
 	struct sensors_subfeature *subfeature;
 	int feature_count;
 	int subfeature_count;
+	int subfeature_base;	/* Index of the first subfeature among those
+				   of all loaded chips */
+	int loaded;		/* Features enumerated */
 } sensors_chip_features;
 
 extern char **sensors_config_files;
@@ -159,6 +205,7 @@ extern int sensors_config_busses_max;
 extern sensors_chip_features *sensors_proc_chips;
 extern int sensors_proc_chips_count;
 extern int sensors_proc_chips_max;
+extern int sensors_proc_subfeatures_count;	/* Of the loaded chips */
 
 #define sensors_add_proc_chips(el) sensors_add_array_el( \
 	(el), &sensors_proc_chips, &sensors_proc_chips_count,\
@@ -172,6 +219,29 @@ extern int sensors_proc_bus_max;
 	(el), &sensors_proc_bus, &sensors_proc_bus_count,\
 	&sensors_proc_bus_max, sizeof(struct sensors_bus))
 
+/* Hash index over a list of busses, so that a bus can be found by id or
+   by adapter name in constant time. Slots hold an index into the bus
+   list, or -1 if empty. When several busses share a key, the first one
+   in the list wins, as it did with the linear searches. */
+typedef struct sensors_bus_index {
+	int *by_id;
+	int *by_adapter;
+	int size;		/* always a power of 2 */
+} sensors_bus_index;
+
+extern sensors_bus_index sensors_proc_bus_index;
+extern int sensors_proc_bus_loaded;
+
+void sensors_index_busses(sensors_bus_index *index,
+			  const sensors_bus *busses, int count);
+void sensors_free_bus_index(sensors_bus_index *index);
+const sensors_bus *sensors_lookup_bus_id(const sensors_bus_index *index,
+					 const sensors_bus *busses,
+					 const sensors_bus_id *bus);
+const sensors_bus *sensors_lookup_bus_adapter(const sensors_bus_index *index,
+					      const sensors_bus *busses,
+					      const char *adapter);
+
 /* Substitute configuration bus numbers with real-world bus numbers
    in the chips lists */
 int sensors_substitute_busses(void);
@@ -49,6 +49,8 @@ static const char *errorlist[] = {
 	/* SENSORS_ERR_ACCESS_W  */ "Can't write",
 	/* SENSORS_ERR_IO        */ "I/O error",
 	/* SENSORS_ERR_RECURSION */ "Evaluation recurses too deep",
+	/* SENSORS_ERR_BUSY      */ "Resource busy",
+	/* SENSORS_ERR_BREAKER   */ "Chip not accessed after repeated errors",
 };
 
 const char *sensors_strerror(int errnum)
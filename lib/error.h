@@ -33,6 +33,8 @@
 #define SENSORS_ERR_ACCESS_W	9 /* Can't write */
 #define SENSORS_ERR_IO		10 /* I/O error */
 #define SENSORS_ERR_RECURSION	11 /* Evaluation recurses too deep */
+#define SENSORS_ERR_BUSY	12 /* Operation not possible now */
+#define SENSORS_ERR_BREAKER	13 /* Chip not accessed after errors */
 
 #ifdef __cplusplus
 extern "C" {
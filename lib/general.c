@@ -19,11 +19,13 @@
 */
 
 #include "error.h"
+#include "alloc.h"
 #include "general.h"
 #include <errno.h>
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
+#include <time.h>
 
 
 #define A_BUNCH 16
@@ -32,7 +34,7 @@ void sensors_malloc_array(void *list, int *num_el, int *max_el, int el_size)
 {
 	void **my_list = (void **)list;
 
-	*my_list = malloc(el_size*A_BUNCH);
+	*my_list = sensors_malloc(el_size*A_BUNCH);
 	if (! *my_list)
 		sensors_fatal_error(__func__, "Allocating new elements");
 	*max_el = A_BUNCH;
@@ -43,7 +45,7 @@ void sensors_free_array(void *list, int *num_el, int *max_el)
 {
 	void **my_list = (void **)list;
 
-	free(*my_list);
+	sensors_free(*my_list);
 	*my_list = NULL;
 	*num_el = 0;
 	*max_el = 0;
@@ -56,7 +58,7 @@ void sensors_add_array_el(const void *el, void *list, int *num_el,
 	void **my_list = (void *)list;
 	if (*num_el + 1 > *max_el) {
 		new_max_el = *max_el + A_BUNCH;
-		*my_list = realloc(*my_list, new_max_el * el_size);
+		*my_list = sensors_realloc(*my_list, new_max_el * el_size);
 		if (! *my_list)
 			sensors_fatal_error(__func__,
 					    "Allocating new elements");
@@ -74,7 +76,7 @@ void sensors_add_array_els(const void *els, int nr_els, void *list,
 	if (*num_el + nr_els > *max_el) {
 		new_max_el = (*max_el + nr_els + A_BUNCH);
 		new_max_el -= new_max_el % A_BUNCH;
-		*my_list = realloc(*my_list, new_max_el * el_size);
+		*my_list = sensors_realloc(*my_list, new_max_el * el_size);
 		if (! *my_list)
 			sensors_fatal_error(__func__,
 					    "Allocating new elements");
@@ -83,3 +85,120 @@ void sensors_add_array_els(const void *els, int nr_els, void *list,
 	memcpy(((char *)*my_list) + *num_el * el_size, els, el_size * nr_els);
 	*num_el += nr_els;
 }
+
+/* String pool blocks are chained, the most recently allocated first */
+#define STRING_BLOCK_SIZE	4096
+
+struct string_block {
+	struct string_block *next;
+	int used;
+	int size;
+	char data[];
+};
+
+static struct string_block *string_blocks;
+
+/* Open-addressed hash table of the interned strings */
+static char **string_table;
+static int string_table_size;	/* always a power of 2 */
+static int string_table_count;
+
+static unsigned int hash_string(const char *str, int len)
+{
+	unsigned int hash = 2166136261U;
+
+	while (len--) {
+		hash ^= (unsigned char)*str++;
+		hash *= 16777619U;
+	}
+	return hash;
+}
+
+static char *string_pool_alloc(int size)
+{
+	struct string_block *block = string_blocks;
+
+	if (!block || block->size - block->used < size) {
+		int block_size = size > STRING_BLOCK_SIZE ?
+				 size : STRING_BLOCK_SIZE;
+
+		block = sensors_malloc(sizeof(struct string_block) + block_size);
+		if (!block)
+			sensors_fatal_error(__func__, "Out of memory");
+		block->used = 0;
+		block->size = block_size;
+		block->next = string_blocks;
+		string_blocks = block;
+	}
+
+	block->used += size;
+	return block->data + block->used - size;
+}
+
+static void string_table_grow(void)
+{
+	char **old_table = string_table;
+	int old_size = string_table_size, i;
+	unsigned int slot;
+
+	string_table_size = old_size ? old_size * 2 : 256;
+	string_table = sensors_calloc(string_table_size, sizeof(char *));
+	if (!string_table)
+		sensors_fatal_error(__func__, "Out of memory");
+
+	for (i = 0; i < old_size; i++) {
+		if (!old_table[i])
+			continue;
+		slot = hash_string(old_table[i], strlen(old_table[i])) &
+		       (string_table_size - 1);
+		while (string_table[slot])
+			slot = (slot + 1) & (string_table_size - 1);
+		string_table[slot] = old_table[i];
+	}
+	sensors_free(old_table);
+}
+
+/* Return the pooled copy of the first len characters of str */
+char *sensors_intern_string(const char *str, int len)
+{
+	unsigned int slot;
+	char *res;
+
+	/* Keep the load factor at or below 1/2 */
+	if (2 * (string_table_count + 1) > string_table_size)
+		string_table_grow();
+
+	for (slot = hash_string(str, len) & (string_table_size - 1);
+	     (res = string_table[slot]);
+	     slot = (slot + 1) & (string_table_size - 1))
+		if (!strncmp(res, str, len) && res[len] == '\0')
+			return res;
+
+	res = string_pool_alloc(len + 1);
+	memcpy(res, str, len);
+	res[len] = '\0';
+	string_table[slot] = res;
+	string_table_count++;
+	return res;
+}
+
+void sensors_free_strings(void)
+{
+	struct string_block *block;
+
+	while ((block = string_blocks)) {
+		string_blocks = block->next;
+		sensors_free(block);
+	}
+	sensors_free(string_table);
+	string_table = NULL;
+	string_table_size = string_table_count = 0;
+}
+
+unsigned long long sensors_monotonic_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (unsigned long long)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
@@ -34,6 +34,17 @@ void sensors_add_array_el(const void *el, void *list, int *num_el,
 void sensors_add_array_els(const void *els, int nr_els, void *list,
 			   int *num_el, int *max_el, int el_size);
 
+/* String pool. Names of the detected chips, features and subfeatures are
+   interned here: each distinct string is stored only once, packed in
+   large blocks, and shared between all the chips which use it. Interned
+   strings must not be modified nor freed individually; they all go away
+   when sensors_free_strings() is called. */
+char *sensors_intern_string(const char *str, int len);
+void sensors_free_strings(void);
+
+/* Current time in nanoseconds, on the CLOCK_MONOTONIC clock */
+unsigned long long sensors_monotonic_ns(void);
+
 #define ARRAY_SIZE(arr)	(int)(sizeof(arr) / sizeof((arr)[0]))
 
 #endif /* LIB_SENSORS_GENERAL */
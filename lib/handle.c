@@ -0,0 +1,261 @@
+/*
+    handle.c - Part of libsensors, a Linux library for reading sensor data.
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+    MA 02110-1301 USA.
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include "sensors.h"
+#include "data.h"
+#include "error.h"
+#include "alloc.h"
+#include "access.h"
+#include "sysfs.h"
+#include "breaker.h"
+#include "cache.h"
+#include "trace.h"
+#include "virtual.h"
+#include "handle.h"
+
+/* A handle does all the lookups of a read or write once: it keeps the
+   chip, the open attribute file, the scaling factor and the compute
+   statement, so reading only takes a read() and the arithmetic. Handles
+   remember the chip and subfeature by name, rather than by pointer, and
+   are resolved again by each sensors_init(), so that they survive
+   configuration reloads. They belong to the application and are only
+   freed by sensors_handle_close(). */
+
+struct sensors_subfeature_handle {
+	struct sensors_subfeature_handle *next;
+
+	/* What the handle refers to */
+	sensors_chip_name name;		/* Own copy of the prefix, no path */
+	char *subfeat_name;
+
+	/* Resolved, chip is NULL if not */
+	const sensors_chip_features *chip;
+	const sensors_subfeature *subfeature;
+	const sensors_expr *from_proc;
+	const sensors_expr *to_proc;
+	int fd;				/* -1 for virtual chips */
+	int mode;
+	int scale;
+};
+
+static struct sensors_subfeature_handle *handles;
+static pthread_mutex_t handles_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* Called with handles_lock held */
+static void handle_release(sensors_subfeature_handle *h)
+{
+	if (!h->chip)
+		return;
+	if (h->fd >= 0)
+		close(h->fd);
+	h->chip = NULL;
+}
+
+/* Called with handles_lock held */
+static int handle_resolve(sensors_subfeature_handle *h)
+{
+	const sensors_chip_features *chip;
+	const sensors_subfeature *subfeature = NULL;
+	const sensors_compute *compute;
+	int i;
+
+	if (!(chip = sensors_lookup_chip(&h->name)))
+		return -SENSORS_ERR_NO_ENTRY;
+	for (i = 0; i < chip->subfeature_count; i++)
+		if (!strcmp(chip->subfeature[i].name, h->subfeat_name)) {
+			subfeature = &chip->subfeature[i];
+			break;
+		}
+	if (!subfeature)
+		return -SENSORS_ERR_NO_ENTRY;
+
+	h->mode = subfeature->flags & (SENSORS_MODE_R | SENSORS_MODE_W);
+	if (sensors_chip_is_virtual(chip)) {
+		h->fd = -1;
+	} else {
+		h->fd = sensors_open_sysfs_attr(&chip->chip, subfeature,
+						h->mode);
+		if (h->fd < 0)
+			return -SENSORS_ERR_KERNEL;
+	}
+
+	compute = sensors_lookup_compute(chip, subfeature);
+	h->from_proc = compute ? compute->from_proc : NULL;
+	h->to_proc = compute ? compute->to_proc : NULL;
+	h->scale = sensors_get_sysfs_scaling(subfeature);
+	h->subfeature = subfeature;
+	h->chip = chip;
+	return 0;
+}
+
+int sensors_handle_open(const sensors_chip_name *name, int subfeat_nr,
+			sensors_subfeature_handle **handle)
+{
+	const sensors_chip_features *chip;
+	sensors_subfeature_handle *h;
+	int res;
+
+	if (sensors_chip_name_has_wildcards(name))
+		return -SENSORS_ERR_WILDCARDS;
+	if (!(chip = sensors_lookup_chip(name)))
+		return -SENSORS_ERR_NO_ENTRY;
+	if (subfeat_nr < 0 || subfeat_nr >= chip->subfeature_count)
+		return -SENSORS_ERR_NO_ENTRY;
+
+	h = sensors_calloc(1, sizeof(sensors_subfeature_handle));
+	if (!h)
+		sensors_fatal_error(__func__, "Out of memory");
+	h->name = chip->chip;
+	h->name.prefix = sensors_strdup(chip->chip.prefix);
+	h->name.path = NULL;
+	h->subfeat_name = sensors_strdup(chip->subfeature[subfeat_nr].name);
+	if (!h->name.prefix || !h->subfeat_name)
+		sensors_fatal_error(__func__, "Out of memory");
+
+	pthread_mutex_lock(&handles_lock);
+	if ((res = handle_resolve(h))) {
+		pthread_mutex_unlock(&handles_lock);
+		sensors_free(h->subfeat_name);
+		sensors_free(h->name.prefix);
+		sensors_free(h);
+		return res;
+	}
+	h->next = handles;
+	handles = h;
+	pthread_mutex_unlock(&handles_lock);
+
+	*handle = h;
+	return 0;
+}
+
+void sensors_handle_close(sensors_subfeature_handle *handle)
+{
+	sensors_subfeature_handle **p;
+
+	pthread_mutex_lock(&handles_lock);
+	for (p = &handles; *p && *p != handle; p = &(*p)->next)
+		;
+	if (*p)
+		*p = handle->next;
+	handle_release(handle);
+	pthread_mutex_unlock(&handles_lock);
+
+	sensors_free(handle->subfeat_name);
+	sensors_free(handle->name.prefix);
+	sensors_free(handle);
+}
+
+int sensors_handle_read(sensors_subfeature_handle *handle, double *value)
+{
+	double raw;
+	int res;
+
+	if (!handle->chip)
+		return -SENSORS_ERR_NO_ENTRY;
+	if (!(handle->mode & SENSORS_MODE_R))
+		return -SENSORS_ERR_ACCESS_R;
+
+	/* There is no file to read from, but other chips */
+	if (handle->fd < 0)
+		return sensors_get_value(&handle->chip->chip,
+					 handle->subfeature->number, value);
+
+	if ((res = sensors_breaker_check(handle->chip - sensors_proc_chips)))
+		return res;
+	if (sensors_trace_mode == SENSORS_TRACE_REPLAY) {
+		res = sensors_trace_get_value(handle->chip, handle->subfeature,
+					      &raw);
+	} else {
+		res = sensors_read_sysfs_raw(handle->fd, &raw);
+		if (!res)
+			raw /= handle->scale;
+		if (sensors_trace_mode == SENSORS_TRACE_RECORD)
+			sensors_trace_read(handle->chip, handle->subfeature,
+					   res, &raw);
+	}
+	sensors_breaker_report(handle->chip - sensors_proc_chips, res);
+	if (res)
+		return res;
+	if (!handle->from_proc) {
+		*value = raw;
+		return 0;
+	}
+	return sensors_eval_stmt(handle->chip, handle->subfeature->name,
+				 handle->from_proc, raw, 0, value);
+}
+
+int sensors_handle_write(sensors_subfeature_handle *handle, double value)
+{
+	int res;
+
+	if (!handle->chip)
+		return -SENSORS_ERR_NO_ENTRY;
+	if (!(handle->mode & SENSORS_MODE_W))
+		return -SENSORS_ERR_ACCESS_W;
+
+	if (handle->to_proc &&
+	    (res = sensors_eval_stmt(handle->chip, handle->subfeature->name,
+				     handle->to_proc, value, 0, &value)))
+		return res;
+	res = sensors_write_sysfs_raw(handle->fd, value * handle->scale);
+	sensors_cache_invalidate_subfeature(handle->chip, handle->subfeature);
+	return res;
+}
+
+int sensors_handle_invalidate(const sensors_chip_name *name)
+{
+	sensors_subfeature_handle *h;
+	int n = 0;
+
+	pthread_mutex_lock(&handles_lock);
+	for (h = handles; h; h = h->next) {
+		if (!h->chip || (name && !sensors_match_chip(&h->name, name)))
+			continue;
+		handle_release(h);
+		n++;
+	}
+	pthread_mutex_unlock(&handles_lock);
+
+	return n;
+}
+
+void sensors_handles_resolve(void)
+{
+	sensors_subfeature_handle *h;
+
+	pthread_mutex_lock(&handles_lock);
+	for (h = handles; h; h = h->next)
+		if (!h->chip)
+			handle_resolve(h);
+	pthread_mutex_unlock(&handles_lock);
+}
+
+void sensors_handles_release(void)
+{
+	sensors_subfeature_handle *h;
+
+	pthread_mutex_lock(&handles_lock);
+	for (h = handles; h; h = h->next)
+		handle_release(h);
+	pthread_mutex_unlock(&handles_lock);
+}
@@ -0,0 +1,31 @@
+/*
+    handle.h - Part of libsensors, a Linux library for reading sensor data.
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+    MA 02110-1301 USA.
+*/
+
+#ifndef LIB_SENSORS_HANDLE_H
+#define LIB_SENSORS_HANDLE_H
+
+/* Resolve the handles which aren't, once the chip list and configuration
+   are loaded. Handles of chips which are gone stay unresolved. */
+void sensors_handles_resolve(void);
+
+/* Unresolve all handles, before the chip list and configuration go
+   away. The handles themselves are kept. */
+void sensors_handles_release(void);
+
+#endif /* def LIB_SENSORS_HANDLE_H */
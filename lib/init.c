@@ -24,57 +24,50 @@
 
 #include <sys/types.h>
 #include <sys/stat.h>
-#include <locale.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
 #include <errno.h>
 #include <dirent.h>
 #include <unistd.h>
+#include <pthread.h>
 #include "sensors.h"
 #include "data.h"
 #include "error.h"
+#include "alloc.h"
 #include "access.h"
 #include "conf.h"
 #include "sysfs.h"
 #include "scanner.h"
 #include "init.h"
+#include "sampler.h"
+#include "async.h"
+#include "subscribe.h"
+#include "alarm.h"
+#include "handle.h"
+#include "compute.h"
+#include "stats.h"
+#include "cache.h"
+#include "breaker.h"
+#include "trace.h"
+#include "profile.h"
+#include "virtual.h"
+#include "probes.h"
 
 #define DEFAULT_CONFIG_FILE	ETCDIR "/sensors3.conf"
 #define ALT_CONFIG_FILE		ETCDIR "/sensors.conf"
 #define DEFAULT_CONFIG_DIR	ETCDIR "/sensors.d"
 
-/* Wrapper around sensors_yyparse(), which clears the locale so that
-   the decimal numbers are always parsed properly. */
-static int sensors_parse(void)
+static void free_interval(sensors_interval *interval)
 {
-	int res;
-	char *locale;
-
-	/* Remember the current locale and clear it */
-	locale = setlocale(LC_ALL, NULL);
-	if (locale) {
-		locale = strdup(locale);
-		if (!locale)
-			sensors_fatal_error(__func__, "Out of memory");
-
-		setlocale(LC_ALL, "C");
-	}
-
-	res = sensors_yyparse();
-
-	/* Restore the old locale */
-	if (locale) {
-		setlocale(LC_ALL, locale);
-		free(locale);
-	}
-
-	return res;
+	sensors_free(interval->name);
 }
 
+static void free_chip(sensors_chip *chip);
+
 static void free_bus(sensors_bus *bus)
 {
-	free(bus->adapter);
+	sensors_free(bus->adapter);
 }
 
 static void free_config_busses(void)
@@ -83,41 +76,229 @@ static void free_config_busses(void)
 
 	for (i = 0; i < sensors_config_busses_count; i++)
 		free_bus(&sensors_config_busses[i]);
-	free(sensors_config_busses);
+	sensors_free(sensors_config_busses);
 	sensors_config_busses = NULL;
 	sensors_config_busses_count = sensors_config_busses_max = 0;
 }
 
+static void parse_state_init(sensors_parse_state *state, const char *name)
+{
+	memset(state, 0, sizeof(sensors_parse_state));
+	state->filename = name;
+	state->current_chip = &state->leading;
+}
+
+/* Free whatever was not merged into the global configuration */
+static void parse_state_free(sensors_parse_state *state)
+{
+	int i;
+
+	for (i = 0; i < state->chips_count; i++)
+		free_chip(&state->chips[i]);
+	sensors_free(state->chips);
+	free_chip(&state->leading);
+	for (i = 0; i < state->busses_count; i++)
+		free_bus(&state->busses[i]);
+	sensors_free(state->busses);
+	for (i = 0; i < state->errors_count; i++)
+		sensors_free(state->errors[i].err);
+	sensors_free(state->errors);
+	sensors_free(state->buffer);
+}
+
+/* Parse input into the partial configuration of state. This doesn't
+   touch the global configuration, so several files can be parsed at the
+   same time. */
+static int parse_file(FILE *input, sensors_parse_state *state)
+{
+	void *scanner;
+	int err, phase;
+
+	phase = sensors_alloc_set_phase(SENSORS_ALLOC_PARSE);
+	SENSORS_PROBE1(parse_entry, state->filename);
+	if (sensors_scanner_init(input, state, &scanner)) {
+		err = -SENSORS_ERR_PARSE;
+		goto exit_phase;
+	}
+	err = sensors_yyparse(state, scanner) ? -SENSORS_ERR_PARSE : 0;
+	sensors_scanner_exit(scanner);
+	/* stdio reads the file by blocks, the last read finding its end */
+	sensors_profile_est_syscalls(ftell(input) / BUFSIZ + 2);
+
+exit_phase:
+	sensors_alloc_set_phase(phase);
+	return err;
+}
+
+/* Move the elements of a partial array to the end of a global one */
+#define move_array_els(from, from_count, from_max, to, to_count, to_max) \
+	do { \
+		if (from_count) \
+			sensors_add_array_els(from, from_count, &(to), \
+					      &(to_count), &(to_max), \
+					      sizeof(*(from))); \
+		sensors_free(from); \
+		from = NULL; \
+		from_count = from_max = 0; \
+	} while (0)
+
+/* Merge the partial configuration of a parsed file into the global one,
+   exactly as if it had been parsed there: errors are reported in the
+   order they were found, statements before the file's first chip
+   statement go to the last chip statement so far, and bus substitution
+   is done with the file's own bus statements. name (which the
+   configuration keeps referring to) is recorded, and err is the result
+   of parse_file(). */
+static int merge_config(sensors_parse_state *state, char *name, int err)
+{
+	sensors_profile_span span;
+	sensors_chip *last;
+	int i, phase;
+
+	phase = sensors_alloc_set_phase(SENSORS_ALLOC_PARSE);
+	if (name) {
+		/* Record configuration file name for error reporting */
+		sensors_add_config_files(&name);
+	}
+
+	last = sensors_config_chips_count ?
+	       &sensors_config_chips[sensors_config_chips_count - 1] : NULL;
+	for (i = 0; i < state->errors_count; i++)
+		if (!state->errors[i].deferred || !last)
+			sensors_parse_error_wfn(state->errors[i].err, name,
+						state->errors[i].lineno);
+
+	if (last) {
+		move_array_els(state->leading.labels,
+			       state->leading.labels_count,
+			       state->leading.labels_max, last->labels,
+			       last->labels_count, last->labels_max);
+		move_array_els(state->leading.sets, state->leading.sets_count,
+			       state->leading.sets_max, last->sets,
+			       last->sets_count, last->sets_max);
+		move_array_els(state->leading.computes,
+			       state->leading.computes_count,
+			       state->leading.computes_max, last->computes,
+			       last->computes_count, last->computes_max);
+		move_array_els(state->leading.ignores,
+			       state->leading.ignores_count,
+			       state->leading.ignores_max, last->ignores,
+			       last->ignores_count, last->ignores_max);
+		move_array_els(state->leading.intervals,
+			       state->leading.intervals_count,
+			       state->leading.intervals_max, last->intervals,
+			       last->intervals_count, last->intervals_max);
+	}
+	move_array_els(state->chips, state->chips_count, state->chips_max,
+		       sensors_config_chips, sensors_config_chips_count,
+		       sensors_config_chips_max);
+
+	if (!err) {
+		sensors_config_busses = state->busses;
+		sensors_config_busses_count = state->busses_count;
+		sensors_config_busses_max = state->busses_max;
+		state->busses = NULL;
+		state->busses_count = state->busses_max = 0;
+		sensors_profile_begin(&span, SENSORS_INIT_SUBST);
+		err = sensors_substitute_busses();
+		sensors_profile_end(&span);
+		free_config_busses();
+	}
+
+	parse_state_free(state);
+	SENSORS_PROBE2(parse_return, name, err);
+	sensors_alloc_set_phase(phase);
+	return err;
+}
+
 static int parse_config(FILE *input, const char *name)
 {
-	int err;
+	sensors_profile_span span;
+	sensors_parse_state state;
 	char *name_copy;
+	int err;
 
 	if (name) {
-		/* Record configuration file name for error reporting */
-		name_copy = strdup(name);
+		name_copy = sensors_strdup(name);
 		if (!name_copy)
 			sensors_fatal_error(__func__, "Out of memory");
-		sensors_add_config_files(&name_copy);
 	} else
 		name_copy = NULL;
 
-	if (sensors_scanner_init(input, name_copy)) {
-		err = -SENSORS_ERR_PARSE;
-		goto exit_cleanup;
-	}
-	err = sensors_parse();
-	sensors_scanner_exit();
-	if (err) {
-		err = -SENSORS_ERR_PARSE;
-		goto exit_cleanup;
-	}
+	sensors_profile_begin(&span, SENSORS_INIT_PARSE);
+	parse_state_init(&state, name_copy);
+	err = parse_file(input, &state);
+	err = merge_config(&state, name_copy, err);
+	sensors_profile_end(&span);
+	sensors_profile_add_file(name_copy, span.ns, span.est_syscalls);
+	return err;
+}
+
+/* A file of the configuration directory, parsed by any thread */
+struct parse_job {
+	char *path;
+	int err;
+	int open_errno;			/* Non-zero if the file can't be read */
+	sensors_parse_state state;
+	unsigned long long ns;		/* Profile of the parsing */
+	unsigned long long est_syscalls;
+};
 
-	err = sensors_substitute_busses();
+struct parse_jobs {
+	struct parse_job *jobs;
+	int count;
+	int next;			/* Next job to pick, atomic */
+};
 
-exit_cleanup:
-	free_config_busses();
-	return err;
+#define PARSE_THREADS		8
+
+static void *parse_worker(void *arg)
+{
+	struct parse_jobs *jobs = arg;
+	struct parse_job *job;
+	sensors_profile_span span;
+	FILE *input;
+	int i;
+
+	while ((i = __atomic_fetch_add(&jobs->next, 1, __ATOMIC_RELAXED))
+	       < jobs->count) {
+		job = &jobs->jobs[i];
+		sensors_profile_begin_detached(&span, SENSORS_INIT_CONFIG_DIR);
+		input = fopen(job->path, "r");
+		if (input) {
+			job->err = parse_file(input, &job->state);
+			fclose(input);
+			sensors_profile_est_syscalls(2);
+		} else {
+			job->open_errno = errno;
+			job->err = -SENSORS_ERR_PARSE;
+			sensors_profile_est_syscalls(1);
+		}
+		sensors_profile_end(&span);
+		job->ns = span.ns;
+		job->est_syscalls = span.est_syscalls;
+	}
+	return NULL;
+}
+
+/* Parse the files in parallel, the calling thread helping */
+static void parse_jobs_run(struct parse_jobs *jobs)
+{
+	pthread_t threads[PARSE_THREADS];
+	long cpus;
+	int i, threads_count = 0;
+
+	cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	while (threads_count + 1 < jobs->count &&
+	       threads_count + 1 < cpus && threads_count < PARSE_THREADS) {
+		if (pthread_create(&threads[threads_count], NULL, parse_worker,
+				   jobs))
+			break;
+		threads_count++;
+	}
+	parse_worker(jobs);
+	for (i = 0; i < threads_count; i++)
+		pthread_join(threads[i], NULL);
 }
 
 static int config_file_filter(const struct dirent *entry)
@@ -125,13 +306,19 @@ static int config_file_filter(const struct dirent *entry)
 	return entry->d_name[0] != '.';		/* Skip hidden files */
 }
 
-static int add_config_from_dir(const char *dir)
+/* The files are parsed in parallel, each into its own partial
+   configuration, and then merged in alphabetical order. As when they
+   were parsed one after the other, the first file which can't be read
+   or parsed stops the merge, and its error is returned. */
+static int add_config_files_from_dir(const char *dir)
 {
-	int count, res, i;
+	int count, res, i, jobs_max = 0;
 	struct dirent **namelist;
+	struct parse_jobs jobs = { NULL, 0, 0 };
 
 	count = scandir(dir, &namelist, config_file_filter, alphasort);
 	if (count < 0) {
+		sensors_profile_est_syscalls(1);
 		/* Do not return an error if directory does not exist */
 		if (errno == ENOENT)
 			return 0;
@@ -139,12 +326,13 @@ static int add_config_from_dir(const char *dir)
 		sensors_parse_error_wfn(strerror(errno), NULL, 0);
 		return -SENSORS_ERR_PARSE;
 	}
+	sensors_profile_est_syscalls(4);	/* open, fstat, getdents..., close */
 
 	for (res = 0, i = 0; !res && i < count; i++) {
 		int len;
 		char path[PATH_MAX];
-		FILE *input;
 		struct stat st;
+		struct parse_job job;
 
 		len = snprintf(path, sizeof(path), "%s/%s", dir,
 			       namelist[i]->d_name);
@@ -154,17 +342,16 @@ static int add_config_from_dir(const char *dir)
 		}
 
 		/* Only accept regular files */
+		sensors_profile_est_syscalls(1);
 		if (stat(path, &st) < 0 || !S_ISREG(st.st_mode))
 			continue;
 
-		input = fopen(path, "r");
-		if (input) {
-			res = parse_config(input, path);
-			fclose(input);
-		} else {
-			res = -SENSORS_ERR_PARSE;
-			sensors_parse_error_wfn(strerror(errno), path, 0);
-		}
+		memset(&job, 0, sizeof(job));
+		job.path = sensors_strdup(path);
+		if (!job.path)
+			sensors_fatal_error(__func__, "Out of memory");
+		sensors_add_array_el(&job, &jobs.jobs, &jobs.count, &jobs_max,
+				     sizeof(struct parse_job));
 	}
 
 	/* Free memory allocated by scandir() */
@@ -172,18 +359,77 @@ static int add_config_from_dir(const char *dir)
 		free(namelist[i]);
 	free(namelist);
 
+	/* Not before, as the states point to themselves */
+	for (i = 0; i < jobs.count; i++)
+		parse_state_init(&jobs.jobs[i].state, jobs.jobs[i].path);
+	parse_jobs_run(&jobs);
+
+	for (i = 0; i < jobs.count; i++) {
+		struct parse_job *job = &jobs.jobs[i];
+		sensors_profile_span merge;
+		int err;
+
+		if (job->open_errno) {
+			sensors_parse_error_wfn(strerror(job->open_errno),
+						job->path, 0);
+			err = job->err;
+			parse_state_free(&job->state);
+			sensors_free(job->path);
+		} else {
+			sensors_profile_begin_detached(&merge,
+						       SENSORS_INIT_CONFIG_DIR);
+			err = merge_config(&job->state, job->path, job->err);
+			sensors_profile_end(&merge);
+			sensors_profile_add_file(job->path, job->ns + merge.ns,
+						 job->est_syscalls +
+						 merge.est_syscalls);
+		}
+		if (err) {
+			res = err;
+			break;
+		}
+	}
+	for (i++; i < jobs.count; i++) {
+		parse_state_free(&jobs.jobs[i].state);
+		sensors_free(jobs.jobs[i].path);
+	}
+	sensors_free(jobs.jobs);
+
+	return res;
+}
+
+static int add_config_from_dir(const char *dir)
+{
+	sensors_profile_span span;
+	int res;
+
+	sensors_profile_begin(&span, SENSORS_INIT_CONFIG_DIR);
+	res = add_config_files_from_dir(dir);
+	sensors_profile_end(&span);
 	return res;
 }
 
 int sensors_init(FILE *input)
 {
+	sensors_profile_span span;
 	int res;
 
-	if (!sensors_init_sysfs())
-		return -SENSORS_ERR_KERNEL;
-	if ((res = sensors_read_sysfs_bus()) ||
-	    (res = sensors_read_sysfs_chips()))
-		goto exit_cleanup;
+	sensors_profile_reset();
+	sensors_profile_begin(&span, SENSORS_INIT_OTHER);
+	sensors_trace_start();
+	if (sensors_trace_mode == SENSORS_TRACE_REPLAY) {
+		/* The chips are those of the trace, not of the system */
+		sensors_trace_add_chips();
+	} else {
+		if (!sensors_init_sysfs()) {
+			sensors_profile_end(&span);
+			return -SENSORS_ERR_KERNEL;
+		}
+		/* The i2c adapters are enumerated later, and only if
+		   needed */
+		if ((res = sensors_read_sysfs_chips()))
+			goto exit_cleanup;
+	}
 
 	if (input) {
 		res = parse_config(input, NULL);
@@ -194,11 +440,15 @@ int sensors_init(FILE *input)
 
 		/* No configuration provided, use default */
 		input = fopen(name = DEFAULT_CONFIG_FILE, "r");
-		if (!input && errno == ENOENT)
+		sensors_profile_est_syscalls(1);
+		if (!input && errno == ENOENT) {
 			input = fopen(name = ALT_CONFIG_FILE, "r");
+			sensors_profile_est_syscalls(1);
+		}
 		if (input) {
 			res = parse_config(input, name);
 			fclose(input);
+			sensors_profile_est_syscalls(1);
 			if (res)
 				goto exit_cleanup;
 
@@ -214,66 +464,79 @@ int sensors_init(FILE *input)
 			goto exit_cleanup;
 	}
 
+	sensors_add_virtual_chips();
+	sensors_build_compute_graph();
+	sensors_reserve_snapshots(1);
+	sensors_breakers_init();
+	sensors_handles_resolve();
+	sensors_profile_end(&span);
 	return 0;
 
 exit_cleanup:
+	SENSORS_PROBE2(error, __func__, res);
+	sensors_profile_end(&span);
 	sensors_cleanup();
 	return res;
 }
 
 static void free_chip_name(sensors_chip_name *name)
 {
-	free(name->prefix);
-	free(name->path);
+	sensors_free(name->prefix);
+	sensors_free(name->path);
 }
 
+/* The names but the path are interned, and the subfeature table shares
+   its memory block with the feature table */
 static void free_chip_features(sensors_chip_features *features)
 {
-	int i;
-
-	for (i = 0; i < features->subfeature_count; i++)
-		free(features->subfeature[i].name);
-	free(features->subfeature);
-	for (i = 0; i < features->feature_count; i++)
-		free(features->feature[i].name);
-	free(features->feature);
+	sensors_free(features->chip.path);
+	sensors_free(features->feature);
 }
 
 static void free_label(sensors_label *label)
 {
-	free(label->name);
-	free(label->value);
+	sensors_free(label->name);
+	sensors_free(label->value);
 }
 
 void sensors_free_expr(sensors_expr *expr)
 {
 	if (expr->kind == sensors_kind_var)
-		free(expr->data.var);
+		sensors_free(expr->data.var);
 	else if (expr->kind == sensors_kind_sub) {
 		if (expr->data.subexpr.sub1)
 			sensors_free_expr(expr->data.subexpr.sub1);
 		if (expr->data.subexpr.sub2)
 			sensors_free_expr(expr->data.subexpr.sub2);
+	} else if (expr->kind == sensors_kind_aggregate) {
+		free_chip_name(&expr->data.aggregate.chip);
+		sensors_free(expr->data.aggregate.pattern);
 	}
-	free(expr);
+	sensors_free(expr);
 }
 
 static void free_set(sensors_set *set)
 {
-	free(set->name);
+	sensors_free(set->name);
 	sensors_free_expr(set->value);
 }
 
 static void free_compute(sensors_compute *compute)
 {
-	free(compute->name);
+	sensors_free(compute->name);
 	sensors_free_expr(compute->from_proc);
 	sensors_free_expr(compute->to_proc);
 }
 
 static void free_ignore(sensors_ignore *ignore)
 {
-	free(ignore->name);
+	sensors_free(ignore->name);
+}
+
+static void free_virtual_feature(sensors_virtual_feature *feature)
+{
+	sensors_free(feature->name);
+	sensors_free_expr(feature->value);
 }
 
 static void free_chip(sensors_chip *chip)
@@ -282,58 +545,85 @@ static void free_chip(sensors_chip *chip)
 
 	for (i = 0; i < chip->chips.fits_count; i++)
 		free_chip_name(&chip->chips.fits[i]);
-	free(chip->chips.fits);
+	sensors_free(chip->chips.fits);
 	chip->chips.fits_count = chip->chips.fits_max = 0;
 
 	for (i = 0; i < chip->labels_count; i++)
 		free_label(&chip->labels[i]);
-	free(chip->labels);
+	sensors_free(chip->labels);
 	chip->labels_count = chip->labels_max = 0;
 
 	for (i = 0; i < chip->sets_count; i++)
 		free_set(&chip->sets[i]);
-	free(chip->sets);
+	sensors_free(chip->sets);
 	chip->sets_count = chip->sets_max = 0;
 
 	for (i = 0; i < chip->computes_count; i++)
 		free_compute(&chip->computes[i]);
-	free(chip->computes);
+	sensors_free(chip->computes);
 	chip->computes_count = chip->computes_max = 0;
 
 	for (i = 0; i < chip->ignores_count; i++)
 		free_ignore(&chip->ignores[i]);
-	free(chip->ignores);
+	sensors_free(chip->ignores);
 	chip->ignores_count = chip->ignores_max = 0;
+
+	for (i = 0; i < chip->features_count; i++)
+		free_virtual_feature(&chip->features[i]);
+	sensors_free(chip->features);
+	chip->features_count = chip->features_max = 0;
+
+	for (i = 0; i < chip->intervals_count; i++)
+		free_interval(&chip->intervals[i]);
+	sensors_free(chip->intervals);
+	chip->intervals_count = chip->intervals_max = 0;
 }
 
 void sensors_cleanup(void)
 {
 	int i;
 
-	for (i = 0; i < sensors_proc_chips_count; i++) {
-		free_chip_name(&sensors_proc_chips[i].chip);
+	sensors_handles_release();
+	sensors_async_cleanup();
+	sensors_sampler_cleanup();
+	sensors_subscriptions_cleanup();
+	sensors_alarm_cleanup();
+	sensors_cache_cleanup();
+	sensors_free_attr_fds();
+	sensors_free_snapshots();
+	sensors_stats_cleanup();
+	sensors_breakers_cleanup();
+	sensors_free_compute_graph();
+	sensors_trace_cleanup();
+	sensors_profile_cleanup();
+	sensors_virtual_cleanup();
+
+	for (i = 0; i < sensors_proc_chips_count; i++)
 		free_chip_features(&sensors_proc_chips[i]);
-	}
-	free(sensors_proc_chips);
+	sensors_free(sensors_proc_chips);
 	sensors_proc_chips = NULL;
 	sensors_proc_chips_count = sensors_proc_chips_max = 0;
+	sensors_proc_subfeatures_count = 0;
+	sensors_free_strings();
 
 	for (i = 0; i < sensors_config_chips_count; i++)
 		free_chip(&sensors_config_chips[i]);
-	free(sensors_config_chips);
+	sensors_free(sensors_config_chips);
 	sensors_config_chips = NULL;
 	sensors_config_chips_count = sensors_config_chips_max = 0;
 	sensors_config_chips_subst = 0;
 
 	for (i = 0; i < sensors_proc_bus_count; i++)
 		free_bus(&sensors_proc_bus[i]);
-	free(sensors_proc_bus);
+	sensors_free(sensors_proc_bus);
 	sensors_proc_bus = NULL;
 	sensors_proc_bus_count = sensors_proc_bus_max = 0;
+	sensors_free_bus_index(&sensors_proc_bus_index);
+	sensors_proc_bus_loaded = 0;
 
 	for (i = 0; i < sensors_config_files_count; i++)
-		free(sensors_config_files[i]);
-	free(sensors_config_files);
+		sensors_free(sensors_config_files[i]);
+	sensors_free(sensors_config_files);
 	sensors_config_files = NULL;
 	sensors_config_files_count = sensors_config_files_max = 0;
 }
@@ -0,0 +1,78 @@
+/*
+    probes.h - Part of libsensors, a Linux library for reading sensor data.
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+    MA 02110-1301 USA.
+*/
+
+#ifndef LIB_SENSORS_PROBES_H
+#define LIB_SENSORS_PROBES_H
+
+/* Static tracepoints (USDT) in the "libsensors" provider. They compile
+   to a single nop each when nobody is tracing, and can be listed with
+   e.g. "bpftrace -l 'usdt:/usr/lib/libsensors.so.4:*'". Values are
+   passed in thousandths, as integers, because not all tracers handle
+   floating point arguments.
+
+   discover_entry(path)
+   discover_return(path, prefix, err)	prefix is NULL if no chip
+   read_entry(prefix, attr)
+   read_return(prefix, attr, value, err)
+   write_entry(prefix, attr, value)
+   write_return(prefix, attr, err)
+   eval_entry(prefix, feature)
+   eval_return(prefix, feature, value, err)
+   parse_entry(filename)		filename is NULL for a stream
+   parse_return(filename, err)
+   error(function, err)			public function failing
+
+   The probes are disabled if <sys/sdt.h> is not available, or if
+   SENSORS_NO_PROBES is defined. */
+
+#ifndef SENSORS_NO_PROBES
+#if defined(__has_include)
+#if __has_include(<sys/sdt.h>)
+#define SENSORS_HAVE_PROBES	1
+#endif
+#endif
+#endif
+
+#ifdef SENSORS_HAVE_PROBES
+#include <sys/sdt.h>
+
+#define SENSORS_PROBE1(name, a) \
+	DTRACE_PROBE1(libsensors, name, a)
+#define SENSORS_PROBE2(name, a, b) \
+	DTRACE_PROBE2(libsensors, name, a, b)
+#define SENSORS_PROBE3(name, a, b, c) \
+	DTRACE_PROBE3(libsensors, name, a, b, c)
+#define SENSORS_PROBE4(name, a, b, c, d) \
+	DTRACE_PROBE4(libsensors, name, a, b, c, d)
+#else
+/* Arguments are still referenced, so that variables only used by probes
+   don't trigger warnings */
+#define SENSORS_PROBE1(name, a) \
+	do { (void)(a); } while (0)
+#define SENSORS_PROBE2(name, a, b) \
+	do { (void)(a); (void)(b); } while (0)
+#define SENSORS_PROBE3(name, a, b, c) \
+	do { (void)(a); (void)(b); (void)(c); } while (0)
+#define SENSORS_PROBE4(name, a, b, c, d) \
+	do { (void)(a); (void)(b); (void)(c); (void)(d); } while (0)
+#endif
+
+#define SENSORS_PROBE_VALUE(val)	((long long)((val) * 1000))
+
+#endif /* def LIB_SENSORS_PROBES_H */
@@ -0,0 +1,241 @@
+/*
+    profile.c - Part of libsensors, a Linux library for reading sensor data.
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+    MA 02110-1301 USA.
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include "sensors.h"
+#include "data.h"
+#include "error.h"
+#include "alloc.h"
+#include "general.h"
+#include "profile.h"
+
+/* Initialization profile: where the time of sensors_init() goes, and
+   that of the work it defers (lazy discovery, adapter enumeration).
+   Each phase is a span of the code; spans nest, and a phase is only
+   charged for what its nested spans don't take, so the phases add up to
+   the whole. System calls are counted by the code making them, as the
+   library knows which calls each file operation takes; each thread
+   keeps a running count, which spans sample when they begin and end. */
+
+struct profile_file {
+	const char *name;
+	sensors_init_stats stats;
+};
+
+static int profiling;
+static sensors_init_stats phase_stats[SENSORS_INIT_PHASES];
+static pthread_mutex_t profile_lock = PTHREAD_MUTEX_INITIALIZER;
+static sensors_init_stats *chip_stats;	/* One per detected chip */
+static int chip_stats_count;
+static struct profile_file *file_stats;	/* In the order they were parsed */
+static int file_stats_count;
+static int file_stats_max;
+
+static __thread sensors_profile_span *thread_span;
+static __thread unsigned long long thread_est_syscalls;
+
+void sensors_set_init_profiling(int enable)
+{
+	profiling = enable;
+}
+
+void sensors_profile_cleanup(void)
+{
+	pthread_mutex_lock(&profile_lock);
+	sensors_free(chip_stats);
+	chip_stats = NULL;
+	chip_stats_count = 0;
+	sensors_free(file_stats);
+	file_stats = NULL;
+	file_stats_count = file_stats_max = 0;
+	pthread_mutex_unlock(&profile_lock);
+}
+
+void sensors_profile_reset(void)
+{
+	sensors_profile_cleanup();
+	memset(phase_stats, 0, sizeof(phase_stats));
+}
+
+void sensors_profile_est_syscalls(int n)
+{
+	if (profiling)
+		thread_est_syscalls += n;
+}
+
+static void span_begin(sensors_profile_span *span, int phase, int detached)
+{
+	if (!profiling) {
+		span->phase = -1;
+		return;
+	}
+
+	span->parent = thread_span;
+	span->phase = phase;
+	span->detached = detached;
+	span->child_ns = span->child_est_syscalls = 0;
+	span->start_est_syscalls = thread_est_syscalls;
+	span->start = sensors_monotonic_ns();
+	thread_span = span;
+}
+
+void sensors_profile_begin(sensors_profile_span *span, int phase)
+{
+	span_begin(span, phase, 0);
+}
+
+void sensors_profile_begin_detached(sensors_profile_span *span, int phase)
+{
+	span_begin(span, phase, 1);
+}
+
+void sensors_profile_end(sensors_profile_span *span)
+{
+	sensors_init_stats *stats;
+	unsigned long long charged_ns;
+
+	if (span->phase < 0) {
+		span->ns = span->est_syscalls = 0;
+		return;
+	}
+
+	span->ns = sensors_monotonic_ns() - span->start;
+	span->est_syscalls = thread_est_syscalls - span->start_est_syscalls;
+
+	/* What the phase is charged, the parent is relieved of */
+	charged_ns = span->detached ? span->child_ns : span->ns;
+	stats = &phase_stats[span->phase];
+	if (!span->detached) {
+		__atomic_add_fetch(&stats->ns, span->ns - span->child_ns,
+				   __ATOMIC_RELAXED);
+		__atomic_add_fetch(&stats->count, 1, __ATOMIC_RELAXED);
+	}
+	__atomic_add_fetch(&stats->est_syscalls,
+			   span->est_syscalls - span->child_est_syscalls,
+			   __ATOMIC_RELAXED);
+
+	thread_span = span->parent;
+	if (span->parent) {
+		span->parent->child_ns += charged_ns;
+		span->parent->child_est_syscalls += span->est_syscalls;
+	}
+}
+
+void sensors_profile_add_chip(int chip, const sensors_profile_span *span)
+{
+	sensors_init_stats *stats;
+	int size;
+
+	if (span->phase < 0)
+		return;
+
+	pthread_mutex_lock(&profile_lock);
+	if (chip >= chip_stats_count) {
+		size = chip_stats_count ? 2 * chip_stats_count : 16;
+		while (size <= chip)
+			size *= 2;
+		chip_stats = sensors_realloc(chip_stats,
+					     size * sizeof(sensors_init_stats));
+		if (!chip_stats)
+			sensors_fatal_error(__func__, "Out of memory");
+		memset(chip_stats + chip_stats_count, 0, (size -
+		       chip_stats_count) * sizeof(sensors_init_stats));
+		chip_stats_count = size;
+	}
+	stats = &chip_stats[chip];
+	stats->ns += span->ns;
+	stats->est_syscalls += span->est_syscalls;
+	stats->count++;
+	pthread_mutex_unlock(&profile_lock);
+}
+
+void sensors_profile_add_file(const char *name, unsigned long long ns,
+			      unsigned long long est_syscalls)
+{
+	struct profile_file entry;
+
+	if (!profiling)
+		return;
+
+	entry.name = name;
+	entry.stats.ns = ns;
+	entry.stats.est_syscalls = est_syscalls;
+	entry.stats.count = 1;
+
+	pthread_mutex_lock(&profile_lock);
+	sensors_add_array_el(&entry, &file_stats, &file_stats_count,
+			     &file_stats_max, sizeof(struct profile_file));
+	pthread_mutex_unlock(&profile_lock);
+}
+
+int sensors_get_init_stats(int phase, sensors_init_stats *stats)
+{
+	const sensors_init_stats *s;
+
+	if (phase < 0 || phase >= SENSORS_INIT_PHASES)
+		return -SENSORS_ERR_NO_ENTRY;
+
+	s = &phase_stats[phase];
+	stats->ns = __atomic_load_n(&s->ns, __ATOMIC_RELAXED);
+	stats->est_syscalls = __atomic_load_n(&s->est_syscalls,
+					      __ATOMIC_RELAXED);
+	stats->count = __atomic_load_n(&s->count, __ATOMIC_RELAXED);
+	return 0;
+}
+
+int sensors_get_init_chip_stats(const sensors_chip_name *name,
+				sensors_init_stats *stats)
+{
+	int nr = 0, found = 0;
+
+	memset(stats, 0, sizeof(sensors_init_stats));
+
+	pthread_mutex_lock(&profile_lock);
+	while (sensors_get_detected_chips(name, &nr)) {
+		/* nr is the index of the chip, plus one */
+		if (nr <= chip_stats_count) {
+			stats->ns += chip_stats[nr - 1].ns;
+			stats->est_syscalls += chip_stats[nr - 1].est_syscalls;
+			stats->count += chip_stats[nr - 1].count;
+		}
+		found = 1;
+	}
+	pthread_mutex_unlock(&profile_lock);
+
+	return found ? 0 : -SENSORS_ERR_NO_ENTRY;
+}
+
+int sensors_get_init_file_stats(int nr, const char **name,
+				sensors_init_stats *stats)
+{
+	int res = 0;
+
+	pthread_mutex_lock(&profile_lock);
+	if (nr < 0 || nr >= file_stats_count) {
+		res = -SENSORS_ERR_NO_ENTRY;
+	} else {
+		*name = file_stats[nr].name;
+		*stats = file_stats[nr].stats;
+	}
+	pthread_mutex_unlock(&profile_lock);
+
+	return res;
+}
@@ -0,0 +1,64 @@
+/*
+    profile.h - Part of libsensors, a Linux library for reading sensor data.
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+    MA 02110-1301 USA.
+*/
+
+#ifndef LIB_SENSORS_PROFILE_H
+#define LIB_SENSORS_PROFILE_H
+
+#include "sensors.h"
+
+/* A span of initialization work, on the stack of the thread doing it.
+   Spans nest: the time and system calls of a span go to its phase,
+   except for those of the spans nested in it. A detached span only
+   measures, for per-chip and per-file figures: its own time goes to no
+   phase, so that work done by several threads at once isn't counted
+   more than once. */
+typedef struct sensors_profile_span {
+	struct sensors_profile_span *parent;
+	int phase;			/* -1 if profiling is disabled */
+	int detached;
+	unsigned long long start;
+	unsigned long long start_est_syscalls;
+	unsigned long long child_ns;
+	unsigned long long child_est_syscalls;
+	/* Set by sensors_profile_end(), nested spans included */
+	unsigned long long ns;
+	unsigned long long est_syscalls;
+} sensors_profile_span;
+
+/* Called by sensors_init() first, and by sensors_cleanup() */
+void sensors_profile_reset(void);
+void sensors_profile_cleanup(void);
+
+void sensors_profile_begin(sensors_profile_span *span, int phase);
+void sensors_profile_begin_detached(sensors_profile_span *span, int phase);
+void sensors_profile_end(sensors_profile_span *span);
+
+/* Count n more system calls the calling thread is estimated to make.
+   The figures are only estimates: the calls made by stdio and directory
+   scanning are not counted, but guessed at the call sites. */
+void sensors_profile_est_syscalls(int n);
+
+/* Add the figures of an ended span to chip number chip, or to a
+   configuration file (name is kept, NULL for the input given to
+   sensors_init()) */
+void sensors_profile_add_chip(int chip, const sensors_profile_span *span);
+void sensors_profile_add_file(const char *name, unsigned long long ns,
+			      unsigned long long est_syscalls);
+
+#endif /* def LIB_SENSORS_PROFILE_H */
@@ -0,0 +1,414 @@
+/*
+    sampler.c - Part of libsensors, a Linux library for reading sensor data.
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+    MA 02110-1301 USA.
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+#include "sensors.h"
+#include "data.h"
+#include "error.h"
+#include "alloc.h"
+#include "access.h"
+#include "general.h"
+#include "sampler.h"
+#include "subscribe.h"
+
+/* The sampler thread reads a fixed set of subfeatures periodically and
+   stores the values in one ring buffer per subfeature. Each ring has a
+   single writer (the sampler thread) and any number of readers, which
+   never take a lock: the ring carries a sequence counter which is odd
+   while the writer updates the ring, and readers retry if it changed
+   while they were reading. All memory is allocated when the sampler is
+   started, so the sampler thread itself never allocates. */
+
+struct sample {
+	unsigned long long timestamp;	/* ns, CLOCK_MONOTONIC */
+	double value;
+};
+
+struct sampler_ring {
+	const sensors_chip_features *chip;
+	int subfeat_nr;
+	unsigned int seq;
+	unsigned int count;		/* Samples written since start */
+	int err;			/* Result of the last read */
+	struct sample *samples;		/* ring_depth entries */
+	struct sensors_subscriber *subscribers;
+};
+
+static struct sampler_ring *rings;
+static int rings_count, rings_max;
+static unsigned int ring_depth;
+static unsigned int period_ms;
+
+/* Open-addressed hash of the rings, keyed by chip and subfeature */
+static int *ring_index;
+static int ring_index_size;		/* always a power of 2 */
+
+static struct sample *sample_storage;
+
+static pthread_t sampler_thread;
+static pthread_mutex_t sampler_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t sampler_cond;
+static int sampler_running, sampler_stopping;
+
+static unsigned int ring_hash(const sensors_chip_features *chip,
+			      int subfeat_nr)
+{
+	return ((unsigned int)(chip - sensors_proc_chips) * 65599U +
+		(unsigned int)subfeat_nr) * 2654435761U;
+}
+
+static struct sampler_ring *
+sampler_lookup_ring(const sensors_chip_features *chip, int subfeat_nr)
+{
+	unsigned int slot;
+	struct sampler_ring *ring;
+
+	if (!ring_index_size)
+		return NULL;
+
+	for (slot = ring_hash(chip, subfeat_nr) & (ring_index_size - 1);
+	     ring_index[slot] >= 0;
+	     slot = (slot + 1) & (ring_index_size - 1)) {
+		ring = &rings[ring_index[slot]];
+		if (ring->chip == chip && ring->subfeat_nr == subfeat_nr)
+			return ring;
+	}
+	return NULL;
+}
+
+static void sampler_build_index(void)
+{
+	int i, size;
+	unsigned int slot;
+
+	for (size = 16; size < 2 * rings_count; size <<= 1)
+		;
+	sensors_free(ring_index);
+	ring_index = sensors_malloc(size * sizeof(int));
+	if (!ring_index)
+		sensors_fatal_error(__func__, "Out of memory");
+	memset(ring_index, 0xff, size * sizeof(int));
+	ring_index_size = size;
+
+	for (i = 0; i < rings_count; i++) {
+		slot = ring_hash(rings[i].chip, rings[i].subfeat_nr) &
+		       (size - 1);
+		while (ring_index[slot] >= 0)
+			slot = (slot + 1) & (size - 1);
+		ring_index[slot] = i;
+	}
+}
+
+/* Only called from the sampler thread */
+static void sampler_read(struct sampler_ring *ring)
+{
+	struct sample *sample;
+	unsigned long long timestamp;
+	double value;
+	int err;
+
+	err = sensors_get_value_timestamp(&ring->chip->chip, ring->subfeat_nr,
+					  &value, &timestamp);
+	__atomic_store_n(&ring->err, err, __ATOMIC_RELAXED);
+	if (err)
+		return;
+
+	/* Same value as last time, served from the value cache */
+	if (ring->count &&
+	    ring->samples[(ring->count - 1) % ring_depth].timestamp == timestamp)
+		return;
+
+	__atomic_store_n(&ring->seq, ring->seq + 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+
+	sample = &ring->samples[ring->count % ring_depth];
+	sample->timestamp = timestamp;
+	sample->value = value;
+	__atomic_store_n(&ring->count, ring->count + 1, __ATOMIC_RELAXED);
+
+	__atomic_store_n(&ring->seq, ring->seq + 1, __ATOMIC_RELEASE);
+
+	if (__atomic_load_n(&ring->subscribers, __ATOMIC_RELAXED))
+		sensors_subscribers_check(&ring->subscribers, value, timestamp);
+}
+
+static void *sampler_main(void *arg)
+{
+	struct timespec next, now;
+	int i;
+	(void)arg; /* hide warning */
+
+	clock_gettime(CLOCK_MONOTONIC, &next);
+
+	pthread_mutex_lock(&sampler_lock);
+	while (!sampler_stopping) {
+		pthread_mutex_unlock(&sampler_lock);
+
+		for (i = 0; i < rings_count; i++)
+			sampler_read(&rings[i]);
+
+		/* Deadlines are absolute so the period does not drift. If
+		   we fell behind, skip the missed periods. */
+		next.tv_sec += period_ms / 1000;
+		next.tv_nsec += (period_ms % 1000) * 1000000;
+		if (next.tv_nsec >= 1000000000) {
+			next.tv_sec++;
+			next.tv_nsec -= 1000000000;
+		}
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		if (now.tv_sec > next.tv_sec ||
+		    (now.tv_sec == next.tv_sec && now.tv_nsec > next.tv_nsec))
+			next = now;
+
+		pthread_mutex_lock(&sampler_lock);
+		while (!sampler_stopping &&
+		       pthread_cond_timedwait(&sampler_cond, &sampler_lock,
+					      &next) != ETIMEDOUT)
+			;
+	}
+	pthread_mutex_unlock(&sampler_lock);
+
+	return NULL;
+}
+
+int sensors_sampler_add(const sensors_chip_name *name, int subfeat_nr)
+{
+	const sensors_chip_features *chip;
+	struct sampler_ring ring;
+	int i;
+
+	if (sampler_running)
+		return -SENSORS_ERR_BUSY;
+	if (sensors_chip_name_has_wildcards(name))
+		return -SENSORS_ERR_WILDCARDS;
+	if (!(chip = sensors_lookup_chip(name)))
+		return -SENSORS_ERR_NO_ENTRY;
+	if (subfeat_nr < 0 || subfeat_nr >= chip->subfeature_count)
+		return -SENSORS_ERR_NO_ENTRY;
+	if (!(chip->subfeature[subfeat_nr].flags & SENSORS_MODE_R))
+		return -SENSORS_ERR_ACCESS_R;
+
+	for (i = 0; i < rings_count; i++)
+		if (rings[i].chip == chip && rings[i].subfeat_nr == subfeat_nr)
+			return 0;
+
+	memset(&ring, 0, sizeof(ring));
+	ring.chip = chip;
+	ring.subfeat_nr = subfeat_nr;
+	ring.err = -SENSORS_ERR_NO_ENTRY;	/* Not sampled yet */
+	sensors_add_array_el(&ring, &rings, &rings_count, &rings_max,
+			     sizeof(struct sampler_ring));
+	return 0;
+}
+
+int sensors_sampler_start(unsigned int period, unsigned int depth)
+{
+	pthread_condattr_t attr;
+	int i;
+
+	if (sampler_running)
+		return -SENSORS_ERR_BUSY;
+	if (!period || !depth || !rings_count)
+		return -SENSORS_ERR_NO_ENTRY;
+
+	sensors_free(sample_storage);
+	sample_storage = sensors_calloc((size_t)rings_count * depth,
+				sizeof(struct sample));
+	if (!sample_storage)
+		sensors_fatal_error(__func__, "Out of memory");
+	for (i = 0; i < rings_count; i++) {
+		rings[i].samples = sample_storage + (size_t)i * depth;
+		rings[i].seq = rings[i].count = 0;
+		rings[i].err = -SENSORS_ERR_NO_ENTRY;
+	}
+	sampler_build_index();
+	/* One for the sampler thread, besides the caller's */
+	sensors_reserve_snapshots(2);
+	ring_depth = depth;
+	period_ms = period;
+
+	pthread_condattr_init(&attr);
+	pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+	pthread_cond_init(&sampler_cond, &attr);
+	pthread_condattr_destroy(&attr);
+
+	sampler_stopping = 0;
+	if (pthread_create(&sampler_thread, NULL, sampler_main, NULL)) {
+		pthread_cond_destroy(&sampler_cond);
+		return -SENSORS_ERR_KERNEL;
+	}
+	sampler_running = 1;
+
+	return 0;
+}
+
+void sensors_sampler_stop(void)
+{
+	if (!sampler_running)
+		return;
+
+	pthread_mutex_lock(&sampler_lock);
+	sampler_stopping = 1;
+	pthread_cond_signal(&sampler_cond);
+	pthread_mutex_unlock(&sampler_lock);
+
+	pthread_join(sampler_thread, NULL);
+	pthread_cond_destroy(&sampler_cond);
+	sampler_running = 0;
+}
+
+struct sensors_subscriber **
+sensors_sampler_subscribers(const sensors_chip_features *chip, int subfeat_nr)
+{
+	int i;
+
+	/* The index is only built when the sampler starts */
+	for (i = 0; i < rings_count; i++)
+		if (rings[i].chip == chip && rings[i].subfeat_nr == subfeat_nr)
+			return &rings[i].subscribers;
+	return NULL;
+}
+
+static struct sampler_ring *sampler_find(const sensors_chip_name *name,
+					 int subfeat_nr, int *err)
+{
+	const sensors_chip_features *chip;
+	struct sampler_ring *ring;
+
+	if (sensors_chip_name_has_wildcards(name)) {
+		*err = -SENSORS_ERR_WILDCARDS;
+		return NULL;
+	}
+	if (!(chip = sensors_lookup_chip(name)) ||
+	    !(ring = sampler_lookup_ring(chip, subfeat_nr))) {
+		*err = -SENSORS_ERR_NO_ENTRY;
+		return NULL;
+	}
+	return ring;
+}
+
+int sensors_sampler_get_latest(const sensors_chip_name *name, int subfeat_nr,
+			       double *value, unsigned long long *timestamp)
+{
+	struct sampler_ring *ring;
+	struct sample sample;
+	unsigned int seq, count;
+	int err;
+
+	if (!(ring = sampler_find(name, subfeat_nr, &err)))
+		return err;
+
+	for (;;) {
+		seq = __atomic_load_n(&ring->seq, __ATOMIC_ACQUIRE);
+		if (seq & 1)
+			continue;	/* Writer in progress */
+
+		count = __atomic_load_n(&ring->count, __ATOMIC_RELAXED);
+		if (count)
+			sample = ring->samples[(count - 1) % ring_depth];
+
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+		if (__atomic_load_n(&ring->seq, __ATOMIC_RELAXED) == seq)
+			break;
+	}
+
+	/* No successful read yet, report why */
+	if (!count)
+		return __atomic_load_n(&ring->err, __ATOMIC_RELAXED);
+
+	*value = sample.value;
+	if (timestamp)
+		*timestamp = sample.timestamp;
+	return 0;
+}
+
+int sensors_sampler_get_window(const sensors_chip_name *name, int subfeat_nr,
+			       unsigned int window, sensors_sample_stats *stats)
+{
+	struct sampler_ring *ring;
+	const struct sample *sample;
+	unsigned long long now, since;
+	unsigned int seq, count, i, n;
+	double sum;
+	int err;
+
+	if (!(ring = sampler_find(name, subfeat_nr, &err)))
+		return err;
+
+	/* A window reaching back past the clock's origin covers all
+	   samples */
+	now = sensors_monotonic_ns();
+	since = (unsigned long long)window * 1000000ULL;
+	since = since < now ? now - since : 0;
+
+	for (;;) {
+		seq = __atomic_load_n(&ring->seq, __ATOMIC_ACQUIRE);
+		if (seq & 1)
+			continue;	/* Writer in progress */
+
+		count = __atomic_load_n(&ring->count, __ATOMIC_RELAXED);
+		n = count < ring_depth ? count : ring_depth;
+		memset(stats, 0, sizeof(*stats));
+		sum = 0;
+
+		/* Walk back from the newest sample */
+		for (i = 0; i < n; i++) {
+			sample = &ring->samples[(count - 1 - i) % ring_depth];
+			if (sample->timestamp < since)
+				break;
+
+			if (!i) {
+				stats->last = stats->min = stats->max =
+					sample->value;
+			} else if (sample->value < stats->min) {
+				stats->min = sample->value;
+			} else if (sample->value > stats->max) {
+				stats->max = sample->value;
+			}
+			sum += sample->value;
+		}
+		stats->count = i;
+
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+		if (__atomic_load_n(&ring->seq, __ATOMIC_RELAXED) == seq)
+			break;
+	}
+
+	if (stats->count)
+		stats->mean = sum / stats->count;
+	return 0;
+}
+
+void sensors_sampler_cleanup(void)
+{
+	sensors_sampler_stop();
+
+	sensors_free(rings);
+	rings = NULL;
+	rings_count = rings_max = 0;
+	sensors_free(ring_index);
+	ring_index = NULL;
+	ring_index_size = 0;
+	sensors_free(sample_storage);
+	sample_storage = NULL;
+}
@@ -21,8 +21,13 @@
 #ifndef LIB_SENSORS_SCANNER_H
 #define LIB_SENSORS_SCANNER_H
 
-int sensors_scanner_init(FILE *input, const char *filename);
-void sensors_scanner_exit(void);
+#include <stdio.h>
+#include "conf.h"
 
-#endif
+/* Each scanner reads one file, tokens carrying the file name and line
+   numbers of state */
+int sensors_scanner_init(FILE *input, sensors_parse_state *state,
+			 void **scanner);
+void sensors_scanner_exit(void *scanner);
 
+#endif
@@ -31,7 +31,7 @@
    when the API + ABI breaks), the third digit is incremented to track small
    API additions like new flags / enum values. The second digit is for tracking
    larger additions like new methods. */
-#define SENSORS_API_VERSION		0x421
+#define SENSORS_API_VERSION		0x430
 
 #define SENSORS_CHIP_NAME_PREFIX_ANY	NULL
 #define SENSORS_CHIP_NAME_ADDR_ANY	(-1)
@@ -77,6 +77,14 @@ int sensors_init(FILE *input);
    this, until the next sensors_init() call! */
 void sensors_cleanup(void);
 
+/* Lazy discovery, disabled by default. When enabled, sensors_init() only
+   records the name, bus, address and path of each chip, and the features
+   and subfeatures of a chip are enumerated when they are first needed,
+   for example by sensors_get_features() or sensors_get_value(). This
+   makes initialization cheap when only a few chips are accessed. Takes
+   effect at the next sensors_init(). */
+void sensors_set_lazy_discovery(int enable);
+
 /* Parse a chip name to the internal representation. Return 0 on success, <0
    on error. */
 int sensors_parse_chip_name(const char *orig_name, sensors_chip_name *res);
@@ -104,18 +112,106 @@ typedef struct sensors_feature sensors_feature;
 char *sensors_get_label(const sensors_chip_name *name,
 			const sensors_feature *feature);
 
+/* Look up the interval, in milliseconds, at which a feature should be
+   sampled according to the interval statements of the configuration, or
+   the chip if feature is NULL. Note that chip should not contain
+   wildcard values! Returns 0 if no interval is configured, and <0 on
+   failure. */
+int sensors_get_interval(const sensors_chip_name *name,
+			 const sensors_feature *feature);
+
 /* Read the value of a subfeature of a certain chip. Note that chip should not
    contain wildcard values! This function will return 0 on success, and <0
    on failure.  */
 int sensors_get_value(const sensors_chip_name *name, int subfeat_nr,
 		      double *value);
 
+/* Same as sensors_get_value(), and also return the time at which the
+   value was read from the hardware, in nanoseconds on the
+   CLOCK_MONOTONIC clock. */
+int sensors_get_value_timestamp(const sensors_chip_name *name, int subfeat_nr,
+				double *value, unsigned long long *timestamp);
+
+/* A request to read the value of a subfeature, for sensors_get_values() */
+typedef struct sensors_value_request {
+	const sensors_chip_name *name;
+	int subfeat_nr;
+	double value;
+	int err;
+} sensors_value_request;
+
+/* Read the values of count subfeatures at once. The hardware reads are
+   all issued together where the kernel supports it (io_uring), so that
+   slow chips are read in parallel. The subfeatures which compute
+   statements refer to are read along, each subfeature only once. For
+   each request, err is set to 0 and value to the value on success, err
+   to <0 on failure. This function
+   will return 0 if all reads succeeded, the first error otherwise. */
+int sensors_get_values(sensors_value_request *reqs, int count);
+
+/* The attribute files read by sensors_get_values() are kept open, up to
+   max of them, SENSORS_ATTR_FDS_DEFAULT by default; the others are
+   opened and closed for each read. 0 keeps none open. Lowering the limit
+   closes the files past it, once the reads using them are done. */
+#define SENSORS_ATTR_FDS_DEFAULT	256
+void sensors_set_attr_fd_limit(unsigned int max);
+
+/* Asynchronous reads. sensors_read_async() queues a call to
+   sensors_get_values() and returns at once; it is performed by a pool of
+   library threads. When it completes, the file descriptor returned by
+   sensors_async_fd() becomes readable (poll it for POLLIN), and the next
+   call to sensors_async_dispatch() fills reqs and calls callback, in the
+   calling thread, with the return value of sensors_get_values() as err.
+   reqs must stay valid until then; the chip names they point to are
+   copied, and may go away as soon as this returns.
+   sensors_read_async() returns a positive read identifier, or
+   -SENSORS_ERR_BUSY if too many reads are pending already. */
+typedef void (*sensors_read_callback)(sensors_value_request *reqs, int count,
+				      int err, void *data);
+
+int sensors_read_async(sensors_value_request *reqs, int count,
+		       sensors_read_callback callback, void *data);
+int sensors_async_fd(void);
+
+/* Call the callbacks of the completed reads. Returns how many were
+   called. */
+int sensors_async_dispatch(void);
+
+/* Cancel a read which was not dispatched yet, even while it is being
+   performed. Its callback won't be called and its requests won't be
+   touched any longer, so they may be freed as soon as this returns.
+   Returns -SENSORS_ERR_NO_ENTRY if there is no such read. */
+int sensors_async_cancel(int id);
+
 /* Set the value of a subfeature of a certain chip. Note that chip should not
    contain wildcard values! This function will return 0 on success, and <0
    on failure. */
 int sensors_set_value(const sensors_chip_name *name, int subfeat_nr,
 		      double value);
 
+/* Subfeature handles. sensors_handle_open() looks up a subfeature of a
+   certain chip once, so that sensors_handle_read() and
+   sensors_handle_write() only have to access the attribute file and
+   apply the compute statement; they bypass the value cache and the
+   operation counters. Note that chip should not contain wildcard values!
+   Handles stay valid across configuration reloads: sensors_cleanup()
+   detaches them, and sensors_init() looks their chip and subfeature up
+   again, by name. sensors_handle_invalidate() detaches the handles of
+   all chips matching name, which may contain wildcards (NULL matches
+   all chips), and returns how many; the application calls it when it
+   knows chips went away. Detached handles fail with
+   -SENSORS_ERR_NO_ENTRY until the next sensors_init() finds their
+   subfeature again. Handles must not be used while they are being
+   detached or closed. */
+typedef struct sensors_subfeature_handle sensors_subfeature_handle;
+
+int sensors_handle_open(const sensors_chip_name *name, int subfeat_nr,
+			sensors_subfeature_handle **handle);
+void sensors_handle_close(sensors_subfeature_handle *handle);
+int sensors_handle_read(sensors_subfeature_handle *handle, double *value);
+int sensors_handle_write(sensors_subfeature_handle *handle, double value);
+int sensors_handle_invalidate(const sensors_chip_name *name);
+
 /* Execute all set statements for this particular chip. The chip may contain
    wildcards!  This function will return 0 on success, and <0 on failure. */
 int sensors_do_chip_sets(const sensors_chip_name *name);
@@ -132,6 +228,7 @@ const sensors_chip_name *sensors_get_detected_chips(const sensors_chip_name
 #define SENSORS_MODE_R			1
 #define SENSORS_MODE_W			2
 #define SENSORS_COMPUTE_MAPPING		4
+#define SENSORS_STATIC_VALUE		8
 
 typedef enum sensors_feature_type {
 	SENSORS_FEATURE_IN		= 0x00,
@@ -222,8 +319,9 @@ struct sensors_feature {
      (for example subfeatures fan1_input, fan1_min, fan1_div and fan1_alarm
       are mapped to main feature fan1)
    flags is a bitfield, its value is a combination of SENSORS_MODE_R (readable),
-     SENSORS_MODE_W (writable) and SENSORS_COMPUTE_MAPPING (affected by the
-     computation rules of the main feature) */
+     SENSORS_MODE_W (writable), SENSORS_COMPUTE_MAPPING (affected by the
+     computation rules of the main feature) and SENSORS_STATIC_VALUE (a
+     limit or setting, which only changes when written) */
 typedef struct sensors_subfeature {
 	char *name;
 	int number;
@@ -258,6 +356,291 @@ sensors_get_subfeature(const sensors_chip_name *name,
 		       const sensors_feature *feature,
 		       sensors_subfeature_type type);
 
+/* Background sampling. The subfeatures registered with
+   sensors_sampler_add() are read every period milliseconds by a library
+   thread, and the last depth values of each are kept in memory. Readers
+   never block the sampler thread and vice versa. Subfeatures can only be
+   added while the sampler is stopped, -SENSORS_ERR_BUSY is returned
+   otherwise. Restarting the sampler discards previous samples. */
+typedef struct sensors_sample_stats {
+	double min;
+	double max;
+	double mean;
+	double last;
+	unsigned int count;
+} sensors_sample_stats;
+
+int sensors_sampler_add(const sensors_chip_name *name, int subfeat_nr);
+int sensors_sampler_start(unsigned int period, unsigned int depth);
+void sensors_sampler_stop(void);
+
+/* Return the most recent sample of a subfeature, and optionally the time
+   at which it was taken, in nanoseconds on the CLOCK_MONOTONIC clock. If
+   no sample was taken yet, the error of the last read attempt is
+   returned. */
+int sensors_sampler_get_latest(const sensors_chip_name *name, int subfeat_nr,
+			       double *value, unsigned long long *timestamp);
+
+/* Compute statistics over the samples taken during the last window
+   milliseconds. stats->count is 0 if there are none. */
+int sensors_sampler_get_window(const sensors_chip_name *name, int subfeat_nr,
+			       unsigned int window, sensors_sample_stats *stats);
+
+/* Threshold subscriptions, evaluated by the sampler each time it takes a
+   new sample of the subfeature, so all the subscribers of a subfeature
+   share its reads. A subscription becomes active when the value goes
+   above (or below) level, and inactive again when it goes back below
+   level - hysteresis (or above level + hysteresis). Either change only
+   happens once the condition held for dwell milliseconds, as seen by
+   the sampler. Only changes are reported: the file descriptor returned
+   by sensors_event_fd() becomes readable, and sensors_event_dispatch()
+   calls the callbacks, in the calling thread. If the state changes back
+   and forth before it is dispatched, no event is reported.
+
+   sensors_subscribe() adds the subfeature to the sampler if needed, so
+   it returns -SENSORS_ERR_BUSY for a subfeature not sampled yet while
+   the sampler is running. It returns a positive subscription
+   identifier on success. */
+#define SENSORS_SUBSCRIBE_ABOVE		0
+#define SENSORS_SUBSCRIBE_BELOW		1
+
+typedef struct sensors_subscription {
+	int type;
+	double level;
+	double hysteresis;
+	unsigned int dwell;
+} sensors_subscription;
+
+typedef struct sensors_event {
+	const sensors_chip_name *name;
+	int subfeat_nr;
+	int id;				/* Subscription identifier */
+	int active;
+	double value;			/* Sample which caused the change */
+	unsigned long long timestamp;	/* Time of that sample */
+} sensors_event;
+
+typedef void (*sensors_event_callback)(const sensors_event *event,
+				       void *data);
+
+int sensors_subscribe(const sensors_chip_name *name, int subfeat_nr,
+		      const sensors_subscription *sub,
+		      sensors_event_callback callback, void *data);
+int sensors_unsubscribe(int id);
+int sensors_event_fd(void);
+
+/* Returns the number of events dispatched */
+int sensors_event_dispatch(void);
+
+/* Alarm watching. The files of the subfeatures registered with
+   sensors_watch_alarm() are waited on for notifications from the
+   driver, and the file descriptor returned by sensors_alarm_fd() becomes
+   readable when one may have changed. Files which never notified are
+   read every interval milliseconds instead (1000 by default, 0 to only
+   rely on notifications). sensors_get_alarm_changes() then fills up to
+   max changes, and returns their number; if that is max, more may be
+   left. */
+typedef struct sensors_alarm_change {
+	const sensors_chip_name *name;
+	int subfeat_nr;
+	double value;			/* New value */
+} sensors_alarm_change;
+
+int sensors_watch_alarm(const sensors_chip_name *name, int subfeat_nr);
+int sensors_set_alarm_poll_interval(unsigned int interval);
+int sensors_alarm_fd(void);
+int sensors_get_alarm_changes(sensors_alarm_change *changes, int max);
+
+/* Value cache. When enabled, the raw values read from the hardware are
+   reused for a per-chip time to live, in milliseconds. It defaults to
+   the update interval of the chip if the driver exposes it, ttl
+   otherwise (0 disables caching for the chip). Threads reading the
+   same value at the same time share a single hardware read. The cache
+   must not be enabled nor disabled while other threads read values. */
+int sensors_cache_enable(unsigned int ttl);
+void sensors_cache_disable(void);
+
+/* Change the time to live of all chips matching name, which may contain
+   wildcards. Returns -SENSORS_ERR_NO_ENTRY if the cache is disabled or
+   no chip matches. */
+int sensors_cache_set_ttl(const sensors_chip_name *name, unsigned int ttl);
+
+/* Caching modes, independent of the time to live. With
+   SENSORS_CACHE_STATIC, the values of the subfeatures flagged
+   SENSORS_STATIC_VALUE are read once, and then cached until they are
+   written or invalidated. SENSORS_CACHE_SOFT_ALARMS, which implies
+   SENSORS_CACHE_STATIC, derives the alarm subfeatures from the cached
+   limits and the input value read last, if it was read within the last
+   second: the alarm is only read from the hardware if the input is at or
+   past a limit, or the alarm was raised on the last read. The modes are
+   reset by sensors_cleanup(), and must not be changed while other
+   threads read values. */
+#define SENSORS_CACHE_STATIC		1
+#define SENSORS_CACHE_SOFT_ALARMS	2
+
+int sensors_cache_set_flags(int flags);
+
+/* Drop the cached values of all chips matching name, which may contain
+   wildcards, static or not. NULL matches all chips. */
+int sensors_cache_invalidate(const sensors_chip_name *name);
+
+/* Memory allocation. All the memory the library uses is obtained from
+   the allocator, which defaults to malloc(), realloc() and free(), and
+   the ctx member is passed to each call. The allocator can only be
+   changed while the library holds no memory, that is before
+   sensors_init() or after sensors_cleanup(); -SENSORS_ERR_BUSY is
+   returned otherwise. NULL restores the default. If an allocation
+   fails, sensors_fatal_error() is called. The strings returned by
+   sensors_get_label() are the exception: they are allocated with
+   malloc(), as the caller frees them. */
+typedef struct sensors_allocator {
+	void *(*malloc)(size_t size, void *ctx);
+	void *(*realloc)(void *ptr, size_t size, void *ctx);
+	void (*free)(void *ptr, void *ctx);
+	void *ctx;
+} sensors_allocator;
+
+int sensors_set_allocator(const sensors_allocator *allocator);
+
+/* Allocation accounting, disabled by default. The allocations are
+   counted per phase: configuration parsing, chip discovery, and
+   everything else. A realloc() of an existing block counts as both an
+   allocation and a free. bytes is the total requested. */
+#define SENSORS_ALLOC_RUNTIME		0
+#define SENSORS_ALLOC_PARSE		1
+#define SENSORS_ALLOC_DISCOVER		2
+#define SENSORS_ALLOC_PHASES		3
+
+typedef struct sensors_alloc_stats {
+	unsigned long long allocs;
+	unsigned long long frees;
+	unsigned long long bytes;
+} sensors_alloc_stats;
+
+void sensors_set_alloc_accounting(int enable);
+int sensors_get_alloc_stats(int phase, sensors_alloc_stats *stats);
+void sensors_reset_alloc_stats(void);
+
+/* Operation counters, kept per chip. Reads and writes are those of
+   subfeature values, evaluations those of compute statements, and
+   discoveries those of chips at initialization time. errors[i] counts
+   the failures with error -i, errors[0] those with other errors.
+   histogram[i] counts the operations which took between 2^i and
+   2^(i+1) - 1 nanoseconds, the last bucket also counts slower ones. */
+#define SENSORS_STATS_READ		0
+#define SENSORS_STATS_WRITE		1
+#define SENSORS_STATS_EVAL		2
+#define SENSORS_STATS_DISCOVER		3
+#define SENSORS_STATS_OPS		4
+
+#define SENSORS_STATS_ERRORS		16
+#define SENSORS_STATS_BUCKETS		32
+
+typedef struct sensors_op_stats {
+	unsigned long long count;
+	unsigned long long errors[SENSORS_STATS_ERRORS];
+	unsigned long long total_ns;
+	unsigned long long max_ns;
+	unsigned long long histogram[SENSORS_STATS_BUCKETS];
+} sensors_op_stats;
+
+/* Circuit breaker state, see sensors_set_breaker() */
+#define SENSORS_BREAKER_CLOSED		0	/* Chip read normally */
+#define SENSORS_BREAKER_PROBING		1	/* One read let through */
+#define SENSORS_BREAKER_OPEN		2	/* Reads fail fast */
+
+typedef struct sensors_breaker_stats {
+	int state;
+	int failures;			/* Consecutive I/O errors */
+	unsigned int backoff;		/* ms between probes, 0 if closed */
+	unsigned long long trips;	/* Times the breaker opened */
+	unsigned long long rejected;	/* Reads which failed fast */
+} sensors_breaker_stats;
+
+typedef struct sensors_stats {
+	sensors_op_stats op[SENSORS_STATS_OPS];
+	sensors_breaker_stats breaker;
+} sensors_stats;
+
+/* Sum the counters of all chips matching name, which may contain
+   wildcards. If name is NULL, the operations which are not tied to a
+   chip are included too. Returns -SENSORS_ERR_NO_ENTRY if no chip
+   matches. For several chips, the breaker state, failures and backoff
+   are those of the worst one. */
+int sensors_get_stats(const sensors_chip_name *name, sensors_stats *stats);
+
+/* Zero all counters */
+void sensors_reset_stats(void);
+
+/* Circuit breaker. After threshold consecutive I/O errors on a chip,
+   reading any of its values fails with -SENSORS_ERR_BREAKER without
+   accessing the hardware, so that a wedged device doesn't stall every
+   read for the bus timeout. After backoff milliseconds, a single read is
+   let through as a probe: if it works, the chip is read normally again,
+   otherwise the delay doubles, up to max_backoff milliseconds. The
+   defaults are 3, 1000 and 60000; a threshold of 0 disables the
+   breaker. */
+int sensors_set_breaker(unsigned int threshold, unsigned int backoff,
+			unsigned int max_backoff);
+
+/* Traces. sensors_trace_record() writes the detected chips, their
+   features and the result of every attribute read, with its time, to a
+   compact binary file. sensors_trace_replay() loads such a file, and the
+   library then presents its chips instead of those of the system: reads
+   return the recorded values and errors, writes are dropped. With a
+   speed of 0, each read of an attribute returns its next recorded value,
+   whatever the timing, so replays are deterministic; otherwise a read
+   returns the value the attribute had at the same time in the trace,
+   time running speed times faster. Once the trace is exhausted, the last
+   values stick. Both must be called before sensors_init(), the trace
+   ends with sensors_cleanup(). Return -SENSORS_ERR_BUSY if a trace is
+   already set up, and -SENSORS_ERR_PARSE if the file to replay is not a
+   valid trace. */
+int sensors_trace_record(const char *path);
+int sensors_trace_replay(const char *path, unsigned int speed);
+
+/* Initialization profile, disabled by default. When enabled, each
+   sensors_init() records where its time goes, per phase, per chip and
+   per configuration file, along with an estimate of the number of system
+   calls the library made (estimated from the I/O it performs, as stdio
+   and directory scanning don't let them be counted); the work it defers
+   (enumeration of the features of a chip with lazy discovery, and of
+   the i2c adapters) is included when it happens. Each phase is only charged for what the phases it
+   triggers don't take (the adapters are typically enumerated during bus
+   substitution), so the phases add up to the total. Configuration files
+   are parsed in parallel, so the times of the files may add up to more
+   than that of their phase. */
+#define SENSORS_INIT_OTHER		0	/* None of the phases below */
+#define SENSORS_INIT_CHIPS		1	/* hwmon device scanning */
+#define SENSORS_INIT_BUSSES		2	/* i2c adapter enumeration */
+#define SENSORS_INIT_PARSE		3	/* Main configuration file */
+#define SENSORS_INIT_CONFIG_DIR		4	/* Files of sensors.d */
+#define SENSORS_INIT_SUBST		5	/* Bus substitution */
+#define SENSORS_INIT_PHASES		6
+
+typedef struct sensors_init_stats {
+	unsigned long long ns;		/* Wall time */
+	unsigned long long est_syscalls;	/* See above */
+	unsigned int count;		/* Times the phase ran, or the chip
+					   was discovered */
+} sensors_init_stats;
+
+void sensors_set_init_profiling(int enable);
+int sensors_get_init_stats(int phase, sensors_init_stats *stats);
+
+/* Sum of the discovery figures of all chips matching name, which may
+   contain wildcards; NULL matches all chips. Returns
+   -SENSORS_ERR_NO_ENTRY if no chip matches. */
+int sensors_get_init_chip_stats(const sensors_chip_name *name,
+				sensors_init_stats *stats);
+
+/* The figures of configuration file number nr, in the order they were
+   parsed, and its name, NULL for the input given to sensors_init().
+   Returns -SENSORS_ERR_NO_ENTRY if nr is out of range. The figures go
+   away with sensors_cleanup(). */
+int sensors_get_init_file_stats(int nr, const char **name,
+				sensors_init_stats *stats);
+
 #ifdef __cplusplus
 }
 #endif /* __cplusplus */
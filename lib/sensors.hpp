@@ -0,0 +1,538 @@
+/*
+    sensors.hpp - Part of libsensors, a Linux library for reading sensor data.
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+    MA 02110-1301 USA.
+*/
+
+#ifndef LIB_SENSORS_SENSORS_HPP
+#define LIB_SENSORS_SENSORS_HPP
+
+/* C++17 layer over the C API, header-only. Everything is inline and only
+   forwards to the C functions: chips, features and subfeatures are views
+   of the library's own structures, valid until sensors_cleanup(), and
+   iterating over them never copies nor allocates. Functions returning an
+   int return 0 or a negative SENSORS_ERR_* value, as the C functions do;
+   the others throw sensors::error. */
+
+#include <cstddef>
+#include <cstdio>
+#include <cstdlib>
+#include <iterator>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <utility>
+
+#include "sensors.h"
+#include "error.h"
+
+namespace sensors {
+
+class error : public std::runtime_error {
+public:
+	/* code is a SENSORS_ERR_* value, negative or not */
+	explicit error(int code)
+		: std::runtime_error(sensors_strerror(code)),
+		  code_(code < 0 ? -code : code) {}
+
+	/* The positive SENSORS_ERR_* value */
+	int code() const noexcept { return code_; }
+
+private:
+	int code_;
+};
+
+/* Units of the subfeature values, as returned by the library (not the
+   raw sysfs values) */
+enum class unit {
+	none,
+	volt,
+	rpm,
+	celsius,
+	watt,
+	joule,
+	ampere,
+	second,
+};
+
+constexpr unit unit_of(sensors_subfeature_type type) noexcept
+{
+	switch (type) {
+	case SENSORS_SUBFEATURE_POWER_AVERAGE_INTERVAL:
+		return unit::second;
+	case SENSORS_SUBFEATURE_TEMP_OFFSET:
+		return unit::celsius;
+	case SENSORS_SUBFEATURE_VID:
+		return unit::volt;
+	case SENSORS_SUBFEATURE_FAN_DIV:
+	case SENSORS_SUBFEATURE_TEMP_TYPE:
+	case SENSORS_SUBFEATURE_UNKNOWN:
+		return unit::none;
+	default:
+		break;
+	}
+
+	/* Alarms, faults and beeps have bit 7 set */
+	if (type & 0x80)
+		return unit::none;
+
+	switch (type >> 8) {
+	case SENSORS_FEATURE_IN:
+		return unit::volt;
+	case SENSORS_FEATURE_FAN:
+		return unit::rpm;
+	case SENSORS_FEATURE_TEMP:
+		return unit::celsius;
+	case SENSORS_FEATURE_POWER:
+		return unit::watt;
+	case SENSORS_FEATURE_ENERGY:
+		return unit::joule;
+	case SENSORS_FEATURE_CURR:
+		return unit::ampere;
+	default:
+		return unit::none;
+	}
+}
+
+constexpr std::string_view unit_symbol(unit u) noexcept
+{
+	switch (u) {
+	case unit::volt:
+		return "V";
+	case unit::rpm:
+		return "RPM";
+	case unit::celsius:
+		return "C";
+	case unit::watt:
+		return "W";
+	case unit::joule:
+		return "J";
+	case unit::ampere:
+		return "A";
+	case unit::second:
+		return "s";
+	default:
+		return "";
+	}
+}
+
+/* Multiplier between the values of a subfeature type and the raw values
+   of its sysfs attribute, which the library divides by */
+constexpr int scale_of(sensors_subfeature_type type) noexcept
+{
+	switch (type & 0xFF80) {
+	case SENSORS_SUBFEATURE_IN_INPUT:
+	case SENSORS_SUBFEATURE_TEMP_INPUT:
+	case SENSORS_SUBFEATURE_CURR_INPUT:
+		return 1000;
+	case SENSORS_SUBFEATURE_FAN_INPUT:
+		return 1;
+	case SENSORS_SUBFEATURE_POWER_AVERAGE:
+	case SENSORS_SUBFEATURE_ENERGY_INPUT:
+		return 1000000;
+	default:
+		break;
+	}
+
+	switch (type) {
+	case SENSORS_SUBFEATURE_POWER_AVERAGE_INTERVAL:
+	case SENSORS_SUBFEATURE_VID:
+	case SENSORS_SUBFEATURE_TEMP_OFFSET:
+		return 1000;
+	default:
+		return 1;
+	}
+}
+
+namespace detail {
+
+/* Range over one of the C functions which take an int *nr cursor. Next
+   holds the arguments of the function, calls it, and makes the views of
+   the elements it returns. */
+template <typename Next>
+class cursor_range {
+public:
+	using element = typename Next::element;
+	using view = typename Next::view;
+
+	class iterator {
+	public:
+		using iterator_category = std::input_iterator_tag;
+		using value_type = view;
+		using difference_type = std::ptrdiff_t;
+		using pointer = void;
+		using reference = view;
+
+		iterator() noexcept = default;
+		explicit iterator(const Next &next) noexcept
+			: next_(next) { cur_ = next_(&nr_); }
+
+		view operator*() const noexcept { return next_.make(cur_); }
+		iterator &operator++() noexcept
+		{
+			cur_ = next_(&nr_);
+			return *this;
+		}
+		iterator operator++(int) noexcept
+		{
+			iterator old = *this;
+			++*this;
+			return old;
+		}
+		bool operator==(const iterator &other) const noexcept
+		{
+			return cur_ == other.cur_;
+		}
+		bool operator!=(const iterator &other) const noexcept
+		{
+			return cur_ != other.cur_;
+		}
+
+	private:
+		Next next_{};
+		int nr_ = 0;
+		const element *cur_ = nullptr;
+	};
+
+	explicit cursor_range(const Next &next) noexcept : next_(next) {}
+
+	iterator begin() const noexcept { return iterator(next_); }
+	iterator end() const noexcept { return iterator(); }
+
+private:
+	Next next_;
+};
+
+struct next_chip;
+struct next_feature;
+struct next_subfeature;
+
+} /* namespace detail */
+
+class subfeature;
+class feature;
+class chip;
+
+using chip_range = detail::cursor_range<detail::next_chip>;
+using feature_range = detail::cursor_range<detail::next_feature>;
+using subfeature_range = detail::cursor_range<detail::next_subfeature>;
+
+/* Subfeature handle, see sensors_handle_open(). Reads and writes are
+   direct calls to the C functions. Handles are owned, and closed when
+   destroyed. */
+class handle {
+public:
+	handle() noexcept = default;
+	inline explicit handle(const subfeature &s);
+	~handle()
+	{
+		if (h_)
+			sensors_handle_close(h_);
+	}
+
+	handle(const handle &) = delete;
+	handle &operator=(const handle &) = delete;
+	handle(handle &&other) noexcept
+		: h_(std::exchange(other.h_, nullptr)) {}
+	handle &operator=(handle &&other) noexcept
+	{
+		std::swap(h_, other.h_);
+		return *this;
+	}
+
+	int read(double &value) const noexcept
+	{
+		return sensors_handle_read(h_, &value);
+	}
+	double read() const
+	{
+		double value;
+		int err;
+
+		if ((err = sensors_handle_read(h_, &value)))
+			throw error(err);
+		return value;
+	}
+	int write(double value) const noexcept
+	{
+		return sensors_handle_write(h_, value);
+	}
+
+	sensors_subfeature_handle *get() const noexcept { return h_; }
+	explicit operator bool() const noexcept { return h_ != nullptr; }
+
+private:
+	sensors_subfeature_handle *h_ = nullptr;
+};
+
+/* Handle to a subfeature of a type known at compile time. Opening it on
+   a subfeature of another type throws. */
+template <sensors_subfeature_type Type>
+class typed_handle : public handle {
+public:
+	static constexpr sensors_subfeature_type type = Type;
+	static constexpr sensors::unit unit = unit_of(Type);
+
+	typed_handle() noexcept = default;
+	explicit typed_handle(const subfeature &s) : handle(check(s)) {}
+
+private:
+	static inline const subfeature &check(const subfeature &s);
+};
+
+using voltage = typed_handle<SENSORS_SUBFEATURE_IN_INPUT>;
+using fan_speed = typed_handle<SENSORS_SUBFEATURE_FAN_INPUT>;
+using temperature = typed_handle<SENSORS_SUBFEATURE_TEMP_INPUT>;
+using power = typed_handle<SENSORS_SUBFEATURE_POWER_INPUT>;
+using energy = typed_handle<SENSORS_SUBFEATURE_ENERGY_INPUT>;
+using current = typed_handle<SENSORS_SUBFEATURE_CURR_INPUT>;
+
+class subfeature {
+public:
+	subfeature(const sensors_chip_name *chip,
+		   const sensors_subfeature *s) noexcept
+		: chip_(chip), s_(s) {}
+
+	std::string_view name() const noexcept { return s_->name; }
+	int number() const noexcept { return s_->number; }
+	sensors_subfeature_type type() const noexcept { return s_->type; }
+	sensors::unit unit() const noexcept { return unit_of(s_->type); }
+	bool readable() const noexcept { return s_->flags & SENSORS_MODE_R; }
+	bool writable() const noexcept { return s_->flags & SENSORS_MODE_W; }
+	bool static_value() const noexcept { return s_->flags & SENSORS_STATIC_VALUE; }
+
+	int read(double &value) const noexcept
+	{
+		return sensors_get_value(chip_, s_->number, &value);
+	}
+	double read() const
+	{
+		double value;
+		int err;
+
+		if ((err = sensors_get_value(chip_, s_->number, &value)))
+			throw error(err);
+		return value;
+	}
+	int write(double value) const noexcept
+	{
+		return sensors_set_value(chip_, s_->number, value);
+	}
+
+	const sensors_chip_name *chip() const noexcept { return chip_; }
+	const sensors_subfeature *get() const noexcept { return s_; }
+
+private:
+	const sensors_chip_name *chip_;
+	const sensors_subfeature *s_;
+};
+
+class feature {
+public:
+	feature(const sensors_chip_name *chip, const sensors_feature *f) noexcept
+		: chip_(chip), f_(f) {}
+
+	std::string_view name() const noexcept { return f_->name; }
+	int number() const noexcept { return f_->number; }
+	sensors_feature_type type() const noexcept { return f_->type; }
+
+	/* The label from the configuration file, or the name */
+	std::string label() const
+	{
+		std::unique_ptr<char, void (*)(void *)>
+			label(sensors_get_label(chip_, f_), std::free);
+
+		if (!label)
+			throw error(SENSORS_ERR_NO_ENTRY);
+		return label.get();
+	}
+
+	inline subfeature_range subfeatures() const noexcept;
+
+	/* Returns false if the feature has no subfeature of that type */
+	bool has(sensors_subfeature_type type) const noexcept
+	{
+		return sensors_get_subfeature(chip_, f_, type) != nullptr;
+	}
+	subfeature at(sensors_subfeature_type type) const
+	{
+		const sensors_subfeature *s;
+
+		if (!(s = sensors_get_subfeature(chip_, f_, type)))
+			throw error(SENSORS_ERR_NO_ENTRY);
+		return subfeature(chip_, s);
+	}
+
+	/* Open a typed handle to the subfeature of type Type */
+	template <sensors_subfeature_type Type>
+	typed_handle<Type> open() const
+	{
+		return typed_handle<Type>(at(Type));
+	}
+
+	const sensors_chip_name *chip() const noexcept { return chip_; }
+	const sensors_feature *get() const noexcept { return f_; }
+
+private:
+	const sensors_chip_name *chip_;
+	const sensors_feature *f_;
+};
+
+class chip {
+public:
+	explicit chip(const sensors_chip_name *name) noexcept : name_(name) {}
+
+	std::string_view prefix() const noexcept { return name_->prefix; }
+	std::string_view path() const noexcept
+	{
+		return name_->path ? name_->path : "";
+	}
+	const sensors_bus_id &bus() const noexcept { return name_->bus; }
+	int addr() const noexcept { return name_->addr; }
+
+	/* The full name, as printed by sensors_snprintf_chip_name() */
+	std::string name() const
+	{
+		char buf[256];
+		int len;
+
+		len = sensors_snprintf_chip_name(buf, sizeof(buf), name_);
+		if (len < 0)
+			throw error(len);
+		return buf;
+	}
+
+	/* The adapter name of the bus, empty if unknown */
+	std::string_view adapter() const noexcept
+	{
+		const char *adapter = sensors_get_adapter_name(&name_->bus);
+
+		return adapter ? adapter : "";
+	}
+
+	inline feature_range features() const noexcept;
+
+	const sensors_chip_name *get() const noexcept { return name_; }
+
+private:
+	const sensors_chip_name *name_;
+};
+
+namespace detail {
+
+struct next_chip {
+	using element = sensors_chip_name;
+	using view = chip;
+
+	const sensors_chip_name *match;
+
+	const element *operator()(int *nr) const noexcept
+	{
+		return sensors_get_detected_chips(match, nr);
+	}
+	view make(const element *e) const noexcept { return chip(e); }
+};
+
+struct next_feature {
+	using element = sensors_feature;
+	using view = feature;
+
+	const sensors_chip_name *name;
+
+	const element *operator()(int *nr) const noexcept
+	{
+		return sensors_get_features(name, nr);
+	}
+	view make(const element *e) const noexcept { return feature(name, e); }
+};
+
+struct next_subfeature {
+	using element = sensors_subfeature;
+	using view = subfeature;
+
+	const sensors_chip_name *name;
+	const sensors_feature *feature;
+
+	const element *operator()(int *nr) const noexcept
+	{
+		return sensors_get_all_subfeatures(name, feature, nr);
+	}
+	view make(const element *e) const noexcept
+	{
+		return subfeature(name, e);
+	}
+};
+
+} /* namespace detail */
+
+/* All detected chips, or those matching match */
+inline chip_range chips(const sensors_chip_name *match = nullptr) noexcept
+{
+	return chip_range(detail::next_chip{ match });
+}
+
+inline feature_range chip::features() const noexcept
+{
+	return feature_range(detail::next_feature{ name_ });
+}
+
+inline subfeature_range feature::subfeatures() const noexcept
+{
+	return subfeature_range(detail::next_subfeature{ chip_, f_ });
+}
+
+inline handle::handle(const subfeature &s)
+{
+	int err;
+
+	if ((err = sensors_handle_open(s.chip(), s.number(), &h_)))
+		throw error(err);
+}
+
+template <sensors_subfeature_type Type>
+inline const subfeature &typed_handle<Type>::check(const subfeature &s)
+{
+	if (s.type() != Type)
+		throw error(SENSORS_ERR_NO_ENTRY);
+	return s;
+}
+
+/* sensors_init() on construction, sensors_cleanup() on destruction.
+   There must be only one at a time. */
+class library {
+public:
+	explicit library(std::FILE *input = nullptr)
+	{
+		int err;
+
+		if ((err = sensors_init(input)))
+			throw error(err);
+	}
+	~library() { sensors_cleanup(); }
+
+	library(const library &) = delete;
+	library &operator=(const library &) = delete;
+
+	chip_range chips(const sensors_chip_name *match = nullptr) const noexcept
+	{
+		return sensors::chips(match);
+	}
+};
+
+} /* namespace sensors */
+
+#endif /* def LIB_SENSORS_SENSORS_HPP */
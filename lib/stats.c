@@ -0,0 +1,227 @@
+/*
+    stats.c - Part of libsensors, a Linux library for reading sensor data.
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+    MA 02110-1301 USA.
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include "sensors.h"
+#include "data.h"
+#include "error.h"
+#include "alloc.h"
+#include "general.h"
+#include "stats.h"
+#include "breaker.h"
+
+/* Each thread accumulates its counters in a block of its own, so that
+   the hot paths need neither locks nor atomic read-modify-write
+   operations. Counters are only written by the owning thread, with
+   relaxed atomic stores so that sensors_get_stats() can sum them at any
+   time. Slot 0 of a block holds the operations which are not tied to a
+   chip, chip i is in slot i + 1.
+
+   Blocks are chained in a global list, and are only freed by
+   sensors_stats_cleanup(), so the counters of threads which exited are
+   still accounted for. The lock protects the list and the growth of
+   the blocks, the hot path only takes it when a thread sees a chip
+   number its block has no room for yet. */
+
+struct stats_slot {
+	sensors_op_stats op[SENSORS_STATS_OPS];
+};
+
+struct stats_block {
+	struct stats_block *next;
+	int size;		/* Number of slots */
+	struct stats_slot *slots;
+};
+
+static struct stats_block *stats_blocks;
+static pthread_mutex_t stats_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* Bumped by sensors_stats_cleanup(), so that threads notice that their
+   block is gone */
+static unsigned int stats_generation = 1;
+
+static __thread struct stats_block *thread_block;
+static __thread unsigned int thread_generation;
+
+unsigned long long sensors_stats_begin(void)
+{
+	return sensors_monotonic_ns();
+}
+
+/* Called with stats_lock held */
+static void stats_grow_block(struct stats_block *block, int size)
+{
+	block->slots = sensors_realloc(block->slots,
+				       size * sizeof(struct stats_slot));
+	if (!block->slots)
+		sensors_fatal_error(__func__, "Out of memory");
+	memset(block->slots + block->size, 0,
+	       (size - block->size) * sizeof(struct stats_slot));
+	block->size = size;
+}
+
+static struct stats_slot *stats_get_slot(int chip)
+{
+	struct stats_block *block = thread_block;
+	unsigned int generation;
+	int size;
+
+	generation = __atomic_load_n(&stats_generation, __ATOMIC_RELAXED);
+	if (block && thread_generation == generation && chip < block->size)
+		return &block->slots[chip];
+
+	pthread_mutex_lock(&stats_lock);
+	if (!block || thread_generation != stats_generation) {
+		block = sensors_calloc(1, sizeof(struct stats_block));
+		if (!block)
+			sensors_fatal_error(__func__, "Out of memory");
+		block->next = stats_blocks;
+		stats_blocks = block;
+		thread_block = block;
+		thread_generation = stats_generation;
+	}
+	if (chip >= block->size) {
+		size = sensors_proc_chips_count + 1;
+		if (size <= chip)
+			size = chip + 1;
+		stats_grow_block(block, size);
+	}
+	pthread_mutex_unlock(&stats_lock);
+
+	return &block->slots[chip];
+}
+
+static void stats_add(unsigned long long *counter, unsigned long long val)
+{
+	__atomic_store_n(counter, *counter + val, __ATOMIC_RELAXED);
+}
+
+void sensors_stats_end(int chip, int op, unsigned long long start, int err)
+{
+	sensors_stats_add(chip, op, sensors_stats_begin() - start, err);
+}
+
+void sensors_stats_add(int chip, int op, unsigned long long ns, int err)
+{
+	sensors_op_stats *stats;
+	int bucket;
+
+	stats = &stats_get_slot(chip + 1)->op[op];
+
+	stats_add(&stats->count, 1);
+	if (err) {
+		err = -err;
+		if (err <= 0 || err >= SENSORS_STATS_ERRORS)
+			err = 0;
+		stats_add(&stats->errors[err], 1);
+	}
+	stats_add(&stats->total_ns, ns);
+	if (ns > stats->max_ns)
+		__atomic_store_n(&stats->max_ns, ns, __ATOMIC_RELAXED);
+
+	bucket = 63 - __builtin_clzll(ns | 1);
+	if (bucket >= SENSORS_STATS_BUCKETS)
+		bucket = SENSORS_STATS_BUCKETS - 1;
+	stats_add(&stats->histogram[bucket], 1);
+}
+
+static void stats_sum_op(sensors_op_stats *sum, const sensors_op_stats *op)
+{
+	unsigned long long val;
+	int i;
+
+	sum->count += __atomic_load_n(&op->count, __ATOMIC_RELAXED);
+	for (i = 0; i < SENSORS_STATS_ERRORS; i++)
+		sum->errors[i] += __atomic_load_n(&op->errors[i],
+						  __ATOMIC_RELAXED);
+	sum->total_ns += __atomic_load_n(&op->total_ns, __ATOMIC_RELAXED);
+	val = __atomic_load_n(&op->max_ns, __ATOMIC_RELAXED);
+	if (val > sum->max_ns)
+		sum->max_ns = val;
+	for (i = 0; i < SENSORS_STATS_BUCKETS; i++)
+		sum->histogram[i] += __atomic_load_n(&op->histogram[i],
+						     __ATOMIC_RELAXED);
+}
+
+/* Called with stats_lock held */
+static void stats_sum_slot(sensors_stats *sum, int slot)
+{
+	const struct stats_block *block;
+	int op;
+
+	for (block = stats_blocks; block; block = block->next) {
+		if (slot >= block->size)
+			continue;
+		for (op = 0; op < SENSORS_STATS_OPS; op++)
+			stats_sum_op(&sum->op[op], &block->slots[slot].op[op]);
+	}
+}
+
+int sensors_get_stats(const sensors_chip_name *name, sensors_stats *stats)
+{
+	const sensors_chip_name *chip;
+	int nr = 0, found = 0;
+
+	memset(stats, 0, sizeof(sensors_stats));
+
+	pthread_mutex_lock(&stats_lock);
+	if (!name)
+		stats_sum_slot(stats, 0);
+	while ((chip = sensors_get_detected_chips(name, &nr))) {
+		/* nr is the index of the chip, plus one */
+		stats_sum_slot(stats, nr);
+		sensors_breaker_add_stats(nr - 1, &stats->breaker);
+		found = 1;
+	}
+	pthread_mutex_unlock(&stats_lock);
+
+	if (name && !found)
+		return -SENSORS_ERR_NO_ENTRY;
+	return 0;
+}
+
+void sensors_reset_stats(void)
+{
+	struct stats_block *block;
+	int i;
+
+	pthread_mutex_lock(&stats_lock);
+	for (block = stats_blocks; block; block = block->next)
+		for (i = 0; i < block->size; i++)
+			memset(&block->slots[i], 0, sizeof(struct stats_slot));
+	pthread_mutex_unlock(&stats_lock);
+	sensors_breaker_reset_stats();
+}
+
+void sensors_stats_cleanup(void)
+{
+	struct stats_block *block;
+
+	pthread_mutex_lock(&stats_lock);
+	while ((block = stats_blocks)) {
+		stats_blocks = block->next;
+		sensors_free(block->slots);
+		sensors_free(block);
+	}
+	__atomic_store_n(&stats_generation, stats_generation + 1,
+			 __ATOMIC_RELAXED);
+	pthread_mutex_unlock(&stats_lock);
+}
@@ -0,0 +1,38 @@
+/*
+    stats.h - Part of libsensors, a Linux library for reading sensor data.
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+    MA 02110-1301 USA.
+*/
+
+#ifndef LIB_SENSORS_STATS_H
+#define LIB_SENSORS_STATS_H
+
+/* Return the current time, to be passed to sensors_stats_end() */
+unsigned long long sensors_stats_begin(void);
+
+/* Account for one operation on chip number chip (an index into
+   sensors_proc_chips, or -1 if no chip applies) which started at time
+   start and returned err (0 or a negative error value). */
+void sensors_stats_end(int chip, int op, unsigned long long start, int err);
+
+/* Same as above, for an operation which took ns nanoseconds */
+void sensors_stats_add(int chip, int op, unsigned long long ns, int err);
+
+/* Free all counters. Must be called when the chip list goes away, as
+   chip numbers change. */
+void sensors_stats_cleanup(void);
+
+#endif /* def LIB_SENSORS_STATS_H */
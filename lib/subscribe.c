@@ -0,0 +1,288 @@
+/*
+    subscribe.c - Part of libsensors, a Linux library for reading sensor data.
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+    MA 02110-1301 USA.
+*/
+
+#include <stdlib.h>
+#include <limits.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/eventfd.h>
+#include "sensors.h"
+#include "data.h"
+#include "error.h"
+#include "alloc.h"
+#include "access.h"
+#include "sampler.h"
+#include "subscribe.h"
+
+/* Subscriptions are evaluated by the sampler thread, each time it takes
+   a new sample of a subfeature, so all the subscribers of a subfeature
+   share its reads, and subfeatures nobody subscribed to cost nothing.
+   Each sampler ring points to the list of its subscribers; all
+   subscribers are also chained in a global list, in id order, which
+   sensors_event_dispatch() scans.
+
+   Only the state changes are reported. If the state of a subscription
+   changes again before the event was dispatched, the events are merged,
+   so the sampler thread never allocates nor blocks on the application,
+   and the application always ends up with the current state. */
+
+struct sensors_subscriber {
+	struct sensors_subscriber *next;	/* Same subfeature */
+	struct sensors_subscriber *next_all;
+	int id;
+	const sensors_chip_features *chip;
+	int subfeat_nr;
+	sensors_subscription sub;
+	sensors_event_callback callback;
+	void *data;
+
+	/* Evaluation state, protected by subs_lock */
+	int active;
+	int reported;			/* State of the last event dispatched */
+	int pending;			/* State changed since then */
+	int changing;			/* active is about to change */
+	unsigned long long since;	/* Time at which it started changing */
+	double value;			/* Sample which triggered the change */
+	unsigned long long timestamp;
+};
+
+static struct sensors_subscriber *subs_head, *subs_tail;
+static int next_id = 1;
+static int event_fd = -1;
+static pthread_mutex_t subs_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* Called with subs_lock held */
+static int event_setup(void)
+{
+	if (event_fd < 0)
+		event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	return event_fd < 0 ? -SENSORS_ERR_KERNEL : event_fd;
+}
+
+/* Called with subs_lock held */
+static void subscriber_eval(struct sensors_subscriber *s, double value,
+			    unsigned long long timestamp)
+{
+	const sensors_subscription *sub = &s->sub;
+	uint64_t one = 1;
+	int want;
+
+	/* Become active past the level, and inactive only once the value
+	   went back past the level by at least the hysteresis */
+	if (sub->type == SENSORS_SUBSCRIBE_ABOVE)
+		want = s->active ? value >= sub->level - sub->hysteresis
+				 : value > sub->level;
+	else
+		want = s->active ? value <= sub->level + sub->hysteresis
+				 : value < sub->level;
+
+	if (want == s->active) {
+		s->changing = 0;
+		return;
+	}
+	if (!s->changing) {
+		s->changing = 1;
+		s->since = timestamp;
+	}
+	if (timestamp - s->since < (unsigned long long)sub->dwell * 1000000ULL)
+		return;
+
+	s->changing = 0;
+	s->active = want;
+	s->value = value;
+	s->timestamp = timestamp;
+	if (s->pending) {
+		/* Changed back before anybody noticed */
+		s->pending = s->active != s->reported;
+	} else {
+		s->pending = 1;
+		if (write(event_fd, &one, sizeof(one)) < 0) {
+			/* Counter overflow, it is readable anyway */
+		}
+	}
+}
+
+void sensors_subscribers_check(struct sensors_subscriber **list, double value,
+			       unsigned long long timestamp)
+{
+	struct sensors_subscriber *s;
+
+	pthread_mutex_lock(&subs_lock);
+	for (s = *list; s; s = s->next)
+		subscriber_eval(s, value, timestamp);
+	pthread_mutex_unlock(&subs_lock);
+}
+
+int sensors_subscribe(const sensors_chip_name *name, int subfeat_nr,
+		      const sensors_subscription *sub,
+		      sensors_event_callback callback, void *data)
+{
+	const sensors_chip_features *chip;
+	struct sensors_subscriber *s, **list;
+	int res;
+
+	if (!callback || (sub->type != SENSORS_SUBSCRIBE_ABOVE &&
+			  sub->type != SENSORS_SUBSCRIBE_BELOW))
+		return -SENSORS_ERR_NO_ENTRY;
+
+	/* Subscribers share the samples of the sampler */
+	if ((res = sensors_sampler_add(name, subfeat_nr)) &&
+	    res != -SENSORS_ERR_BUSY)
+		return res;
+	chip = sensors_lookup_chip(name);
+	list = sensors_sampler_subscribers(chip, subfeat_nr);
+	if (!list)
+		return res;	/* Sampler running and not sampled */
+
+	s = sensors_calloc(1, sizeof(struct sensors_subscriber));
+	if (!s)
+		sensors_fatal_error(__func__, "Out of memory");
+	s->chip = chip;
+	s->subfeat_nr = subfeat_nr;
+	s->sub = *sub;
+	s->callback = callback;
+	s->data = data;
+
+	pthread_mutex_lock(&subs_lock);
+	if ((res = event_setup()) < 0) {
+		pthread_mutex_unlock(&subs_lock);
+		sensors_free(s);
+		return res;
+	}
+	s->id = res = next_id;
+	next_id = next_id == INT_MAX ? 1 : next_id + 1;
+
+	if (subs_tail)
+		subs_tail->next_all = s;
+	else
+		subs_head = s;
+	subs_tail = s;
+	s->next = *list;
+	__atomic_store_n(list, s, __ATOMIC_RELAXED);
+	pthread_mutex_unlock(&subs_lock);
+
+	return res;
+}
+
+int sensors_unsubscribe(int id)
+{
+	struct sensors_subscriber *s, *prev = NULL, **p;
+
+	pthread_mutex_lock(&subs_lock);
+	for (s = subs_head; s && s->id != id; prev = s, s = s->next_all)
+		;
+	if (!s) {
+		pthread_mutex_unlock(&subs_lock);
+		return -SENSORS_ERR_NO_ENTRY;
+	}
+
+	if (prev)
+		prev->next_all = s->next_all;
+	else
+		subs_head = s->next_all;
+	if (subs_tail == s)
+		subs_tail = prev;
+
+	p = sensors_sampler_subscribers(s->chip, s->subfeat_nr);
+	while (*p != s)
+		p = &(*p)->next;
+	__atomic_store_n(p, s->next, __ATOMIC_RELAXED);
+	pthread_mutex_unlock(&subs_lock);
+
+	sensors_free(s);
+	return 0;
+}
+
+int sensors_event_fd(void)
+{
+	int res;
+
+	pthread_mutex_lock(&subs_lock);
+	res = event_setup();
+	pthread_mutex_unlock(&subs_lock);
+
+	return res;
+}
+
+int sensors_event_dispatch(void)
+{
+	struct sensors_subscriber *s;
+	sensors_event_callback callback;
+	sensors_event event;
+	uint64_t events;
+	void *data;
+	int last = 0, n = 0;
+
+	pthread_mutex_lock(&subs_lock);
+	if (event_fd >= 0 && read(event_fd, &events, sizeof(events)) < 0) {
+		/* Nothing signaled, there may still be events left over
+		   from a previous call */
+	}
+
+	/* Callbacks may subscribe or unsubscribe, so don't hold the lock
+	   while calling them, and look for the next pending event each
+	   time */
+	for (;;) {
+		for (s = subs_head; s && (s->id <= last || !s->pending);
+		     s = s->next_all)
+			;
+		if (!s)
+			break;
+
+		s->pending = 0;
+		s->reported = s->active;
+		last = s->id;
+
+		event.name = &s->chip->chip;
+		event.subfeat_nr = s->subfeat_nr;
+		event.id = s->id;
+		event.active = s->active;
+		event.value = s->value;
+		event.timestamp = s->timestamp;
+		callback = s->callback;
+		data = s->data;
+		pthread_mutex_unlock(&subs_lock);
+
+		callback(&event, data);
+		n++;
+
+		pthread_mutex_lock(&subs_lock);
+	}
+	pthread_mutex_unlock(&subs_lock);
+
+	return n;
+}
+
+void sensors_subscriptions_cleanup(void)
+{
+	struct sensors_subscriber *s;
+
+	/* The sampler thread is stopped already */
+	while ((s = subs_head)) {
+		subs_head = s->next_all;
+		sensors_free(s);
+	}
+	subs_tail = NULL;
+
+	if (event_fd >= 0) {
+		close(event_fd);
+		event_fd = -1;
+	}
+}
@@ -0,0 +1,34 @@
+/*
+    subscribe.h - Part of libsensors, a Linux library for reading sensor data.
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+    MA 02110-1301 USA.
+*/
+
+#ifndef LIB_SENSORS_SUBSCRIBE_H
+#define LIB_SENSORS_SUBSCRIBE_H
+
+struct sensors_subscriber;
+
+/* Called by the sampler thread with each new sample of a subfeature
+   which has subscribers */
+void sensors_subscribers_check(struct sensors_subscriber **list, double value,
+			       unsigned long long timestamp);
+
+/* Free all subscriptions and close the event file descriptor. The
+   sampler thread must be stopped. */
+void sensors_subscriptions_cleanup(void);
+
+#endif /* def LIB_SENSORS_SUBSCRIBE_H */
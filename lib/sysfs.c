@@ -19,28 +19,38 @@
     MA 02110-1301 USA.
 */
 
-/* this define needed for strndup() */
-#define _GNU_SOURCE
-
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <fcntl.h>
 #include <unistd.h>
 #include <string.h>
 #include <stdlib.h>
 #include <limits.h>
 #include <errno.h>
 #include <dirent.h>
+#include <pthread.h>
 #include "data.h"
 #include "error.h"
+#include "alloc.h"
 #include "access.h"
 #include "general.h"
 #include "sysfs.h"
+#include "stats.h"
+#include "breaker.h"
+#include "trace.h"
+#include "profile.h"
+#include "probes.h"
+#include "uring.h"
 
 
 /****************************************************************************/
 
 #define ATTR_MAX	128
 
+/* Estimated system calls to list a directory: open, getdents until it
+   returns nothing, close; a large directory takes more getdents */
+#define EST_SYSCALLS_SCANDIR	4
+
 /*
  * Read an attribute from sysfs
  * Returns a pointer to a freshly allocated string; free it yourself.
@@ -54,15 +64,18 @@ static char *sysfs_read_attr(const char *device, const char *attr)
 
 	snprintf(path, NAME_MAX, "%s/%s", device, attr);
 
-	if (!(f = fopen(path, "r")))
+	if (!(f = fopen(path, "r"))) {
+		sensors_profile_est_syscalls(1);
 		return NULL;
+	}
 	p = fgets(buf, ATTR_MAX, f);
 	fclose(f);
+	sensors_profile_est_syscalls(4);	/* open, fstat, read, close */
 	if (!p)
 		return NULL;
 
 	/* Last byte is a '\n'; chop that off */
-	p = strndup(buf, strlen(buf) - 1);
+	p = sensors_strndup(buf, strlen(buf) - 1);
 	if (!p)
 		sensors_fatal_error(__func__, "Out of memory");
 	return p;
@@ -83,8 +96,10 @@ static int sysfs_foreach_classdev(const char *class_name,
 
 	path_off = snprintf(path, NAME_MAX, "%s/class/%s",
 			    sensors_sysfs_mount, class_name);
-	if (!(dir = opendir(path)))
+	if (!(dir = opendir(path))) {
+		sensors_profile_est_syscalls(1);
 		return errno;
+	}
 
 	ret = 0;
 	while (!ret && (ent = readdir(dir))) {
@@ -97,6 +112,7 @@ static int sysfs_foreach_classdev(const char *class_name,
 	}
 
 	closedir(dir);
+	sensors_profile_est_syscalls(EST_SYSCALLS_SCANDIR);
 	return ret;
 }
 
@@ -115,8 +131,10 @@ static int sysfs_foreach_busdev(const char *bus_type,
 
 	path_off = snprintf(path, NAME_MAX, "%s/bus/%s/devices",
 			    sensors_sysfs_mount, bus_type);
-	if (!(dir = opendir(path)))
+	if (!(dir = opendir(path))) {
+		sensors_profile_est_syscalls(1);
 		return errno;
+	}
 
 	ret = 0;
 	while (!ret && (ent = readdir(dir))) {
@@ -129,6 +147,7 @@ static int sysfs_foreach_busdev(const char *bus_type,
 	}
 
 	closedir(dir);
+	sensors_profile_est_syscalls(EST_SYSCALLS_SCANDIR);
 	return ret;
 }
 
@@ -174,11 +193,10 @@ int get_type_scaling(sensors_subfeature_type type)
 	}
 }
 
+/* Returns the interned name of the feature a subfeature belongs to */
 static
 char *get_feature_name(sensors_feature_type ftype, char *sfname)
 {
-	char *name, *underscore;
-
 	switch (ftype) {
 	case SENSORS_FEATURE_IN:
 	case SENSORS_FEATURE_FAN:
@@ -186,19 +204,11 @@ char *get_feature_name(sensors_feature_type ftype, char *sfname)
 	case SENSORS_FEATURE_POWER:
 	case SENSORS_FEATURE_ENERGY:
 	case SENSORS_FEATURE_CURR:
-		underscore = strchr(sfname, '_');
-		name = strndup(sfname, underscore - sfname);
-		if (!name)
-			sensors_fatal_error(__func__, "Out of memory");
-
-		break;
+		return sensors_intern_string(sfname,
+					     strchr(sfname, '_') - sfname);
 	default:
-		name = strdup(sfname);
-		if (!name)
-			sensors_fatal_error(__func__, "Out of memory");
+		return sfname;
 	}
-
-	return name;
 }
 
 /* Static mappings for use by sensors_subfeature_get_type() */
@@ -329,6 +339,7 @@ static int sensors_get_attr_mode(const char *device, const char *attr)
 	int mode = 0;
 
 	snprintf(path, NAME_MAX, "%s/%s", device, attr);
+	sensors_profile_est_syscalls(1);
 	if (!stat(path, &st)) {
 		if (st.st_mode & S_IRUSR)
 			mode |= SENSORS_MODE_R;
@@ -338,106 +349,92 @@ static int sensors_get_attr_mode(const char *device, const char *attr)
 	return mode;
 }
 
-static int sensors_read_dynamic_chip(sensors_chip_features *chip,
-				     const char *dev_path)
+/* Limits and settings, which only change when written */
+static int sensors_subfeature_is_static(sensors_subfeature_type type)
 {
-	int i, fnum = 0, sfnum = 0, prev_slot;
-	DIR *dir;
-	struct dirent *ent;
-	sensors_subfeature *all_subfeatures;
-	sensors_subfeature *dyn_subfeatures;
-	sensors_feature *dyn_features;
-	sensors_feature_type ftype;
-	sensors_subfeature_type sftype;
-
-	if (!(dir = opendir(dev_path)))
-		return -errno;
-
-	/* We use a large sparse table at first to store all found
-	   subfeatures, so that we can store them sorted at type and index
-	   and then later create a dense sorted table. */
-	all_subfeatures = calloc(ALL_POSSIBLE_SUBFEATURES,
-				 sizeof(sensors_subfeature));
-	if (!all_subfeatures)
-		sensors_fatal_error(__func__, "Out of memory");
-
-	while ((ent = readdir(dir))) {
-		char *name;
-		int nr;
-
-		/* Skip directories and symlinks */
-		if (ent->d_type != DT_REG)
-			continue;
-
-		name = ent->d_name;
-
-		sftype = sensors_subfeature_get_type(name, &nr);
-		if (sftype == SENSORS_SUBFEATURE_UNKNOWN)
-			continue;
-
-		/* Adjust the channel number */
-		switch (sftype & 0xFF00) {
-		case SENSORS_SUBFEATURE_FAN_INPUT:
-		case SENSORS_SUBFEATURE_TEMP_INPUT:
-		case SENSORS_SUBFEATURE_POWER_AVERAGE:
-		case SENSORS_SUBFEATURE_ENERGY_INPUT:
-		case SENSORS_SUBFEATURE_CURR_INPUT:
-			nr--;
-			break;
-		}
-
-		if (nr < 0 || nr >= MAX_SENSORS_PER_TYPE) {
-			/* More sensors of one type than MAX_SENSORS_PER_TYPE,
-			   we have to ignore it */
-#ifdef DEBUG
-			sensors_fatal_error(__func__,
-					    "Increase MAX_SENSORS_PER_TYPE!");
-#endif
-			continue;
-		}
+	switch (type) {
+	case SENSORS_SUBFEATURE_IN_MIN:
+	case SENSORS_SUBFEATURE_IN_MAX:
+	case SENSORS_SUBFEATURE_IN_BEEP:
+	case SENSORS_SUBFEATURE_FAN_MIN:
+	case SENSORS_SUBFEATURE_FAN_DIV:
+	case SENSORS_SUBFEATURE_FAN_BEEP:
+	case SENSORS_SUBFEATURE_TEMP_MAX:
+	case SENSORS_SUBFEATURE_TEMP_MAX_HYST:
+	case SENSORS_SUBFEATURE_TEMP_MIN:
+	case SENSORS_SUBFEATURE_TEMP_CRIT:
+	case SENSORS_SUBFEATURE_TEMP_CRIT_HYST:
+	case SENSORS_SUBFEATURE_TEMP_TYPE:
+	case SENSORS_SUBFEATURE_TEMP_OFFSET:
+	case SENSORS_SUBFEATURE_TEMP_BEEP:
+	case SENSORS_SUBFEATURE_POWER_AVERAGE_INTERVAL:
+	case SENSORS_SUBFEATURE_CURR_MIN:
+	case SENSORS_SUBFEATURE_CURR_MAX:
+	case SENSORS_SUBFEATURE_CURR_BEEP:
+	case SENSORS_SUBFEATURE_BEEP_ENABLE:
+		return 1;
+	default:
+		return 0;
+	}
+}
 
-		/* "calculate" a place to store the subfeature in our sparse,
-		   sorted table */
-		switch (sftype) {
-		case SENSORS_SUBFEATURE_VID:
-			i = nr + MAX_SENSORS_PER_TYPE * MAX_SUBFEATURES *
-			    MAX_SENSOR_TYPES * 2;
-			break;
-		case SENSORS_SUBFEATURE_BEEP_ENABLE:
-			i = MAX_SENSORS_PER_TYPE * MAX_SUBFEATURES *
-			    MAX_SENSOR_TYPES * 2 + MAX_SENSORS_PER_TYPE;
-			break;
-		default:
-			i = (sftype >> 8) * MAX_SENSORS_PER_TYPE *
-			    MAX_SUBFEATURES * 2 + nr * MAX_SUBFEATURES * 2 +
-			    ((sftype & 0x80) >> 7) * MAX_SUBFEATURES +
-			    (sftype & 0x7F);
-		}
+/* Return the place of a subfeature in the sparse table of all possible
+   subfeatures, which is sorted by type and channel, or -1 if it has no
+   place there */
+static int sensors_subfeature_slot(sensors_subfeature_type sftype, int nr)
+{
+	/* Adjust the channel number */
+	switch (sftype & 0xFF00) {
+	case SENSORS_SUBFEATURE_FAN_INPUT:
+	case SENSORS_SUBFEATURE_TEMP_INPUT:
+	case SENSORS_SUBFEATURE_POWER_AVERAGE:
+	case SENSORS_SUBFEATURE_ENERGY_INPUT:
+	case SENSORS_SUBFEATURE_CURR_INPUT:
+		nr--;
+		break;
+	}
 
-		if (all_subfeatures[i].name) {
+	if (nr < 0 || nr >= MAX_SENSORS_PER_TYPE) {
+		/* More sensors of one type than MAX_SENSORS_PER_TYPE,
+		   we have to ignore it */
 #ifdef DEBUG
-			sensors_fatal_error(__func__, "Duplicate subfeature");
+		sensors_fatal_error(__func__,
+				    "Increase MAX_SENSORS_PER_TYPE!");
 #endif
-			continue;
-		}
-
-		/* fill in the subfeature members */
-		all_subfeatures[i].type = sftype;
-		all_subfeatures[i].name = strdup(name);
-		if (!all_subfeatures[i].name)
-			sensors_fatal_error(__func__, "Out of memory");
-
-		if (!(sftype & 0x80))
-			all_subfeatures[i].flags |= SENSORS_COMPUTE_MAPPING;
-		all_subfeatures[i].flags |= sensors_get_attr_mode(dev_path, name);
+		return -1;
+	}
 
-		sfnum++;
+	/* "calculate" a place to store the subfeature in our sparse,
+	   sorted table */
+	switch (sftype) {
+	case SENSORS_SUBFEATURE_VID:
+		return nr + MAX_SENSORS_PER_TYPE * MAX_SUBFEATURES *
+		       MAX_SENSOR_TYPES * 2;
+	case SENSORS_SUBFEATURE_BEEP_ENABLE:
+		return MAX_SENSORS_PER_TYPE * MAX_SUBFEATURES *
+		       MAX_SENSOR_TYPES * 2 + MAX_SENSORS_PER_TYPE;
+	default:
+		return (sftype >> 8) * MAX_SENSORS_PER_TYPE *
+		       MAX_SUBFEATURES * 2 + nr * MAX_SUBFEATURES * 2 +
+		       ((sftype & 0x80) >> 7) * MAX_SUBFEATURES +
+		       (sftype & 0x7F);
 	}
-	closedir(dir);
+}
+
+/* Build the dense feature and subfeature tables of a chip out of the
+   sparse table, which holds sfnum subfeatures */
+static void sensors_compact_subfeatures(sensors_chip_features *chip,
+					const sensors_subfeature
+					*all_subfeatures, int sfnum)
+{
+	int i, fnum = 0, prev_slot;
+	sensors_subfeature *dyn_subfeatures;
+	sensors_feature *dyn_features;
+	sensors_feature_type ftype;
 
 	if (!sfnum) { /* No subfeature */
 		chip->subfeature = NULL;
-		goto exit_free;
+		return;
 	}
 
 	/* How many main features? */
@@ -454,10 +451,14 @@ static int sensors_read_dynamic_chip(sensors_chip_features *chip,
 		}
 	}
 
-	dyn_subfeatures = calloc(sfnum, sizeof(sensors_subfeature));
-	dyn_features = calloc(fnum, sizeof(sensors_feature));
-	if (!dyn_subfeatures || !dyn_features)
+	/* Both tables live in a single block, features first. The size of
+	   sensors_feature is a multiple of the pointer size, so the
+	   subfeature table is properly aligned. */
+	dyn_features = sensors_calloc(1, fnum * sizeof(sensors_feature) +
+			      sfnum * sizeof(sensors_subfeature));
+	if (!dyn_features)
 		sensors_fatal_error(__func__, "Out of memory");
+	dyn_subfeatures = (sensors_subfeature *)(dyn_features + fnum);
 
 	/* Copy from the sparse array to the compact array */
 	sfnum = 0;
@@ -494,18 +495,153 @@ static int sensors_read_dynamic_chip(sensors_chip_features *chip,
 	chip->subfeature_count = sfnum;
 	chip->feature = dyn_features;
 	chip->feature_count = ++fnum;
+}
 
-exit_free:
-	free(all_subfeatures);
+static int sensors_read_dynamic_chip(sensors_chip_features *chip,
+				     const char *dev_path)
+{
+	int i, sfnum = 0;
+	DIR *dir;
+	struct dirent *ent;
+	sensors_subfeature *all_subfeatures;
+	sensors_subfeature_type sftype;
+
+	if (!(dir = opendir(dev_path))) {
+		sensors_profile_est_syscalls(1);
+		return -errno;
+	}
+
+	/* We use a large sparse table at first to store all found
+	   subfeatures, so that we can store them sorted at type and index
+	   and then later create a dense sorted table. */
+	all_subfeatures = sensors_calloc(ALL_POSSIBLE_SUBFEATURES,
+				 sizeof(sensors_subfeature));
+	if (!all_subfeatures)
+		sensors_fatal_error(__func__, "Out of memory");
+
+	while ((ent = readdir(dir))) {
+		char *name;
+		int nr;
+
+		/* Skip directories and symlinks */
+		if (ent->d_type != DT_REG)
+			continue;
+
+		name = ent->d_name;
+
+		sftype = sensors_subfeature_get_type(name, &nr);
+		if (sftype == SENSORS_SUBFEATURE_UNKNOWN)
+			continue;
+
+		if ((i = sensors_subfeature_slot(sftype, nr)) < 0)
+			continue;
+
+		if (all_subfeatures[i].name) {
+#ifdef DEBUG
+			sensors_fatal_error(__func__, "Duplicate subfeature");
+#endif
+			continue;
+		}
+
+		/* fill in the subfeature members */
+		all_subfeatures[i].type = sftype;
+		all_subfeatures[i].name = sensors_intern_string(name,
+							strlen(name));
+
+		if (!(sftype & 0x80))
+			all_subfeatures[i].flags |= SENSORS_COMPUTE_MAPPING;
+		all_subfeatures[i].flags |= sensors_get_attr_mode(dev_path, name);
+		if (sensors_subfeature_is_static(sftype))
+			all_subfeatures[i].flags |= SENSORS_STATIC_VALUE;
+
+		sfnum++;
+	}
+	closedir(dir);
+	sensors_profile_est_syscalls(EST_SYSCALLS_SCANDIR);
+
+	sensors_compact_subfeatures(chip, all_subfeatures, sfnum);
+	sensors_free(all_subfeatures);
 	return 0;
 }
 
+int sensors_subfeature_name_is_virtual(const char *name)
+{
+	sensors_subfeature_type sftype;
+	int nr;
+
+	sftype = sensors_subfeature_get_type(name, &nr);
+	return sftype != SENSORS_SUBFEATURE_UNKNOWN && !(sftype & 0x80) &&
+	       sftype != SENSORS_SUBFEATURE_BEEP_ENABLE &&
+	       sensors_subfeature_slot(sftype, nr) >= 0;
+}
+
+void sensors_set_virtual_features(sensors_chip_features *chip,
+				  char * const *names, int count)
+{
+	sensors_subfeature *all_subfeatures;
+	sensors_subfeature_type sftype;
+	int i, j, nr, sfnum = 0;
+
+	all_subfeatures = sensors_calloc(ALL_POSSIBLE_SUBFEATURES,
+				 sizeof(sensors_subfeature));
+	if (!all_subfeatures)
+		sensors_fatal_error(__func__, "Out of memory");
+
+	for (j = 0; j < count; j++) {
+		sftype = sensors_subfeature_get_type(names[j], &nr);
+		i = sensors_subfeature_slot(sftype, nr);
+		if (all_subfeatures[i].name)
+			continue;
+
+		all_subfeatures[i].type = sftype;
+		all_subfeatures[i].name = names[j];
+		all_subfeatures[i].flags = SENSORS_MODE_R |
+					   SENSORS_COMPUTE_MAPPING;
+		sfnum++;
+	}
+
+	sensors_compact_subfeatures(chip, all_subfeatures, sfnum);
+	sensors_free(all_subfeatures);
+}
+
+/* With lazy discovery, chips are only identified, which only takes a few
+   reads per chip; their attributes are enumerated (one stat() each) when
+   they are first looked up */
+static int lazy_discovery;
+
+void sensors_set_lazy_discovery(int enable)
+{
+	lazy_discovery = enable;
+}
+
+/* returns !0 if the directory holds at least one subfeature attribute */
+static int sensors_has_subfeatures(const char *dev_path)
+{
+	DIR *dir;
+	struct dirent *ent;
+	int nr, found = 0;
+
+	if (!(dir = opendir(dev_path))) {
+		sensors_profile_est_syscalls(1);
+		return 0;
+	}
+	while (!found && (ent = readdir(dir)))
+		found = ent->d_type == DT_REG &&
+			sensors_subfeature_get_type(ent->d_name, &nr) !=
+			SENSORS_SUBFEATURE_UNKNOWN;
+	closedir(dir);
+	sensors_profile_est_syscalls(EST_SYSCALLS_SCANDIR);
+
+	return found;
+}
+
 /* returns !0 if sysfs filesystem was found, 0 otherwise */
 int sensors_init_sysfs(void)
 {
 	struct stat statbuf;
 
 	snprintf(sensors_sysfs_mount, NAME_MAX, "%s", "/sys");
+	sensors_profile_est_syscalls(1);
 	if (stat(sensors_sysfs_mount, &statbuf) < 0
 	 || statbuf.st_nlink <= 2)	/* Empty directory */
 		return 0;
@@ -525,16 +661,13 @@ static int sensors_read_one_sysfs_chip(const char *dev_path,
 	char linkpath[NAME_MAX];
 	char subsys_path[NAME_MAX], *subsys;
 	int sub_len;
+	char *prefix;
 	sensors_chip_features entry;
 
 	/* ignore any device without name attribute */
-	if (!(entry.chip.prefix = sysfs_read_attr(hwmon_path, "name")))
+	if (!(prefix = sysfs_read_attr(hwmon_path, "name")))
 		return 0;
 
-	entry.chip.path = strdup(hwmon_path);
-	if (!entry.chip.path)
-		sensors_fatal_error(__func__, "Out of memory");
-
 	if (dev_path == NULL) {
 		/* Virtual device */
 		entry.chip.bus.type = SENSORS_BUS_TYPE_VIRTUAL;
@@ -547,10 +680,12 @@ static int sensors_read_one_sysfs_chip(const char *dev_path,
 	/* Find bus type */
 	snprintf(linkpath, NAME_MAX, "%s/subsystem", dev_path);
 	sub_len = readlink(linkpath, subsys_path, NAME_MAX - 1);
+	sensors_profile_est_syscalls(1);
 	if (sub_len < 0 && errno == ENOENT) {
 		/* Fallback to "bus" link for kernels <= 2.6.17 */
 		snprintf(linkpath, NAME_MAX, "%s/bus", dev_path);
 		sub_len = readlink(linkpath, subsys_path, NAME_MAX - 1);
+		sensors_profile_est_syscalls(1);
 	}
 	if (sub_len < 0) {
 		/* Older kernels (<= 2.6.11) have neither the subsystem
@@ -583,7 +718,7 @@ static int sensors_read_one_sysfs_chip(const char *dev_path,
 					entry.chip.bus.nr = 0;
 				}
 
-				free(bus_attr);
+				sensors_free(bus_attr);
 			}
 		}
 	} else
@@ -626,19 +761,65 @@ static int sensors_read_one_sysfs_chip(const char *dev_path,
 	}
 
 done:
-	if (sensors_read_dynamic_chip(&entry, hwmon_path) < 0)
-		goto exit_free;
-	if (!entry.subfeature) { /* No subfeature, discard chip */
-		err = 0;
-		goto exit_free;
+	if (lazy_discovery) {
+		if (!sensors_has_subfeatures(hwmon_path)) {
+			err = 0;
+			goto exit_free;
+		}
+		entry.feature = NULL;
+		entry.subfeature = NULL;
+		entry.feature_count = entry.subfeature_count = 0;
+		entry.subfeature_base = 0;
+		entry.loaded = 0;
+	} else {
+		if (sensors_read_dynamic_chip(&entry, hwmon_path) < 0)
+			goto exit_free;
+		if (!entry.subfeature) { /* No subfeature, discard chip */
+			err = 0;
+			goto exit_free;
+		}
+		entry.subfeature_base = sensors_proc_subfeatures_count;
+		sensors_proc_subfeatures_count += entry.subfeature_count;
+		entry.loaded = 1;
 	}
+	entry.chip.prefix = sensors_intern_string(prefix, strlen(prefix));
+	/* Each chip has a path of its own, no use interning it */
+	entry.chip.path = sensors_strdup(hwmon_path);
+	if (!entry.chip.path)
+		sensors_fatal_error(__func__, "Out of memory");
 	sensors_add_proc_chips(&entry);
+	sensors_trace_chip(&sensors_proc_chips[sensors_proc_chips_count - 1]);
+	sensors_free(prefix);
 
 	return 1;
 
 exit_free:
-	free(entry.chip.prefix);
-	free(entry.chip.path);
+	sensors_free(prefix);
+	return err;
+}
+
+/* Same as above, accounting for the time spent. It goes to the new chip
+   if there is one, otherwise to the library. */
+static int sensors_discover_one_sysfs_chip(const char *dev_path,
+					   const char *dev_name,
+					   const char *hwmon_path)
+{
+	sensors_profile_span span;
+	unsigned long long start;
+	int err;
+
+	SENSORS_PROBE1(discover_entry, hwmon_path);
+	sensors_profile_begin_detached(&span, SENSORS_INIT_CHIPS);
+	start = sensors_stats_begin();
+	err = sensors_read_one_sysfs_chip(dev_path, dev_name, hwmon_path);
+	sensors_stats_end(err > 0 ? sensors_proc_chips_count - 1 : -1,
+			  SENSORS_STATS_DISCOVER, start, err < 0 ? err : 0);
+	sensors_profile_end(&span);
+	if (err > 0)
+		sensors_profile_add_chip(sensors_proc_chips_count - 1, &span);
+	SENSORS_PROBE3(discover_return, hwmon_path, err > 0 ?
+		       sensors_proc_chips[sensors_proc_chips_count - 1].chip.prefix :
+		       NULL, err < 0 ? err : 0);
 	return err;
 }
 
@@ -647,7 +828,7 @@ static int sensors_add_hwmon_device_compat(const char *path,
 {
 	int err;
 
-	err = sensors_read_one_sysfs_chip(path, dev_name, path);
+	err = sensors_discover_one_sysfs_chip(path, dev_name, path);
 	if (err < 0)
 		return err;
 	return 0;
@@ -674,19 +855,22 @@ static int sensors_add_hwmon_device(const char *path, const char *classdev)
 
 	snprintf(linkpath, NAME_MAX, "%s/device", path);
 	dev_len = readlink(linkpath, device, NAME_MAX - 1);
+	sensors_profile_est_syscalls(1);
 	if (dev_len < 0) {
 		/* No device link? Treat as virtual */
-		err = sensors_read_one_sysfs_chip(NULL, NULL, path);
+		err = sensors_discover_one_sysfs_chip(NULL, NULL, path);
 	} else {
 		device[dev_len] = '\0';
 		device_p = strrchr(device, '/') + 1;
 
 		/* The attributes we want might be those of the hwmon class
 		   device, or those of the device itself. */
-		err = sensors_read_one_sysfs_chip(linkpath, device_p, path);
+		err = sensors_discover_one_sysfs_chip(linkpath, device_p,
+						      path);
 		if (err == 0)
-			err = sensors_read_one_sysfs_chip(linkpath, device_p,
-							  linkpath);
+			err = sensors_discover_one_sysfs_chip(linkpath,
+							      device_p,
+							      linkpath);
 	}
 	if (err < 0)
 		return err;
@@ -696,19 +880,54 @@ static int sensors_add_hwmon_device(const char *path, const char *classdev)
 /* returns 0 if successful, !0 otherwise */
 int sensors_read_sysfs_chips(void)
 {
-	int ret;
+	sensors_profile_span span;
+	int ret, phase;
 
+	phase = sensors_alloc_set_phase(SENSORS_ALLOC_DISCOVER);
+	sensors_profile_begin(&span, SENSORS_INIT_CHIPS);
 	ret = sysfs_foreach_classdev("hwmon", sensors_add_hwmon_device);
 	if (ret == ENOENT) {
 		/* compatibility function for kernel 2.6.n where n <= 13 */
-		return sensors_read_sysfs_chips_compat();
-	}
-
-	if (ret > 0)
+		ret = sensors_read_sysfs_chips_compat();
+	} else if (ret > 0)
 		ret = -SENSORS_ERR_KERNEL;
+	sensors_profile_end(&span);
+	sensors_alloc_set_phase(phase);
+
 	return ret;
 }
 
+/* Called with the chips locked, see sensors_lookup_chip() */
+int sensors_read_sysfs_features(sensors_chip_features *chip)
+{
+	sensors_profile_span span;
+	unsigned long long start;
+	int err, phase;
+
+	phase = sensors_alloc_set_phase(SENSORS_ALLOC_DISCOVER);
+	SENSORS_PROBE1(discover_entry, chip->chip.path);
+	sensors_profile_begin(&span, SENSORS_INIT_CHIPS);
+	start = sensors_stats_begin();
+	err = sensors_read_dynamic_chip(chip, chip->chip.path) < 0 ?
+	      -SENSORS_ERR_KERNEL : 0;
+	sensors_stats_end(chip - sensors_proc_chips, SENSORS_STATS_DISCOVER,
+			  start, err);
+	sensors_profile_end(&span);
+	sensors_profile_add_chip(chip - sensors_proc_chips, &span);
+	SENSORS_PROBE3(discover_return, chip->chip.path, chip->chip.prefix,
+		       err);
+	sensors_alloc_set_phase(phase);
+	if (err < 0)
+		return err;
+
+	chip->subfeature_base = sensors_proc_subfeatures_count;
+	__atomic_store_n(&sensors_proc_subfeatures_count,
+			 chip->subfeature_base + chip->subfeature_count,
+			 __ATOMIC_RELAXED);
+	sensors_trace_features(chip);
+	return 0;
+}
+
 /* returns 0 if successful, !0 otherwise */
 static int sensors_add_i2c_bus(const char *path, const char *classdev)
 {
@@ -731,57 +950,496 @@ static int sensors_add_i2c_bus(const char *path, const char *classdev)
 	return 0;
 }
 
-/* returns 0 if successful, !0 otherwise */
+static pthread_mutex_t bus_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* Enumerate the i2c adapters and index them. This is done once per
+   sensors_init(), when the adapter list is first needed, by whichever
+   thread needs it first; an enumeration which fails is tried again the
+   next time. returns 0 if successful, !0 otherwise */
 int sensors_read_sysfs_bus(void)
 {
-	int ret;
+	sensors_profile_span span;
+	int i, count, ret, phase;
 
-	ret = sysfs_foreach_classdev("i2c-adapter", sensors_add_i2c_bus);
-	if (ret == ENOENT)
-		ret = sysfs_foreach_busdev("i2c", sensors_add_i2c_bus);
-	if (ret && ret != ENOENT)
-		return -SENSORS_ERR_KERNEL;
+	if (__atomic_load_n(&sensors_proc_bus_loaded, __ATOMIC_ACQUIRE))
+		return 0;
+
+	pthread_mutex_lock(&bus_lock);
+	if (sensors_proc_bus_loaded) {
+		pthread_mutex_unlock(&bus_lock);
+		return 0;
+	}
 
+	count = sensors_proc_bus_count;
+	phase = sensors_alloc_set_phase(SENSORS_ALLOC_DISCOVER);
+	sensors_profile_begin(&span, SENSORS_INIT_BUSSES);
+	if (sensors_trace_mode == SENSORS_TRACE_REPLAY) {
+		sensors_trace_add_busses();
+		ret = 0;
+	} else {
+		ret = sysfs_foreach_classdev("i2c-adapter",
+					     sensors_add_i2c_bus);
+		if (ret == ENOENT)
+			ret = sysfs_foreach_busdev("i2c", sensors_add_i2c_bus);
+		sensors_trace_busses();
+	}
+
+	if (ret && ret != ENOENT) {
+		/* Drop what was found, so as not to add it twice */
+		for (i = count; i < sensors_proc_bus_count; i++)
+			sensors_free(sensors_proc_bus[i].adapter);
+		sensors_proc_bus_count = count;
+		ret = -SENSORS_ERR_KERNEL;
+	} else {
+		sensors_index_busses(&sensors_proc_bus_index,
+				     sensors_proc_bus, sensors_proc_bus_count);
+		__atomic_store_n(&sensors_proc_bus_loaded, 1,
+				 __ATOMIC_RELEASE);
+		ret = 0;
+	}
+	sensors_profile_end(&span);
+	sensors_alloc_set_phase(phase);
+	pthread_mutex_unlock(&bus_lock);
+
+	return ret;
+}
+
+/* Returns the interval at which the driver refreshes its values, in
+   milliseconds, or 0 if the driver doesn't tell */
+unsigned int sensors_read_sysfs_update_interval(const sensors_chip_name *name)
+{
+	unsigned int interval = 0;
+	char *value;
+
+	/* Virtual chips have no sysfs directory */
+	if (sensors_trace_mode == SENSORS_TRACE_REPLAY || !name->path)
+		return 0;
+	if ((value = sysfs_read_attr(name->path, "update_interval"))) {
+		interval = strtoul(value, NULL, 10);
+		sensors_free(value);
+	}
+	return interval;
+}
+
+/* Convert the contents of an attribute file, without scaling. len is the
+   number of bytes read into buf, or a negative errno value if the read
+   failed. */
+static int parse_sysfs_raw(char *buf, int len, double *value)
+{
+	char *end;
+
+	if (len < 0)
+		return len == -EIO || len == -ETIMEDOUT ? -SENSORS_ERR_IO :
+		       -SENSORS_ERR_ACCESS_R;
+
+	buf[len] = '\0';
+	*value = strtod(buf, &end);
+	if (end == buf)
+		return -SENSORS_ERR_ACCESS_R;
 	return 0;
 }
 
-int sensors_read_sysfs_attr(const sensors_chip_name *name,
+static int parse_sysfs_attr(const sensors_subfeature *subfeature,
+			    char *buf, int len, double *value)
+{
+	int err;
+
+	if (!(err = parse_sysfs_raw(buf, len, value)))
+		*value /= get_type_scaling(subfeature->type);
+	return err;
+}
+
+int sensors_get_sysfs_scaling(const sensors_subfeature *subfeature)
+{
+	return get_type_scaling(subfeature->type);
+}
+
+/* Plain open/read/close rather than stdio, so that reading an attribute
+   never allocates memory */
+int sensors_read_sysfs_attr(const sensors_chip_features *chip,
 			    const sensors_subfeature *subfeature,
 			    double *value)
 {
 	char n[NAME_MAX];
-	FILE *f;
+	char buf[ATTR_MAX];
+	int fd, len, err;
 
-	snprintf(n, NAME_MAX, "%s/%s", name->path, subfeature->name);
-	if ((f = fopen(n, "r"))) {
-		int res, err = 0;
+	SENSORS_PROBE2(read_entry, chip->chip.prefix, subfeature->name);
 
-		errno = 0;
-		res = fscanf(f, "%lf", value);
-		if (res == EOF && errno == EIO)
-			err = -SENSORS_ERR_IO;
-		else if (res != 1)
-			err = -SENSORS_ERR_ACCESS_R;
-		res = fclose(f);
-		if (err)
-			return err;
+	if (sensors_trace_mode == SENSORS_TRACE_REPLAY) {
+		err = sensors_trace_get_value(chip, subfeature, value);
+		goto exit;
+	}
 
-		if (res == EOF) {
-			if (errno == EIO)
-				return -SENSORS_ERR_IO;
-			else 
-				return -SENSORS_ERR_ACCESS_R;
-		}
-		*value /= get_type_scaling(subfeature->type);
-	} else
-		return -SENSORS_ERR_KERNEL;
+	snprintf(n, NAME_MAX, "%s/%s", chip->chip.path, subfeature->name);
+	if ((fd = open(n, O_RDONLY | O_CLOEXEC)) < 0) {
+		err = -SENSORS_ERR_KERNEL;
+		goto exit_trace;
+	}
+
+	len = read(fd, buf, sizeof(buf) - 1);
+	if (len < 0)
+		len = -errno;
+	close(fd);
+	err = parse_sysfs_attr(subfeature, buf, len, value);
+
+exit_trace:
+	if (sensors_trace_mode == SENSORS_TRACE_RECORD)
+		sensors_trace_read(chip, subfeature, err, value);
+exit:
+	SENSORS_PROBE4(read_return, chip->chip.prefix, subfeature->name,
+		       err ? 0 : SENSORS_PROBE_VALUE(*value), err);
+	return err;
+}
+
+int sensors_open_sysfs_attr(const sensors_chip_name *name,
+			    const sensors_subfeature *subfeature, int mode)
+{
+	char n[NAME_MAX];
+	int flags;
+
+	/* Nothing to access when replaying, writes go nowhere */
+	if (sensors_trace_mode == SENSORS_TRACE_REPLAY)
+		snprintf(n, NAME_MAX, "/dev/null");
+	else
+		snprintf(n, NAME_MAX, "%s/%s", name->path, subfeature->name);
+
+	if ((mode & SENSORS_MODE_R) && (mode & SENSORS_MODE_W))
+		flags = O_RDWR;
+	else if (mode & SENSORS_MODE_W)
+		flags = O_WRONLY;
+	else
+		flags = O_RDONLY;
+
+	/* Never block on a read, whatever the file is */
+	return open(n, flags | O_NONBLOCK | O_CLOEXEC);
+}
+
+int sensors_read_sysfs_fd(const sensors_chip_features *chip,
+			  const sensors_subfeature *subfeature, int fd,
+			  double *value)
+{
+	char buf[ATTR_MAX];
+	int len, err;
+
+	SENSORS_PROBE2(read_entry, chip->chip.prefix, subfeature->name);
 
+	if (sensors_trace_mode == SENSORS_TRACE_REPLAY) {
+		err = sensors_trace_get_value(chip, subfeature, value);
+	} else {
+		/* Not pread(), so that files which can't seek can be read
+		   too */
+		lseek(fd, 0, SEEK_SET);
+		len = read(fd, buf, sizeof(buf) - 1);
+		if (len < 0)
+			len = -errno;
+		err = parse_sysfs_attr(subfeature, buf, len, value);
+		if (sensors_trace_mode == SENSORS_TRACE_RECORD)
+			sensors_trace_read(chip, subfeature, err, value);
+	}
+
+	SENSORS_PROBE4(read_return, chip->chip.prefix, subfeature->name,
+		       err ? 0 : SENSORS_PROBE_VALUE(*value), err);
+	return err;
+}
+
+int sensors_read_sysfs_raw(int fd, double *value)
+{
+	char buf[ATTR_MAX];
+	int len;
+
+	lseek(fd, 0, SEEK_SET);
+	len = read(fd, buf, sizeof(buf) - 1);
+	if (len < 0)
+		len = -errno;
+	return parse_sysfs_raw(buf, len, value);
+}
+
+int sensors_write_sysfs_raw(int fd, double value)
+{
+	char buf[ATTR_MAX];
+	int len;
+
+	/* Attributes are always written from the start */
+	len = snprintf(buf, sizeof(buf), "%d", (int) value);
+	if (pwrite(fd, buf, len, 0) < 0)
+		return errno == EIO ? -SENSORS_ERR_IO : -SENSORS_ERR_ACCESS_W;
 	return 0;
 }
 
-int sensors_write_sysfs_attr(const sensors_chip_name *name,
-			     const sensors_subfeature *subfeature,
-			     double value)
+/* Descriptor cache for batched reads. Each subfeature of each chip has a
+   slot, allocated when the chip is first read. Attribute files are opened
+   on first use and stay open, sysfs regenerates their contents whenever
+   they are read from offset 0. They are also registered with io_uring,
+   at the index of the subfeature among those of all chips, when possible:
+   the file table is sized for the chips loaded by then, so with lazy
+   discovery, the files of chips loaded later are read unregistered.
+   At most attr_fds_limit files are kept open, see
+   sensors_set_attr_fd_limit(); past that, files are opened for each
+   read and closed after it. Lowering the limit closes the files past
+   it. */
+struct chip_fds {
+	int *fds;		/* -1 if not open yet */
+	int *slots;		/* io_uring slot, -1 if not registered */
+};
+
+static struct chip_fds *attr_fds;	/* One per detected chip */
+static unsigned int attr_fds_open;
+static unsigned int attr_fds_limit = SENSORS_ATTR_FDS_DEFAULT;
+static pthread_mutex_t attr_fds_lock = PTHREAD_MUTEX_INITIALIZER;
+/* Held for reading while descriptors handed out by get_attr_fd() are in
+   use, and for writing to close cached ones */
+static pthread_rwlock_t attr_fds_use = PTHREAD_RWLOCK_INITIALIZER;
+
+void sensors_set_attr_fd_limit(unsigned int max)
+{
+	struct chip_fds *cf;
+	int i, j;
+
+	pthread_rwlock_wrlock(&attr_fds_use);
+	pthread_mutex_lock(&attr_fds_lock);
+	attr_fds_limit = max;
+
+	/* Close the files past the new limit, those of the last chips
+	   first */
+	for (i = sensors_proc_chips_count - 1;
+	     attr_fds && i >= 0 && attr_fds_open > attr_fds_limit; i--) {
+		cf = &attr_fds[i];
+		if (!cf->fds)
+			continue;
+		for (j = sensors_proc_chips[i].subfeature_count - 1;
+		     j >= 0 && attr_fds_open > attr_fds_limit; j--) {
+			if (cf->fds[j] < 0)
+				continue;
+			if (cf->slots[j] >= 0)
+				sensors_uring_unregister(cf->slots[j]);
+			close(cf->fds[j]);
+			cf->fds[j] = cf->slots[j] = -1;
+			attr_fds_open--;
+		}
+	}
+	pthread_mutex_unlock(&attr_fds_lock);
+	pthread_rwlock_unlock(&attr_fds_use);
+}
+
+/* Called with attr_fds_lock held */
+static struct chip_fds *get_chip_fds(const sensors_chip_features *chip)
+{
+	struct chip_fds *cf;
+	int i;
+
+	if (!attr_fds) {
+		attr_fds = sensors_calloc(sensors_proc_chips_count,
+					  sizeof(struct chip_fds));
+		if (!attr_fds)
+			sensors_fatal_error(__func__, "Out of memory");
+	}
+
+	cf = &attr_fds[chip - sensors_proc_chips];
+	if (!cf->fds) {
+		cf->fds = sensors_malloc((chip->subfeature_count + 1) *
+					 sizeof(int));
+		cf->slots = sensors_malloc((chip->subfeature_count + 1) *
+					   sizeof(int));
+		if (!cf->fds || !cf->slots)
+			sensors_fatal_error(__func__, "Out of memory");
+		for (i = 0; i < chip->subfeature_count; i++)
+			cf->fds[i] = cf->slots[i] = -1;
+	}
+	return cf;
+}
+
+/* Returns an open descriptor for the attribute file of a subfeature, and
+   its io_uring slot, or -1 if the file can't be opened. *owned is set if
+   the descriptor isn't cached, and the caller must close it. */
+static int get_attr_fd(const sensors_chip_features *chip,
+		       const sensors_subfeature *subfeature, int *slot,
+		       int *owned)
+{
+	struct chip_fds *cf;
+	char n[NAME_MAX];
+	int i, fd;
+
+	*slot = -1;
+	*owned = 0;
+	pthread_mutex_lock(&attr_fds_lock);
+	cf = get_chip_fds(chip);
+	i = subfeature->number;
+	if (cf->fds[i] >= 0) {
+		fd = cf->fds[i];
+		*slot = cf->slots[i];
+		goto exit_unlock;
+	}
+
+	snprintf(n, NAME_MAX, "%s/%s", chip->chip.path, subfeature->name);
+	if ((fd = open(n, O_RDONLY | O_CLOEXEC)) < 0)
+		goto exit_unlock;
+	if (attr_fds_open >= attr_fds_limit) {
+		*owned = 1;
+		goto exit_unlock;
+	}
+	cf->fds[i] = fd;
+	cf->slots[i] = sensors_uring_register(chip->subfeature_base + i, fd,
+			__atomic_load_n(&sensors_proc_subfeatures_count,
+					__ATOMIC_RELAXED));
+	*slot = cf->slots[i];
+	attr_fds_open++;
+
+exit_unlock:
+	pthread_mutex_unlock(&attr_fds_lock);
+	return fd;
+}
+
+void sensors_attr_work_grow(sensors_attr_work *work, int size)
+{
+	if (size <= work->size)
+		return;
+
+	work->ur = sensors_realloc(work->ur,
+				   size * sizeof(struct sensors_uring_read));
+	work->map = sensors_realloc(work->map, size * sizeof(int));
+	work->owned = sensors_realloc(work->owned, size * sizeof(int));
+	work->ns = sensors_realloc(work->ns,
+				   size * sizeof(unsigned long long));
+	work->bufs = sensors_realloc(work->bufs, size * ATTR_MAX);
+	if (!work->ur || !work->map || !work->owned || !work->ns ||
+	    !work->bufs)
+		sensors_fatal_error(__func__, "Out of memory");
+	work->size = size;
+}
+
+void sensors_attr_work_free(sensors_attr_work *work)
+{
+	sensors_free(work->bufs);
+	sensors_free(work->ns);
+	sensors_free(work->owned);
+	sensors_free(work->map);
+	sensors_free(work->ur);
+	memset(work, 0, sizeof(*work));
+}
+
+void sensors_read_sysfs_attrs(sensors_attr_read *reads, int count,
+			      sensors_attr_work *work)
+{
+	struct sensors_uring_read *ur = work->ur;
+	unsigned long long start, *ns = work->ns;
+	char *bufs = work->bufs;
+	int *map = work->map, *owned = work->owned, i, n;
+
+	if (!count)
+		return;
+
+	/* The cached descriptors stay open until we are done */
+	pthread_rwlock_rdlock(&attr_fds_use);
+
+	for (i = 0, n = 0; i < count; i++) {
+		start = sensors_stats_begin();
+		SENSORS_PROBE2(read_entry, reads[i].chip->chip.prefix,
+			       reads[i].subfeature->name);
+		reads[i].err = sensors_breaker_check(reads[i].chip -
+						     sensors_proc_chips);
+		if (!reads[i].err &&
+		    sensors_trace_mode == SENSORS_TRACE_REPLAY) {
+			reads[i].err = sensors_trace_get_value(reads[i].chip,
+							reads[i].subfeature,
+							&reads[i].value);
+		} else if (!reads[i].err) {
+			ur[n].fd = get_attr_fd(reads[i].chip,
+					       reads[i].subfeature,
+					       &ur[n].slot, &owned[n]);
+			if (ur[n].fd < 0) {
+				reads[i].err = -SENSORS_ERR_KERNEL;
+			} else {
+				ur[n].iov.iov_base = bufs + n * ATTR_MAX;
+				ur[n].iov.iov_len = ATTR_MAX - 1;
+				map[n++] = i;
+			}
+		}
+		ns[i] = sensors_stats_begin() - start;
+	}
+
+	/* All reads at once if we can, one after the other otherwise. The
+	   reads of a batch complete in no particular order, so the time the
+	   batch took is shared evenly between them. */
+	start = sensors_stats_begin();
+	if (sensors_uring_read(ur, n) < 0) {
+		for (i = 0; i < n; i++) {
+			start = sensors_stats_begin();
+			ur[i].res = pread(ur[i].fd, ur[i].iov.iov_base,
+					  ur[i].iov.iov_len, 0);
+			if (ur[i].res < 0)
+				ur[i].res = -errno;
+			ns[map[i]] += sensors_stats_begin() - start;
+		}
+	} else if (n) {
+		start = (sensors_stats_begin() - start) / n;
+		for (i = 0; i < n; i++)
+			ns[map[i]] += start;
+	}
+
+	for (i = 0; i < n; i++) {
+		start = sensors_stats_begin();
+		if (owned[i])
+			close(ur[i].fd);
+		reads[map[i]].err = parse_sysfs_attr(reads[map[i]].subfeature,
+						     ur[i].iov.iov_base,
+						     ur[i].res,
+						     &reads[map[i]].value);
+		if (sensors_trace_mode == SENSORS_TRACE_RECORD)
+			sensors_trace_read(reads[map[i]].chip,
+					   reads[map[i]].subfeature,
+					   reads[map[i]].err,
+					   &reads[map[i]].value);
+		ns[map[i]] += sensors_stats_begin() - start;
+	}
+
+	pthread_rwlock_unlock(&attr_fds_use);
+
+	for (i = 0; i < count; i++) {
+		if (reads[i].err != -SENSORS_ERR_BREAKER) {
+			sensors_stats_add(reads[i].chip - sensors_proc_chips,
+					  SENSORS_STATS_READ, ns[i],
+					  reads[i].err);
+			sensors_breaker_report(reads[i].chip -
+					       sensors_proc_chips,
+					       reads[i].err);
+		}
+		SENSORS_PROBE4(read_return, reads[i].chip->chip.prefix,
+			       reads[i].subfeature->name, reads[i].err ? 0 :
+			       SENSORS_PROBE_VALUE(reads[i].value),
+			       reads[i].err);
+	}
+
+}
+
+void sensors_free_attr_fds(void)
+{
+	struct chip_fds *cf;
+	int i, j;
+
+	/* Unregisters the descriptors */
+	sensors_uring_cleanup();
+
+	pthread_mutex_lock(&attr_fds_lock);
+	for (i = 0; attr_fds && i < sensors_proc_chips_count; i++) {
+		cf = &attr_fds[i];
+		if (!cf->fds)
+			continue;
+		for (j = 0; j < sensors_proc_chips[i].subfeature_count; j++)
+			if (cf->fds[j] >= 0)
+				close(cf->fds[j]);
+		sensors_free(cf->fds);
+		sensors_free(cf->slots);
+	}
+	sensors_free(attr_fds);
+	attr_fds = NULL;
+	attr_fds_open = 0;
+	pthread_mutex_unlock(&attr_fds_lock);
+}
+
+static int __sensors_write_sysfs_attr(const sensors_chip_name *name,
+				      const sensors_subfeature *subfeature,
+				      double value)
 {
 	char n[NAME_MAX];
 	FILE *f;
@@ -811,3 +1469,18 @@ int sensors_write_sysfs_attr(const sensors_chip_name *name,
 
 	return 0;
 }
+
+int sensors_write_sysfs_attr(const sensors_chip_name *name,
+			     const sensors_subfeature *subfeature,
+			     double value)
+{
+	int err;
+
+	SENSORS_PROBE3(write_entry, name->prefix, subfeature->name,
+		       SENSORS_PROBE_VALUE(value));
+	/* Writes are accepted and dropped when replaying */
+	err = sensors_trace_mode == SENSORS_TRACE_REPLAY ? 0 :
+	      __sensors_write_sysfs_attr(name, subfeature, value);
+	SENSORS_PROBE3(write_return, name->prefix, subfeature->name, err);
+	return err;
+}
@@ -28,13 +28,83 @@ int sensors_init_sysfs(void);
 
 int sensors_read_sysfs_chips(void);
 
+/* Enumerate the features and subfeatures of a chip found by lazy
+   discovery. Returns 0 on success, <0 on failure. */
+int sensors_read_sysfs_features(sensors_chip_features *chip);
+
 int sensors_read_sysfs_bus(void);
 
+/* Check whether name is that of a subfeature a virtual chip can have: an
+   input or a limit, not an alarm nor a setting */
+int sensors_subfeature_name_is_virtual(const char *name);
+
+/* Build the features and subfeatures of a virtual chip, all readable,
+   from the interned names of its subfeatures, which must pass the check
+   above. The first of duplicate names wins. */
+void sensors_set_virtual_features(sensors_chip_features *chip,
+				  char * const *names, int count);
+
+/* Read the update interval of a chip, in milliseconds, 0 if unknown */
+unsigned int sensors_read_sysfs_update_interval(const sensors_chip_name *name);
+
 /* Read a value out of a sysfs attribute file */
-int sensors_read_sysfs_attr(const sensors_chip_name *name,
+int sensors_read_sysfs_attr(const sensors_chip_features *chip,
 			    const sensors_subfeature *subfeature,
 			    double *value);
 
+/* Open the attribute file of a subfeature, for sensors_read_sysfs_fd().
+   mode is SENSORS_MODE_R and/or SENSORS_MODE_W. Returns -1 on failure. */
+int sensors_open_sysfs_attr(const sensors_chip_name *name,
+			    const sensors_subfeature *subfeature, int mode);
+
+/* Read a value out of an attribute file opened by
+   sensors_open_sysfs_attr(). This also acknowledges the notifications
+   received on that file. */
+int sensors_read_sysfs_fd(const sensors_chip_features *chip,
+			  const sensors_subfeature *subfeature, int fd,
+			  double *value);
+
+/* Multiplier between the values of a subfeature and its attribute file */
+int sensors_get_sysfs_scaling(const sensors_subfeature *subfeature);
+
+/* Read or write the raw, unscaled value of an attribute file opened by
+   sensors_open_sysfs_attr(), with no accounting nor tracing */
+int sensors_read_sysfs_raw(int fd, double *value);
+int sensors_write_sysfs_raw(int fd, double value);
+
+/* One read of a batch */
+typedef struct sensors_attr_read {
+	const sensors_chip_features *chip;
+	const sensors_subfeature *subfeature;
+	double value;
+	int err;
+} sensors_attr_read;
+
+/* Work space for a batch of up to size reads, so that reading doesn't
+   allocate */
+struct sensors_uring_read;
+typedef struct sensors_attr_work {
+	int size;
+	struct sensors_uring_read *ur;
+	int *map;
+	int *owned;
+	unsigned long long *ns;		/* Time spent on each read */
+	char *bufs;
+} sensors_attr_work;
+
+/* Make room in work for size reads, or free it. A zeroed work is empty. */
+void sensors_attr_work_grow(sensors_attr_work *work, int size);
+void sensors_attr_work_free(sensors_attr_work *work);
+
+/* Read the values of many attribute files at once, through io_uring if
+   the kernel supports it, with work room for count reads. The err member
+   of each read is set to 0 on success, <0 on failure. */
+void sensors_read_sysfs_attrs(sensors_attr_read *reads, int count,
+			      sensors_attr_work *work);
+
+/* Close the attribute files opened by sensors_read_sysfs_attrs() */
+void sensors_free_attr_fds(void);
+
 /* Write a value to a sysfs attribute file */
 int sensors_write_sysfs_attr(const sensors_chip_name *name,
 			     const sensors_subfeature *subfeature,
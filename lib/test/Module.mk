@@ -1,22 +1,30 @@
 LIB_DIR		:= lib
 LIB_TEST_DIR	:= lib/test
 
-LIB_TEST_TARGETS := $(LIB_TEST_DIR)/test-scanner
-LIB_TEST_SOURCES := $(LIB_TEST_DIR)/test-scanner.c
+LIB_TEST_TARGETS := $(LIB_TEST_DIR)/test-scanner \
+		    $(LIB_TEST_DIR)/test-alarm
+LIB_TEST_SOURCES := $(LIB_TEST_DIR)/test-scanner.c \
+		    $(LIB_TEST_DIR)/test-alarm.c
 
 LIB_TEST_SCANNER_OBJS := \
 	$(LIB_TEST_DIR)/test-scanner.ro \
 	$(LIB_DIR)/conf-lex.ao \
 	$(LIB_DIR)/error.ao \
-	$(LIB_DIR)/general.ao
+	$(LIB_DIR)/general.ao \
+	$(LIB_DIR)/alloc.ao
 
 $(LIB_TEST_DIR)/test-scanner: $(LIB_TEST_SCANNER_OBJS)
 	$(CC) $(EXLDFLAGS) -o $@ $(LIB_TEST_SCANNER_OBJS) -Llib
 
+# Linked statically, as it sets up a simulated chip in the library
+$(LIB_TEST_DIR)/test-alarm: $(LIB_TEST_DIR)/test-alarm.ro $(LIBSTOBJECTS)
+	$(CC) $(EXLDFLAGS) -o $@ $^ -lm -lpthread
+
 all-lib-test: $(LIB_TEST_TARGETS)
 user :: all-lib-test
 
 $(LIB_TEST_DIR)/test-scanner.ro: $(LIB_DIR)/data.h $(LIB_DIR)/conf.h $(LIB_DIR)/conf-parse.h $(LIB_DIR)/scanner.h
+$(LIB_TEST_DIR)/test-alarm.ro: $(LIB_DIR)/sensors.h $(LIB_DIR)/data.h $(LIB_DIR)/alarm.h
 
 clean-lib-test:
 	$(RM) $(LIB_TEST_DIR)/*.rd $(LIB_TEST_DIR)/*.ro 
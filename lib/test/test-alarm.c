@@ -0,0 +1,166 @@
+/*
+    test-alarm.c - Regression test for the libsensors alarm watching.
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+    MA 02110-1301 USA.
+*/
+
+/* The chip is simulated, in a temporary directory rather than in sysfs.
+   in0_alarm is a regular file, which can't notify, so it must be picked
+   up by the timer. in1_alarm is a FIFO: closing its write end wakes up
+   the readers with POLLHUP, which stands for the notification of a
+   driver with interrupt support. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/stat.h>
+
+#include "../sensors.h"
+#include "../data.h"
+#include "../alarm.h"
+
+static char dir[] = "/tmp/test-alarm.XXXXXX";
+static char path0[64], path1[64];
+
+static char prefix[] = "test";
+static char in0[] = "in0", in1[] = "in1";
+static char in0_alarm[] = "in0_alarm", in1_alarm[] = "in1_alarm";
+
+static sensors_feature features[] = {
+	{ in0, 0, SENSORS_FEATURE_IN, 0, 0 },
+	{ in1, 1, SENSORS_FEATURE_IN, 1, 0 },
+};
+
+static sensors_subfeature subfeatures[] = {
+	{ in0_alarm, 0, SENSORS_SUBFEATURE_IN_ALARM, 0, SENSORS_MODE_R },
+	{ in1_alarm, 1, SENSORS_SUBFEATURE_IN_ALARM, 1, SENSORS_MODE_R },
+};
+
+static sensors_chip_features chip = {
+	{ prefix, { SENSORS_BUS_TYPE_VIRTUAL, 0 }, 0, dir },
+	features, subfeatures, 2, 2
+};
+
+static int tests, failed;
+
+static void check(int ok, const char *desc)
+{
+	tests++;
+	if (!ok)
+		failed++;
+	printf("%sok %d - %s\n", ok ? "" : "not ", tests, desc);
+}
+
+/* Simulate the driver updating in0_alarm, which it can't notify */
+static void set_in0(const char *value)
+{
+	FILE *f = fopen(path0, "w");
+
+	fputs(value, f);
+	fclose(f);
+}
+
+/* Simulate the driver updating in1_alarm and notifying it */
+static void notify_in1(const char *value)
+{
+	int fd = open(path1, O_WRONLY | O_NONBLOCK);
+
+	if (write(fd, value, strlen(value)) < 0)
+		perror("write");
+	close(fd);
+}
+
+static int wait_alarm(int timeout)
+{
+	struct pollfd pfd;
+
+	pfd.fd = sensors_alarm_fd();
+	pfd.events = POLLIN;
+	return poll(&pfd, 1, timeout);
+}
+
+static unsigned long long reads(void)
+{
+	sensors_stats stats;
+
+	sensors_get_stats(NULL, &stats);
+	return stats.op[SENSORS_STATS_READ].count;
+}
+
+int main(void)
+{
+	sensors_alarm_change changes[4];
+	unsigned long long n;
+	int i;
+
+	if (!mkdtemp(dir))
+		return 1;
+	snprintf(path0, sizeof(path0), "%s/in0_alarm", dir);
+	snprintf(path1, sizeof(path1), "%s/in1_alarm", dir);
+	set_in0("0\n");
+	if (mkfifo(path1, 0600))
+		return 1;
+
+	sensors_proc_chips = &chip;
+	sensors_proc_chips_count = 1;
+
+	/* Timer fallback */
+	check(sensors_set_alarm_poll_interval(10) == 0, "set poll interval");
+	check(sensors_watch_alarm(&chip.chip, 0) == 0, "watch in0_alarm");
+	check(sensors_get_alarm_changes(changes, 4) == 0,
+	      "initial value not reported");
+	set_in0("1\n");
+	check(wait_alarm(1000) == 1, "timer wakes up");
+	for (i = 0; i < 100 && !sensors_get_alarm_changes(changes, 4); i++)
+		wait_alarm(100);
+	check(i < 100 && changes[0].subfeat_nr == 0 && changes[0].value == 1,
+	      "in0_alarm change polled");
+	wait_alarm(50);
+	check(sensors_get_alarm_changes(changes, 4) == 0,
+	      "no change, nothing reported");
+	sensors_alarm_cleanup();
+
+	/* Notifications */
+	check(sensors_set_alarm_poll_interval(10) == 0, "set poll interval");
+	check(sensors_watch_alarm(&chip.chip, 1) == 0, "watch in1_alarm");
+	notify_in1("1\n");
+	check(wait_alarm(1000) == 1, "notification wakes up");
+	check(sensors_get_alarm_changes(changes, 4) == 1 &&
+	      changes[0].subfeat_nr == 1 && changes[0].value == 1,
+	      "in1_alarm change notified");
+
+	/* Once in1_alarm notified, the timer is stopped */
+	n = reads();
+	check(wait_alarm(100) == 0, "idle, no wake up");
+	check(sensors_get_alarm_changes(changes, 4) == 0 && reads() == n,
+	      "idle, no read");
+
+	notify_in1("0\n");
+	check(wait_alarm(1000) == 1 &&
+	      sensors_get_alarm_changes(changes, 4) == 1 &&
+	      changes[0].value == 0, "in1_alarm cleared");
+	sensors_alarm_cleanup();
+
+	unlink(path0);
+	unlink(path1);
+	rmdir(dir);
+
+	printf("1..%d\n", tests);
+	return failed ? 1 : 0;
+}
@@ -19,26 +19,32 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include "../data.h"
 #include "../conf.h"
 #include "../conf-parse.h"
 #include "../scanner.h"
 
-YYSTYPE sensors_yylval;
+/* This is defined in conf-lex.l */
+int sensors_yylex(YYSTYPE *lvalp, void *scanner);
 
 int main(void)
 {
 	int result;
+	sensors_parse_state state;
+	YYSTYPE lval;
+	void *scanner;
 
 	/* init the scanner */
-	if ((result = sensors_scanner_init(stdin, NULL)))
+	memset(&state, 0, sizeof(state));
+	if ((result = sensors_scanner_init(stdin, &state, &scanner)))
 		return result;
 
 	do {
-		result = sensors_yylex();
+		result = sensors_yylex(&lval, scanner);
 
-		printf("%d: ", sensors_yylineno);
+		printf("%d: ", state.lineno);
 
 		switch (result) {
 
@@ -78,13 +84,25 @@ int main(void)
 				printf("IGNORE\n");
 				break;
 	
+			case VIRTUAL:
+				printf("VIRTUAL\n");
+				break;
+	
+			case FEATURE:
+				printf("FEATURE\n");
+				break;
+	
+			case INTERVAL:
+				printf("INTERVAL\n");
+				break;
+	
 			case FLOAT:
-				printf("FLOAT: %f\n", sensors_yylval.value);
+				printf("FLOAT: %f\n", lval.value);
 				break;
 	
 			case NAME:
-				printf("NAME: %s\n", sensors_yylval.name);
-				free(sensors_yylval.name);
+				printf("NAME: %s\n", lval.name);
+				free(lval.name);
 				break;
 	
 			case ERROR:
@@ -99,7 +117,7 @@ int main(void)
 	} while (result);
 
 	/* clean up the scanner */
-	sensors_scanner_exit();
+	sensors_scanner_exit(scanner);
 
 	return 0;
 }
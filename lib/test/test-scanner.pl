@@ -44,6 +44,8 @@ my @scenarios = (
 		desc => 'normal, quoted names' },
 	{ base => 'names-quoted-errors', status => 0,
 		desc => 'invalid, quoted names' },
+	{ base => 'floats', status => 0,
+		desc => 'numbers, alone and within expressions' },
 );
 
 plan tests => ($#scenarios + 1) * 3;
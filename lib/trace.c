@@ -0,0 +1,670 @@
+/*
+    trace.c - Part of libsensors, a Linux library for reading sensor data.
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+    MA 02110-1301 USA.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <pthread.h>
+#include "sensors.h"
+#include "data.h"
+#include "error.h"
+#include "alloc.h"
+#include "general.h"
+#include "trace.h"
+
+/* A trace starts with a magic string and a version number, followed by
+   records, each made of a type byte and fields. Integers are stored as
+   LEB128 varints, signed ones zigzag-encoded first, strings as their
+   length and bytes, and values as the 8 bytes of the double, least
+   significant first. The records are:
+
+   'C' prefix, path, bus type, bus number, address
+	A detected chip. Chips are numbered in the order they come.
+   'F' chip, feature count, subfeature count,
+       each feature: name, type, first subfeature, label ("" if none),
+       each subfeature: name, type, mapping, flags
+	The features of a chip, once enumerated.
+   'B' adapter name, bus type, bus number
+	An i2c adapter, once the adapter list is needed.
+   'R' nanoseconds since the previous read, chip, subfeature, error,
+       and the value if the error is 0
+	An attribute read.
+
+   A trace is replayed as a whole: it is loaded in memory up front, so
+   that replaying costs no I/O. A record cut short at the end of the
+   file, as left by a process killed while recording, is dropped. */
+
+#define TRACE_MAGIC	"LMSTRACE"
+#define TRACE_VERSION	1
+
+/* Sanity limit on the counts read from a trace */
+#define TRACE_MAX_COUNT	65536
+
+int sensors_trace_mode = SENSORS_TRACE_OFF;
+
+/* Record mode */
+static FILE *trace_file;
+static pthread_mutex_t trace_lock = PTHREAD_MUTEX_INITIALIZER;
+static unsigned long long trace_last;	/* ns, time of the last read */
+
+/* Replay mode */
+struct trace_sample {
+	unsigned long long t;	/* ns since the start of the trace */
+	double value;
+	int err;
+};
+
+struct trace_series {
+	struct trace_sample *samples;
+	int count;
+	int max;
+	int next;		/* Next sample, when replaying in order */
+};
+
+struct trace_chip {
+	sensors_chip_features features;	/* Handed over to sensors_proc_chips
+					   by sensors_trace_add_chips() */
+	struct trace_series *series;	/* One per subfeature */
+	char **labels;			/* One per feature */
+};
+
+static struct trace_chip *trace_chips;
+static int trace_chips_count;
+static int trace_chips_max;
+static sensors_bus *trace_busses;
+static int trace_busses_count;
+static int trace_busses_max;
+static unsigned int trace_speed;
+static unsigned long long trace_begin;	/* ns, when the replay started */
+
+static void put_uint(FILE *f, unsigned long long v)
+{
+	while (v >= 0x80) {
+		putc((v & 0x7f) | 0x80, f);
+		v >>= 7;
+	}
+	putc(v, f);
+}
+
+static void put_int(FILE *f, long long v)
+{
+	put_uint(f, ((unsigned long long)v << 1) ^ (v >> 63));
+}
+
+static void put_string(FILE *f, const char *s)
+{
+	size_t len = strlen(s);
+
+	put_uint(f, len);
+	fwrite(s, 1, len, f);
+}
+
+static void put_double(FILE *f, double value)
+{
+	unsigned long long bits;
+	int i;
+
+	memcpy(&bits, &value, sizeof(bits));
+	for (i = 0; i < 8; i++, bits >>= 8)
+		putc(bits & 0xff, f);
+}
+
+int sensors_trace_record(const char *path)
+{
+	if (sensors_trace_mode != SENSORS_TRACE_OFF)
+		return -SENSORS_ERR_BUSY;
+	if (!(trace_file = fopen(path, "w")))
+		return -SENSORS_ERR_ACCESS_W;
+
+	fputs(TRACE_MAGIC, trace_file);
+	put_uint(trace_file, TRACE_VERSION);
+	sensors_trace_mode = SENSORS_TRACE_RECORD;
+	return 0;
+}
+
+void sensors_trace_start(void)
+{
+	trace_last = trace_begin = sensors_monotonic_ns();
+}
+
+/* The contents of the sysfs label file of a feature, "" if none */
+static void read_label(const sensors_chip_features *chip,
+		       const sensors_feature *feature, char *buf, int size)
+{
+	FILE *f;
+	int n = 0;
+
+	snprintf(buf, size, "%s/%s_label", chip->chip.path, feature->name);
+	if ((f = fopen(buf, "r"))) {
+		n = fread(buf, 1, size, f);
+		fclose(f);
+	}
+	/* n - 1 to strip the '\n' at the end */
+	buf[n > 0 ? n - 1 : 0] = '\0';
+}
+
+/* Called with trace_lock held */
+static void put_features(const sensors_chip_features *chip)
+{
+	const sensors_feature *feature;
+	const sensors_subfeature *subfeature;
+	char label[PATH_MAX];
+	int i;
+
+	putc('F', trace_file);
+	put_uint(trace_file, chip - sensors_proc_chips);
+	put_uint(trace_file, chip->feature_count);
+	put_uint(trace_file, chip->subfeature_count);
+	for (i = 0; i < chip->feature_count; i++) {
+		feature = &chip->feature[i];
+		read_label(chip, feature, label, sizeof(label));
+		put_string(trace_file, feature->name);
+		put_uint(trace_file, feature->type);
+		put_uint(trace_file, feature->first_subfeature);
+		put_string(trace_file, label);
+	}
+	for (i = 0; i < chip->subfeature_count; i++) {
+		subfeature = &chip->subfeature[i];
+		put_string(trace_file, subfeature->name);
+		put_uint(trace_file, subfeature->type);
+		put_uint(trace_file, subfeature->mapping);
+		put_uint(trace_file, subfeature->flags);
+	}
+}
+
+void sensors_trace_chip(const sensors_chip_features *chip)
+{
+	if (sensors_trace_mode != SENSORS_TRACE_RECORD)
+		return;
+
+	pthread_mutex_lock(&trace_lock);
+	putc('C', trace_file);
+	put_string(trace_file, chip->chip.prefix);
+	put_string(trace_file, chip->chip.path);
+	put_int(trace_file, chip->chip.bus.type);
+	put_int(trace_file, chip->chip.bus.nr);
+	put_int(trace_file, chip->chip.addr);
+	if (chip->loaded)
+		put_features(chip);
+	pthread_mutex_unlock(&trace_lock);
+}
+
+void sensors_trace_features(const sensors_chip_features *chip)
+{
+	if (sensors_trace_mode != SENSORS_TRACE_RECORD)
+		return;
+
+	pthread_mutex_lock(&trace_lock);
+	put_features(chip);
+	pthread_mutex_unlock(&trace_lock);
+}
+
+void sensors_trace_busses(void)
+{
+	int i;
+
+	if (sensors_trace_mode != SENSORS_TRACE_RECORD)
+		return;
+
+	pthread_mutex_lock(&trace_lock);
+	for (i = 0; i < sensors_proc_bus_count; i++) {
+		putc('B', trace_file);
+		put_string(trace_file, sensors_proc_bus[i].adapter);
+		put_int(trace_file, sensors_proc_bus[i].bus.type);
+		put_int(trace_file, sensors_proc_bus[i].bus.nr);
+	}
+	pthread_mutex_unlock(&trace_lock);
+}
+
+void sensors_trace_read(const sensors_chip_features *chip,
+			const sensors_subfeature *subfeature, int err,
+			const double *value)
+{
+	unsigned long long now;
+
+	pthread_mutex_lock(&trace_lock);
+	/* Taken with the lock held, so that times never go backwards */
+	now = sensors_monotonic_ns();
+	putc('R', trace_file);
+	put_uint(trace_file, now - trace_last);
+	put_uint(trace_file, chip - sensors_proc_chips);
+	put_uint(trace_file, subfeature->number);
+	put_int(trace_file, err);
+	if (!err)
+		put_double(trace_file, *value);
+	trace_last = now;
+	pthread_mutex_unlock(&trace_lock);
+}
+
+/* Reading a trace. Reading past the end sets truncated and returns 0. */
+struct trace_reader {
+	const unsigned char *p;
+	const unsigned char *end;
+	int truncated;
+};
+
+static unsigned long long get_uint(struct trace_reader *r)
+{
+	unsigned long long v = 0;
+	int shift;
+
+	for (shift = 0; r->p < r->end && shift < 64; shift += 7) {
+		v |= (unsigned long long)(*r->p & 0x7f) << shift;
+		if (!(*r->p++ & 0x80))
+			return v;
+	}
+	r->truncated = 1;
+	return 0;
+}
+
+static long long get_int(struct trace_reader *r)
+{
+	unsigned long long v = get_uint(r);
+
+	return (long long)(v >> 1) ^ -(long long)(v & 1);
+}
+
+/* Returns an interned string, NULL if truncated */
+static char *get_string(struct trace_reader *r)
+{
+	unsigned long long len = get_uint(r);
+
+	if (r->truncated || len > (unsigned long long)(r->end - r->p)) {
+		r->truncated = 1;
+		return NULL;
+	}
+	r->p += len;
+	return sensors_intern_string((const char *)r->p - len, len);
+}
+
+/* Same as above for strings which aren't shared, returns a copy */
+static char *get_unique_string(struct trace_reader *r)
+{
+	unsigned long long len = get_uint(r);
+	char *res;
+
+	if (r->truncated || len > (unsigned long long)(r->end - r->p)) {
+		r->truncated = 1;
+		return NULL;
+	}
+	res = sensors_strndup((const char *)r->p, len);
+	if (!res)
+		sensors_fatal_error(__func__, "Out of memory");
+	r->p += len;
+	return res;
+}
+
+static double get_double(struct trace_reader *r)
+{
+	unsigned long long bits = 0;
+	double value;
+	int i;
+
+	if (r->end - r->p < 8) {
+		r->truncated = 1;
+		return 0;
+	}
+	for (i = 0; i < 8; i++)
+		bits |= (unsigned long long)*r->p++ << (8 * i);
+	memcpy(&value, &bits, sizeof(value));
+	return value;
+}
+
+static int load_chip(struct trace_reader *r)
+{
+	struct trace_chip entry;
+
+	memset(&entry, 0, sizeof(entry));
+	entry.features.chip.prefix = get_string(r);
+	entry.features.chip.path = get_unique_string(r);
+	entry.features.chip.bus.type = get_int(r);
+	entry.features.chip.bus.nr = get_int(r);
+	entry.features.chip.addr = get_int(r);
+	entry.features.loaded = 1;
+	if (r->truncated) {
+		sensors_free(entry.features.chip.path);
+		return 0;
+	}
+
+	sensors_add_array_el(&entry, &trace_chips, &trace_chips_count,
+			     &trace_chips_max, sizeof(struct trace_chip));
+	return 0;
+}
+
+static int load_features(struct trace_reader *r)
+{
+	struct trace_chip *chip;
+	sensors_feature *features;
+	sensors_subfeature *subfeatures;
+	char **labels;
+	unsigned long long nr, fnum, sfnum;
+	int i;
+
+	nr = get_uint(r);
+	fnum = get_uint(r);
+	sfnum = get_uint(r);
+	if (r->truncated)
+		return 0;
+	if (nr >= (unsigned long long)trace_chips_count ||
+	    trace_chips[nr].series || !fnum || fnum > sfnum ||
+	    sfnum > TRACE_MAX_COUNT)
+		return -SENSORS_ERR_PARSE;
+	chip = &trace_chips[nr];
+
+	/* Same layout as that of sensors_read_dynamic_chip() */
+	features = sensors_calloc(1, fnum * sizeof(sensors_feature) +
+				  sfnum * sizeof(sensors_subfeature));
+	labels = sensors_calloc(fnum, sizeof(char *));
+	if (!features || !labels)
+		sensors_fatal_error(__func__, "Out of memory");
+	subfeatures = (sensors_subfeature *)(features + fnum);
+
+	for (i = 0; i < (int)fnum; i++) {
+		features[i].name = get_string(r);
+		features[i].number = i;
+		features[i].type = get_uint(r);
+		features[i].first_subfeature = get_uint(r);
+		labels[i] = get_string(r);
+		if (labels[i] && !labels[i][0])
+			labels[i] = NULL;
+		if (features[i].first_subfeature < 0 ||
+		    features[i].first_subfeature >= (int)sfnum)
+			goto exit_parse;
+	}
+	for (i = 0; i < (int)sfnum; i++) {
+		subfeatures[i].name = get_string(r);
+		subfeatures[i].number = i;
+		subfeatures[i].type = get_uint(r);
+		subfeatures[i].mapping = get_uint(r);
+		subfeatures[i].flags = get_uint(r);
+		if (subfeatures[i].mapping < 0 ||
+		    subfeatures[i].mapping >= (int)fnum)
+			goto exit_parse;
+	}
+	if (r->truncated)
+		goto exit_free;
+
+	chip->features.feature = features;
+	chip->features.subfeature = subfeatures;
+	chip->features.feature_count = fnum;
+	chip->features.subfeature_count = sfnum;
+	chip->labels = labels;
+	chip->series = sensors_calloc(sfnum, sizeof(struct trace_series));
+	if (!chip->series)
+		sensors_fatal_error(__func__, "Out of memory");
+	return 0;
+
+exit_parse:
+	/* Garbage read past the end makes no sense either */
+	if (r->truncated)
+		goto exit_free;
+	sensors_free(labels);
+	sensors_free(features);
+	return -SENSORS_ERR_PARSE;
+
+exit_free:
+	sensors_free(labels);
+	sensors_free(features);
+	return 0;
+}
+
+static int load_bus(struct trace_reader *r)
+{
+	sensors_bus entry;
+	const char *adapter;
+
+	memset(&entry, 0, sizeof(entry));
+	adapter = get_string(r);
+	entry.bus.type = get_int(r);
+	entry.bus.nr = get_int(r);
+	if (r->truncated)
+		return 0;
+
+	if (!(entry.adapter = sensors_strdup(adapter)))
+		sensors_fatal_error(__func__, "Out of memory");
+	sensors_add_array_el(&entry, &trace_busses, &trace_busses_count,
+			     &trace_busses_max, sizeof(sensors_bus));
+	return 0;
+}
+
+static int load_read(struct trace_reader *r, unsigned long long *t)
+{
+	struct trace_series *series;
+	struct trace_sample sample;
+	unsigned long long nr, sfnr;
+
+	*t += get_uint(r);
+	nr = get_uint(r);
+	sfnr = get_uint(r);
+	sample.err = get_int(r);
+	sample.value = sample.err ? 0 : get_double(r);
+	sample.t = *t;
+	if (r->truncated)
+		return 0;
+	if (nr >= (unsigned long long)trace_chips_count ||
+	    !trace_chips[nr].series ||
+	    sfnr >= (unsigned long long)trace_chips[nr].features.subfeature_count)
+		return -SENSORS_ERR_PARSE;
+
+	/* Hours of samples: grow geometrically, not by A_BUNCH */
+	series = &trace_chips[nr].series[sfnr];
+	if (series->count == series->max) {
+		series->max = series->max ? 2 * series->max : 64;
+		series->samples = sensors_realloc(series->samples, series->max *
+						  sizeof(struct trace_sample));
+		if (!series->samples)
+			sensors_fatal_error(__func__, "Out of memory");
+	}
+	series->samples[series->count++] = sample;
+	return 0;
+}
+
+static int load_trace(const unsigned char *buf, size_t len)
+{
+	struct trace_reader r;
+	unsigned long long t = 0;
+	int err = 0;
+
+	r.p = buf;
+	r.end = buf + len;
+	r.truncated = 0;
+
+	if (len < strlen(TRACE_MAGIC) ||
+	    memcmp(buf, TRACE_MAGIC, strlen(TRACE_MAGIC)))
+		return -SENSORS_ERR_PARSE;
+	r.p += strlen(TRACE_MAGIC);
+	if (get_uint(&r) != TRACE_VERSION)
+		return -SENSORS_ERR_PARSE;
+
+	while (!err && !r.truncated && r.p < r.end) {
+		switch (*r.p++) {
+		case 'C':
+			err = load_chip(&r);
+			break;
+		case 'F':
+			err = load_features(&r);
+			break;
+		case 'B':
+			err = load_bus(&r);
+			break;
+		case 'R':
+			err = load_read(&r, &t);
+			break;
+		default:
+			err = -SENSORS_ERR_PARSE;
+		}
+	}
+
+	return err;
+}
+
+int sensors_trace_replay(const char *path, unsigned int speed)
+{
+	unsigned char *buf = NULL;
+	size_t len = 0, size = 0;
+	FILE *f;
+	int err;
+
+	if (sensors_trace_mode != SENSORS_TRACE_OFF)
+		return -SENSORS_ERR_BUSY;
+	if (!(f = fopen(path, "r")))
+		return -SENSORS_ERR_ACCESS_R;
+
+	do {
+		if (len == size) {
+			size = size ? 2 * size : 65536;
+			if (!(buf = sensors_realloc(buf, size)))
+				sensors_fatal_error(__func__, "Out of memory");
+		}
+		len += fread(buf + len, 1, size - len, f);
+	} while (len == size);
+	err = ferror(f) ? -SENSORS_ERR_ACCESS_R : 0;
+	fclose(f);
+
+	if (!err)
+		err = load_trace(buf, len);
+	sensors_free(buf);
+
+	trace_speed = speed;
+	sensors_trace_mode = SENSORS_TRACE_REPLAY;
+	if (err)
+		sensors_trace_cleanup();
+	return err;
+}
+
+void sensors_trace_add_chips(void)
+{
+	struct trace_chip *chip;
+	int i;
+
+	for (i = 0; i < trace_chips_count; i++) {
+		chip = &trace_chips[i];
+		chip->features.subfeature_base = sensors_proc_subfeatures_count;
+		sensors_proc_subfeatures_count +=
+			chip->features.subfeature_count;
+		sensors_add_proc_chips(&chip->features);
+		/* The tables now belong to sensors_proc_chips */
+		chip->features.chip.path = NULL;
+		chip->features.feature = NULL;
+	}
+}
+
+void sensors_trace_add_busses(void)
+{
+	int i;
+
+	for (i = 0; i < trace_busses_count; i++)
+		sensors_add_proc_bus(&trace_busses[i]);
+	sensors_free(trace_busses);
+	trace_busses = NULL;
+	trace_busses_count = trace_busses_max = 0;
+}
+
+/* The index of the last sample taken at or before t, 0 if none */
+static int find_sample(const struct trace_series *series,
+		       unsigned long long t)
+{
+	int lo = 0, hi = series->count - 1, mid;
+
+	while (lo < hi) {
+		mid = lo + (hi - lo + 1) / 2;
+		if (series->samples[mid].t <= t)
+			lo = mid;
+		else
+			hi = mid - 1;
+	}
+	return lo;
+}
+
+/* Without speed, each read of an attribute gets the next value it had,
+   whatever the timing: replays are deterministic. With a speed, a read
+   gets the value the attribute had at the same time in the trace, time
+   running speed times faster. Either way, the last value sticks once the
+   trace is exhausted. */
+int sensors_trace_get_value(const sensors_chip_features *chip,
+			    const sensors_subfeature *subfeature,
+			    double *value)
+{
+	struct trace_series *series;
+	const struct trace_sample *sample;
+	int i;
+
+	series = trace_chips[chip - sensors_proc_chips].series;
+	if (!series || !(series += subfeature->number)->count)
+		return -SENSORS_ERR_KERNEL;	/* Never read */
+
+	if (trace_speed) {
+		i = find_sample(series, (sensors_monotonic_ns() - trace_begin) *
+				trace_speed);
+	} else {
+		i = __atomic_load_n(&series->next, __ATOMIC_RELAXED);
+		while (i < series->count - 1 &&
+		       !__atomic_compare_exchange_n(&series->next, &i, i + 1, 0,
+						    __ATOMIC_RELAXED,
+						    __ATOMIC_RELAXED))
+			;
+	}
+
+	sample = &series->samples[i];
+	if (!sample->err)
+		*value = sample->value;
+	return sample->err;
+}
+
+char *sensors_trace_get_label(const sensors_chip_features *chip,
+			      const sensors_feature *feature)
+{
+	char **labels = trace_chips[chip - sensors_proc_chips].labels;
+
+	return labels ? labels[feature->number] : NULL;
+}
+
+void sensors_trace_cleanup(void)
+{
+	struct trace_chip *chip;
+	int i, j;
+
+	if (trace_file) {
+		fclose(trace_file);
+		trace_file = NULL;
+	}
+
+	for (i = 0; i < trace_chips_count; i++) {
+		chip = &trace_chips[i];
+		if (chip->series)
+			for (j = 0; j < chip->features.subfeature_count; j++)
+				sensors_free(chip->series[j].samples);
+		sensors_free(chip->series);
+		sensors_free(chip->labels);
+		sensors_free(chip->features.chip.path);
+		sensors_free(chip->features.feature);
+	}
+	sensors_free(trace_chips);
+	trace_chips = NULL;
+	trace_chips_count = trace_chips_max = 0;
+
+	for (i = 0; i < trace_busses_count; i++)
+		sensors_free(trace_busses[i].adapter);
+	sensors_free(trace_busses);
+	trace_busses = NULL;
+	trace_busses_count = trace_busses_max = 0;
+
+	sensors_trace_mode = SENSORS_TRACE_OFF;
+}
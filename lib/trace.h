@@ -0,0 +1,58 @@
+/*
+    trace.h - Part of libsensors, a Linux library for reading sensor data.
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+    MA 02110-1301 USA.
+*/
+
+#ifndef LIB_SENSORS_TRACE_H
+#define LIB_SENSORS_TRACE_H
+
+#include "data.h"
+
+#define SENSORS_TRACE_OFF	0
+#define SENSORS_TRACE_RECORD	1
+#define SENSORS_TRACE_REPLAY	2
+
+/* Only changes while the library isn't initialized */
+extern int sensors_trace_mode;
+
+/* Called by sensors_init(), before the chips are detected, and by
+   sensors_cleanup(), which ends the trace */
+void sensors_trace_start(void);
+void sensors_trace_cleanup(void);
+
+/* Record mode: log a detected chip, once added to sensors_proc_chips,
+   its features once enumerated, the i2c adapters once enumerated, and
+   the result of each attribute read */
+void sensors_trace_chip(const sensors_chip_features *chip);
+void sensors_trace_features(const sensors_chip_features *chip);
+void sensors_trace_busses(void);
+void sensors_trace_read(const sensors_chip_features *chip,
+			const sensors_subfeature *subfeature, int err,
+			const double *value);
+
+/* Replay mode: add the chips and the i2c adapters of the trace, get the
+   next value of an attribute, and the label of a feature (NULL if it
+   has none) */
+void sensors_trace_add_chips(void);
+void sensors_trace_add_busses(void);
+int sensors_trace_get_value(const sensors_chip_features *chip,
+			    const sensors_subfeature *subfeature,
+			    double *value);
+char *sensors_trace_get_label(const sensors_chip_features *chip,
+			      const sensors_feature *feature);
+
+#endif /* def LIB_SENSORS_TRACE_H */
@@ -0,0 +1,333 @@
+/*
+    uring.c - Part of libsensors, a Linux library for reading sensor data.
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+    MA 02110-1301 USA.
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include "sensors.h"
+#include "error.h"
+#include "alloc.h"
+#include "uring.h"
+
+/* Batched reads through io_uring, using the raw system calls so that
+   we don't depend on liburing. Reads of sysfs attributes can't be done
+   without blocking, so the kernel hands them to its worker threads, and
+   slow chips are read in parallel rather than one after the other.
+   There is a single ring, used by one batch at a time. When it is busy
+   or the kernel lacks io_uring, callers fall back to plain reads. */
+
+#if defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#define HAVE_IO_URING	1
+#endif
+#endif
+
+#if defined(HAVE_IO_URING) && defined(__NR_io_uring_setup)
+#include <linux/io_uring.h>
+
+#define URING_ENTRIES	64
+
+static struct {
+	int fd;
+	unsigned *sq_head, *sq_tail, *sq_mask, *sq_array;
+	unsigned *cq_head, *cq_tail, *cq_mask;
+	struct io_uring_sqe *sqes;
+	struct io_uring_cqe *cqes;
+	void *sq_ring, *cq_ring;
+	size_t sq_ring_size, cq_ring_size, sqes_size;
+	unsigned sq_entries;
+	int files;		/* Size of the registered file table */
+} ring = { .fd = -1 };
+
+/* 0 if not set up yet, 1 if usable, -1 if unavailable */
+static int ring_state;
+static pthread_mutex_t ring_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* Called with ring_lock held */
+static int uring_setup(void)
+{
+	struct io_uring_params p;
+	char *sq, *cq;
+
+	if (ring_state)
+		return ring_state;
+	ring_state = -1;
+
+	memset(&p, 0, sizeof(p));
+	ring.fd = syscall(__NR_io_uring_setup, URING_ENTRIES, &p);
+	if (ring.fd < 0)
+		return ring_state;
+
+	ring.sq_ring_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+	ring.cq_ring_size = p.cq_off.cqes +
+			    p.cq_entries * sizeof(struct io_uring_cqe);
+	if (p.features & IORING_FEAT_SINGLE_MMAP) {
+		if (ring.cq_ring_size > ring.sq_ring_size)
+			ring.sq_ring_size = ring.cq_ring_size;
+		ring.cq_ring_size = 0;
+	}
+	ring.sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+
+	ring.sq_ring = mmap(NULL, ring.sq_ring_size, PROT_READ | PROT_WRITE,
+			    MAP_SHARED | MAP_POPULATE, ring.fd,
+			    IORING_OFF_SQ_RING);
+	if (ring.sq_ring == MAP_FAILED)
+		goto exit_close;
+	if (ring.cq_ring_size) {
+		ring.cq_ring = mmap(NULL, ring.cq_ring_size,
+				    PROT_READ | PROT_WRITE,
+				    MAP_SHARED | MAP_POPULATE, ring.fd,
+				    IORING_OFF_CQ_RING);
+		if (ring.cq_ring == MAP_FAILED)
+			goto exit_unmap_sq;
+	} else
+		ring.cq_ring = ring.sq_ring;
+	ring.sqes = mmap(NULL, ring.sqes_size, PROT_READ | PROT_WRITE,
+			 MAP_SHARED | MAP_POPULATE, ring.fd, IORING_OFF_SQES);
+	if (ring.sqes == MAP_FAILED)
+		goto exit_unmap_cq;
+
+	sq = ring.sq_ring;
+	ring.sq_head = (unsigned *)(sq + p.sq_off.head);
+	ring.sq_tail = (unsigned *)(sq + p.sq_off.tail);
+	ring.sq_mask = (unsigned *)(sq + p.sq_off.ring_mask);
+	ring.sq_array = (unsigned *)(sq + p.sq_off.array);
+	ring.sq_entries = p.sq_entries;
+	cq = ring.cq_ring;
+	ring.cq_head = (unsigned *)(cq + p.cq_off.head);
+	ring.cq_tail = (unsigned *)(cq + p.cq_off.tail);
+	ring.cq_mask = (unsigned *)(cq + p.cq_off.ring_mask);
+	ring.cqes = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+
+	ring_state = 1;
+	return ring_state;
+
+exit_unmap_cq:
+	if (ring.cq_ring_size)
+		munmap(ring.cq_ring, ring.cq_ring_size);
+exit_unmap_sq:
+	munmap(ring.sq_ring, ring.sq_ring_size);
+exit_close:
+	close(ring.fd);
+	ring.fd = -1;
+	return ring_state;
+}
+
+/* Called with ring_lock held, on a usable ring */
+static void uring_teardown(void)
+{
+	munmap(ring.sqes, ring.sqes_size);
+	if (ring.cq_ring_size)
+		munmap(ring.cq_ring, ring.cq_ring_size);
+	munmap(ring.sq_ring, ring.sq_ring_size);
+	close(ring.fd);
+	ring.fd = -1;
+	ring.files = 0;
+}
+
+int sensors_uring_register(int slot, int fd, int slots)
+{
+	struct io_uring_files_update update;
+	int *table, i, ret = -1;
+
+	pthread_mutex_lock(&ring_lock);
+	if (uring_setup() < 0)
+		goto exit_unlock;
+
+	if (!ring.files) {
+		/* Sparse table, filled as files get opened */
+		table = sensors_malloc(slots * sizeof(int));
+		if (!table)
+			sensors_fatal_error(__func__, "Out of memory");
+		for (i = 0; i < slots; i++)
+			table[i] = -1;
+		if (syscall(__NR_io_uring_register, ring.fd,
+			    IORING_REGISTER_FILES, table, slots) == 0)
+			ring.files = slots;
+		else
+			ring.files = -1;	/* Don't try again */
+		sensors_free(table);
+	}
+	if (slot >= ring.files)
+		goto exit_unlock;
+
+	memset(&update, 0, sizeof(update));
+	update.offset = slot;
+	update.fds = (unsigned long)&fd;
+	if (syscall(__NR_io_uring_register, ring.fd,
+		    IORING_REGISTER_FILES_UPDATE, &update, 1) == 1)
+		ret = slot;
+
+exit_unlock:
+	pthread_mutex_unlock(&ring_lock);
+	return ret;
+}
+
+void sensors_uring_unregister(int slot)
+{
+	struct io_uring_files_update update;
+	int fd = -1;
+
+	pthread_mutex_lock(&ring_lock);
+	if (ring_state > 0 && slot >= 0 && slot < ring.files) {
+		memset(&update, 0, sizeof(update));
+		update.offset = slot;
+		update.fds = (unsigned long)&fd;
+		syscall(__NR_io_uring_register, ring.fd,
+			IORING_REGISTER_FILES_UPDATE, &update, 1);
+	}
+	pthread_mutex_unlock(&ring_lock);
+}
+
+/* Marks the reads which did not complete */
+#define READ_PENDING	INT_MIN
+
+int sensors_uring_read(struct sensors_uring_read *reads, int count)
+{
+	struct io_uring_sqe *sqe;
+	struct io_uring_cqe *cqe;
+	unsigned tail, head;
+	int queued = 0, done = 0, err = 0, i, ret;
+
+	if (pthread_mutex_trylock(&ring_lock))
+		return -1;
+	if (uring_setup() < 0) {
+		pthread_mutex_unlock(&ring_lock);
+		return -1;
+	}
+
+	for (i = 0; i < count; i++)
+		reads[i].res = READ_PENDING;
+
+	while (done < queued || (!err && queued < count)) {
+		/* Queue as many reads as the ring has room for. We never
+		   have more than sq_entries reads in flight, so the
+		   completion ring (twice as large) can't overflow. */
+		tail = *ring.sq_tail;
+		head = __atomic_load_n(ring.sq_head, __ATOMIC_ACQUIRE);
+		while (!err && queued < count &&
+		       queued - done < (int)ring.sq_entries &&
+		       tail - head < ring.sq_entries) {
+			sqe = &ring.sqes[tail & *ring.sq_mask];
+			memset(sqe, 0, sizeof(*sqe));
+			sqe->opcode = IORING_OP_READV;
+			if (reads[queued].slot >= 0) {
+				sqe->flags = IOSQE_FIXED_FILE;
+				sqe->fd = reads[queued].slot;
+			} else
+				sqe->fd = reads[queued].fd;
+			sqe->addr = (unsigned long)&reads[queued].iov;
+			sqe->len = 1;
+			sqe->user_data = queued;
+			ring.sq_array[tail & *ring.sq_mask] =
+				tail & *ring.sq_mask;
+			tail++;
+			queued++;
+		}
+		__atomic_store_n(ring.sq_tail, tail, __ATOMIC_RELEASE);
+
+		ret = syscall(__NR_io_uring_enter, ring.fd,
+			      err ? 0 : tail - head, 1,
+			      IORING_ENTER_GETEVENTS, NULL, 0);
+		if (ret < 0 && errno != EINTR && errno != EAGAIN &&
+		    errno != EBUSY) {
+			/* Should not happen. Stop queuing, and take back
+			   the reads the kernel didn't consume, but wait for
+			   those in flight, they use our buffers. */
+			if (!err) {
+				err = -errno;
+				head = __atomic_load_n(ring.sq_head,
+						       __ATOMIC_ACQUIRE);
+				queued -= tail - head;
+				__atomic_store_n(ring.sq_tail, head,
+						 __ATOMIC_RELEASE);
+			} else {
+				/* The kernel still posts the completions,
+				   we just can't sleep until they come */
+				usleep(1000);
+			}
+		}
+
+		/* Harvest whatever completed */
+		head = *ring.cq_head;
+		while (head != __atomic_load_n(ring.cq_tail,
+					       __ATOMIC_ACQUIRE)) {
+			cqe = &ring.cqes[head & *ring.cq_mask];
+			reads[cqe->user_data].res = cqe->res;
+			head++;
+			done++;
+		}
+		__atomic_store_n(ring.cq_head, head, __ATOMIC_RELEASE);
+	}
+
+	/* Don't use a ring which failed us again */
+	if (err) {
+		uring_teardown();
+		ring_state = -1;
+	}
+	pthread_mutex_unlock(&ring_lock);
+
+	/* Nothing read, the caller can still do it */
+	if (err && !done)
+		return -1;
+
+	for (i = 0; i < count; i++)
+		if (reads[i].res == READ_PENDING)
+			reads[i].res = err;
+	return 0;
+}
+
+void sensors_uring_cleanup(void)
+{
+	pthread_mutex_lock(&ring_lock);
+	if (ring_state > 0)
+		uring_teardown();
+	ring_state = 0;
+	pthread_mutex_unlock(&ring_lock);
+}
+
+#else /* No io_uring */
+
+int sensors_uring_register(int slot, int fd, int slots)
+{
+	(void)slot; (void)fd; (void)slots; /* hide warning */
+	return -1;
+}
+
+void sensors_uring_unregister(int slot)
+{
+	(void)slot; /* hide warning */
+}
+
+int sensors_uring_read(struct sensors_uring_read *reads, int count)
+{
+	(void)reads; (void)count; /* hide warning */
+	return -1;
+}
+
+void sensors_uring_cleanup(void)
+{
+}
+
+#endif
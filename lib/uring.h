@@ -0,0 +1,52 @@
+/*
+    uring.h - Part of libsensors, a Linux library for reading sensor data.
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+    MA 02110-1301 USA.
+*/
+
+#ifndef LIB_SENSORS_URING_H
+#define LIB_SENSORS_URING_H
+
+#include <sys/uio.h>
+
+/* One read from the start of a file. slot is the index of fd in the
+   registered file table, or -1 if it isn't registered. res is set to
+   the number of bytes read, or a negative errno value. */
+struct sensors_uring_read {
+	int fd;
+	int slot;
+	struct iovec iov;
+	int res;
+};
+
+/* Perform all reads through io_uring, waiting for all of them to
+   complete. Returns 0 on success, or -1 if io_uring is not available,
+   busy or failed before reading anything, in which case nothing was done
+   and the caller should read synchronously. A ring which fails is torn
+   down, and not used again until sensors_uring_cleanup(). */
+int sensors_uring_read(struct sensors_uring_read *reads, int count);
+
+/* Register fd in slot of the file table, which has room for slots
+   entries. Returns the slot, or -1 if the file can't be registered. */
+int sensors_uring_register(int slot, int fd, int slots);
+
+/* Empty a slot of the file table, so that the file it held can close */
+void sensors_uring_unregister(int slot);
+
+/* Tear down the ring */
+void sensors_uring_cleanup(void);
+
+#endif /* def LIB_SENSORS_URING_H */
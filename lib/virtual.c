@@ -0,0 +1,294 @@
+/*
+    virtual.c - Part of libsensors, a Linux library for reading sensor data.
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+    MA 02110-1301 USA.
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include <fnmatch.h>
+#include <pthread.h>
+#include "sensors.h"
+#include "data.h"
+#include "error.h"
+#include "alloc.h"
+#include "general.h"
+#include "access.h"
+#include "sysfs.h"
+#include "virtual.h"
+
+/* Virtual chips are declared in the configuration, and their subfeatures
+   computed from those of the detected chips, typically the hottest of
+   all cores or the power drawn by all supplies. They come after the
+   detected chips in sensors_proc_chips, so they have features, compute
+   nodes and counters like any other chip; only reads differ: the value
+   of a virtual subfeature is that of the expression of its feature
+   statement, evaluated over a snapshot holding its inputs, see
+   get_values(). */
+
+struct virtual_subfeature {
+	const sensors_expr *expr;
+	sensors_virtual_aggregate *aggregates;
+	int aggregates_count;
+	int aggregates_max;
+};
+
+struct virtual_chip {
+	struct virtual_subfeature *subfeatures;	/* One per subfeature */
+	int resolved;			/* Inputs looked up */
+};
+
+static struct virtual_chip *virtual_chips;
+static int virtual_first;		/* Index of the first virtual chip */
+static int virtual_count;
+static int virtual_max;
+static pthread_mutex_t resolve_lock = PTHREAD_MUTEX_INITIALIZER;
+
+int sensors_chip_is_virtual(const sensors_chip_features *chip)
+{
+	int nr = chip - sensors_proc_chips;
+
+	return nr >= virtual_first && nr < virtual_first + virtual_count;
+}
+
+static struct virtual_chip *get_virtual_chip(const sensors_chip_features *chip)
+{
+	return &virtual_chips[chip - sensors_proc_chips - virtual_first];
+}
+
+/* Add the aggregates of expr, in the order they appear */
+static void add_aggregates(struct virtual_subfeature *vsf,
+			   const sensors_expr *expr)
+{
+	sensors_virtual_aggregate aggregate;
+
+	switch (expr->kind) {
+	case sensors_kind_aggregate:
+		memset(&aggregate, 0, sizeof(aggregate));
+		aggregate.expr = expr;
+		sensors_add_array_el(&aggregate, &vsf->aggregates,
+				     &vsf->aggregates_count,
+				     &vsf->aggregates_max,
+				     sizeof(sensors_virtual_aggregate));
+		return;
+	case sensors_kind_sub:
+		add_aggregates(vsf, expr->data.subexpr.sub1);
+		if (expr->data.subexpr.sub2)
+			add_aggregates(vsf, expr->data.subexpr.sub2);
+		return;
+	default:
+		return;
+	}
+}
+
+/* Find the last feature statement for subfeature name among the blocks
+   of virtual chip name */
+static const sensors_virtual_feature *
+lookup_feature(const sensors_chip_name *name, const char *sfname)
+{
+	const sensors_chip *block;
+	int i, j;
+
+	for (i = sensors_config_chips_count - 1; i >= 0; i--) {
+		block = &sensors_config_chips[i];
+		if (!block->virtual ||
+		    strcmp(block->chips.fits[0].prefix, name->prefix))
+			continue;
+		for (j = block->features_count - 1; j >= 0; j--)
+			if (!strcmp(block->features[j].name, sfname))
+				return &block->features[j];
+	}
+	return NULL;
+}
+
+/* All the blocks of the same name make one chip, and the last feature
+   statement of a subfeature wins, so the names are collected last
+   first */
+static void add_virtual_chip(const sensors_chip_name *name)
+{
+	const sensors_chip *block;
+	sensors_chip_features entry;
+	struct virtual_chip vchip;
+	char **names = NULL;
+	int names_count = 0, names_max = 0;
+	int i, j;
+	char *sfname;
+
+	for (i = sensors_config_chips_count - 1; i >= 0; i--) {
+		block = &sensors_config_chips[i];
+		if (!block->virtual ||
+		    strcmp(block->chips.fits[0].prefix, name->prefix))
+			continue;
+		for (j = block->features_count - 1; j >= 0; j--) {
+			sfname = sensors_intern_string(block->features[j].name,
+					strlen(block->features[j].name));
+			sensors_add_array_el(&sfname, &names, &names_count,
+					     &names_max, sizeof(char *));
+		}
+	}
+
+	memset(&entry, 0, sizeof(entry));
+	sensors_set_virtual_features(&entry, names, names_count);
+	sensors_free(names);
+	if (!entry.subfeature)	/* No feature statement */
+		return;
+
+	entry.chip = *name;
+	entry.chip.prefix = sensors_intern_string(name->prefix,
+						  strlen(name->prefix));
+	entry.chip.bus.nr = 0;
+	entry.chip.path = NULL;
+	entry.subfeature_base = sensors_proc_subfeatures_count;
+	sensors_proc_subfeatures_count += entry.subfeature_count;
+	entry.loaded = 1;
+	sensors_add_proc_chips(&entry);
+
+	vchip.resolved = 0;
+	vchip.subfeatures = sensors_calloc(entry.subfeature_count,
+					   sizeof(struct virtual_subfeature));
+	if (!vchip.subfeatures)
+		sensors_fatal_error(__func__, "Out of memory");
+	for (i = 0; i < entry.subfeature_count; i++) {
+		vchip.subfeatures[i].expr =
+			lookup_feature(name, entry.subfeature[i].name)->value;
+		add_aggregates(&vchip.subfeatures[i],
+			       vchip.subfeatures[i].expr);
+	}
+	sensors_add_array_el(&vchip, &virtual_chips, &virtual_count,
+			     &virtual_max, sizeof(struct virtual_chip));
+}
+
+void sensors_add_virtual_chips(void)
+{
+	const sensors_chip *block;
+	int i, j, seen;
+
+	virtual_first = sensors_proc_chips_count;
+	virtual_count = 0;
+
+	for (i = 0; i < sensors_config_chips_count; i++) {
+		block = &sensors_config_chips[i];
+		if (!block->virtual)
+			continue;
+		for (seen = 0, j = 0; !seen && j < i; j++)
+			seen = sensors_config_chips[j].virtual &&
+			       !strcmp(sensors_config_chips[j].chips.fits[0].prefix,
+				       block->chips.fits[0].prefix);
+		if (!seen)
+			add_virtual_chip(&block->chips.fits[0]);
+	}
+}
+
+void sensors_virtual_cleanup(void)
+{
+	struct virtual_subfeature *vsf;
+	int i, j, k;
+
+	for (i = 0; i < virtual_count; i++) {
+		for (j = 0; j < sensors_proc_chips[virtual_first + i].
+						subfeature_count; j++) {
+			vsf = &virtual_chips[i].subfeatures[j];
+			for (k = 0; k < vsf->aggregates_count; k++)
+				sensors_free(vsf->aggregates[k].inputs);
+			sensors_free(vsf->aggregates);
+		}
+		sensors_free(virtual_chips[i].subfeatures);
+	}
+	sensors_free(virtual_chips);
+	virtual_chips = NULL;
+	virtual_first = virtual_count = virtual_max = 0;
+}
+
+const sensors_expr *
+sensors_get_virtual_expr(const sensors_chip_features *chip, int subfeat_nr)
+{
+	return get_virtual_chip(chip)->subfeatures[subfeat_nr].expr;
+}
+
+/* The inputs are the readable subfeatures matching the pattern, of the
+   detected chips matching the chip name */
+static void resolve_aggregate(sensors_virtual_aggregate *aggregate)
+{
+	const sensors_aggregate *a = &aggregate->expr->data.aggregate;
+	sensors_chip_features *chip;
+	sensors_virtual_input input;
+	int i, j;
+
+	for (i = 0; i < virtual_first; i++) {
+		chip = &sensors_proc_chips[i];
+		if (!sensors_match_chip(&chip->chip, &a->chip))
+			continue;
+		sensors_load_chip(chip);
+		for (j = 0; j < chip->subfeature_count; j++) {
+			if (!(chip->subfeature[j].flags & SENSORS_MODE_R) ||
+			    fnmatch(a->pattern, chip->subfeature[j].name, 0))
+				continue;
+			input.chip = chip;
+			input.subfeature = &chip->subfeature[j];
+			sensors_add_array_el(&input, &aggregate->inputs,
+					     &aggregate->inputs_count,
+					     &aggregate->inputs_max,
+					     sizeof(sensors_virtual_input));
+		}
+	}
+}
+
+static void resolve_chip(const sensors_chip_features *chip)
+{
+	struct virtual_chip *vchip = get_virtual_chip(chip);
+	struct virtual_subfeature *vsf;
+	int i, j;
+
+	pthread_mutex_lock(&resolve_lock);
+	if (!vchip->resolved) {
+		for (i = 0; i < chip->subfeature_count; i++) {
+			vsf = &vchip->subfeatures[i];
+			for (j = 0; j < vsf->aggregates_count; j++)
+				resolve_aggregate(&vsf->aggregates[j]);
+		}
+		__atomic_store_n(&vchip->resolved, 1, __ATOMIC_RELEASE);
+	}
+	pthread_mutex_unlock(&resolve_lock);
+}
+
+int sensors_get_virtual_aggregates(const sensors_chip_features *chip,
+				   int subfeat_nr,
+				   const sensors_virtual_aggregate **aggregates)
+{
+	struct virtual_chip *vchip = get_virtual_chip(chip);
+
+	if (!__atomic_load_n(&vchip->resolved, __ATOMIC_ACQUIRE))
+		resolve_chip(chip);
+	*aggregates = vchip->subfeatures[subfeat_nr].aggregates;
+	return vchip->subfeatures[subfeat_nr].aggregates_count;
+}
+
+const sensors_virtual_aggregate *
+sensors_lookup_virtual_aggregate(const sensors_chip_features *chip,
+				 const sensors_expr *expr)
+{
+	struct virtual_chip *vchip = get_virtual_chip(chip);
+	struct virtual_subfeature *vsf;
+	int i, j;
+
+	for (i = 0; i < chip->subfeature_count; i++) {
+		vsf = &vchip->subfeatures[i];
+		for (j = 0; j < vsf->aggregates_count; j++)
+			if (vsf->aggregates[j].expr == expr)
+				return &vsf->aggregates[j];
+	}
+	return NULL;
+}
@@ -0,0 +1,66 @@
+/*
+    virtual.h - Part of libsensors, a Linux library for reading sensor data.
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+    MA 02110-1301 USA.
+*/
+
+#ifndef LIB_SENSORS_VIRTUAL_H
+#define LIB_SENSORS_VIRTUAL_H
+
+#include "data.h"
+
+/* A subfeature an aggregate is computed from */
+typedef struct sensors_virtual_input {
+	const sensors_chip_features *chip;
+	const sensors_subfeature *subfeature;
+} sensors_virtual_input;
+
+/* An aggregate of the expression of a virtual subfeature, and the
+   subfeatures it is computed from */
+typedef struct sensors_virtual_aggregate {
+	const sensors_expr *expr;
+	sensors_virtual_input *inputs;
+	int inputs_count;
+	int inputs_max;
+} sensors_virtual_aggregate;
+
+/* Add a chip for each virtual chip block of the configuration, after the
+   detected chips, which are then known. Called by sensors_init() once
+   the configuration is loaded, and by sensors_cleanup(). */
+void sensors_add_virtual_chips(void);
+void sensors_virtual_cleanup(void);
+
+int sensors_chip_is_virtual(const sensors_chip_features *chip);
+
+/* The expression of the feature statement of a virtual subfeature */
+const sensors_expr *
+sensors_get_virtual_expr(const sensors_chip_features *chip, int subfeat_nr);
+
+/* The aggregates of the expression of a virtual subfeature. The inputs
+   of all the aggregates of a chip are looked up when it is first read,
+   which enumerates the features of the chips they belong to. Returns the
+   number of aggregates. */
+int sensors_get_virtual_aggregates(const sensors_chip_features *chip,
+				   int subfeat_nr,
+				   const sensors_virtual_aggregate **aggregates);
+
+/* Find the aggregate of a virtual chip whose expression is expr, once
+   the inputs are looked up. Returns NULL if not found. */
+const sensors_virtual_aggregate *
+sensors_lookup_virtual_aggregate(const sensors_chip_features *chip,
+				 const sensors_expr *expr);
+
+#endif /* def LIB_SENSORS_VIRTUAL_H */
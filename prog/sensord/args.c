@@ -25,6 +25,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <getopt.h>
+#include <limits.h>
 #include <syslog.h>
 
 #include "args.h"
@@ -34,26 +35,33 @@
 
 struct sensord_arguments sensord_args = {
  	.pidFile = "/var/run/sensord.pid",
- 	.scanTime = 60,
- 	.logTime = 30 * 60,
- 	.rrdTime = 5 * 60,
+ 	.scanTime = 60 * 1000,
+ 	.logTime = 30 * 60 * 1000,
+ 	.rrdTime = 5 * 60 * 1000,
+ 	.readDeadline = 1000,
  	.syslogFacility = LOG_DAEMON,
 };
 
+/* Return the time in milliseconds */
 static int parseTime(char *arg)
 {
 	char *end;
-	int value = strtoul(arg, &end, 10);
-	if ((end > arg) && (*end == 's')) {
+	unsigned long long value = strtoul(arg, &end, 10);
+	if ((end > arg) && !strncmp(end, "ms", 2)) {
+		end += 2;
+	} else if ((end > arg) && (*end == 's')) {
+		value *= 1000;
 		++ end;
 	} else if ((end > arg) && (*end == 'm')) {
-		value *= 60;
+		value *= 60 * 1000;
 		++ end;
 	} else if ((end > arg) && (*end == 'h')) {
-		value *= 60 * 60;
+		value *= 60 * 60 * 1000;
 		++ end;
+	} else {
+		value *= 1000;
 	}
-	if ((end == arg) || *end) {
+	if ((end == arg) || *end || (value > INT_MAX)) {
 		fprintf(stderr, "Error parsing time value `%s'.\n", arg);
 		return -1;
 	}
@@ -94,6 +102,7 @@ static const char *daemonSyntax =
 	"  -l, --log-interval <time> -- interval between logging sensors (default 30m)\n"
 	"  -t, --rrd-interval <time> -- interval between updating RRD file (default 5m)\n"
 	"  -T, --rrd-no-average      -- switch RRD in non-average mode\n"
+	"  -D, --read-deadline <t>   -- time a chip has to be read in (default 1s)\n"
 	"  -r, --rrd-file <file>     -- RRD file (default <none>)\n"
 	"  -c, --config-file <file>  -- configuration file\n"
 	"  -p, --pid-file <file>     -- PID file (default /var/run/sensord.pid)\n"
@@ -104,6 +113,8 @@ static const char *daemonSyntax =
 	"  -v, --version             -- display version and exit\n"
 	"  -h, --help                -- display help and exit\n"
 	"\n"
+	"Times are in seconds, or have a suffix ms, s, m or h; for example 500ms.\n"
+	"\n"
 	"Specify a value of 0 for any interval to disable that operation;\n"
 	"for example, specify --log-interval 0 to only scan for alarms."
 	"\n"
@@ -116,13 +127,14 @@ static const char *daemonSyntax =
 	"the RRD file configuration must EXACTLY match the sensors that are used. If\n"
 	"your configuration changes, delete the old RRD file and restart sensord.\n";
 
-static const char *shortOptions = "i:l:t:Tf:r:c:p:advhg:";
+static const char *shortOptions = "i:l:t:TD:f:r:c:p:advhg:";
 
 static const struct option longOptions[] = {
 	{ "interval", required_argument, NULL, 'i' },
 	{ "log-interval", required_argument, NULL, 'l' },
 	{ "rrd-interval", required_argument, NULL, 't' },
 	{ "rrd-no-average", no_argument, NULL, 'T' },
+	{ "read-deadline", required_argument, NULL, 'D' },
 	{ "syslog-facility", required_argument, NULL, 'f' },
 	{ "rrd-file", required_argument, NULL, 'r' },
 	{ "config-file", required_argument, NULL, 'c' },
@@ -164,6 +176,15 @@ int parseArgs(int argc, char **argv)
 		case 'T':
 			sensord_args.rrdNoAverage = 1;
 			break;
+		case 'D':
+			if ((sensord_args.readDeadline = parseTime(optarg)) < 0)
+				return -1;
+			if (!sensord_args.readDeadline) {
+				fprintf(stderr,
+					"Error: --read-deadline can't be 0.\n");
+				return -1;
+			}
+			break;
 		case 'f':
 			sensord_args.syslogFacility = parseFacility(optarg);
 			if (sensord_args.syslogFacility < 0)
@@ -219,6 +240,13 @@ int parseArgs(int argc, char **argv)
 		return -1;
 	}
 
+	/* The RRD step is a number of seconds */
+	if (sensord_args.rrdFile && sensord_args.rrdTime % 1000) {
+		fprintf(stderr,
+			"Error: --rrd-interval must be whole seconds.\n");
+		return -1;
+	}
+
 	if (!sensord_args.logTime && !sensord_args.scanTime &&
 	    !sensord_args.rrdFile) {
 		fprintf(stderr,
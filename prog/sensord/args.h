@@ -11,9 +11,10 @@ struct sensord_arguments {
 	const char *pidFile;
 	const char *rrdFile;
 	const char *cgiDir;
-	int scanTime;
-	int logTime;
-	int rrdTime;
+	int scanTime;		/* ms */
+	int logTime;		/* ms */
+	int rrdTime;		/* ms */
+	int readDeadline;	/* ms */
 	int rrdNoAverage;
 	int syslogFacility;
 	int doScan;
@@ -367,6 +367,9 @@ static FeatureDescriptor * generateChipFeatures(const sensors_chip_name *chip)
 		}
 
 		features[count].feature = sensor;
+		features[count].interval = sensors_get_interval(chip, sensor);
+		if (features[count].interval < 0)
+			features[count].interval = 0;
 		count++;
 	}
 
@@ -82,23 +82,34 @@ int loadLib(const char *cfgPath)
 {
 	int ret;
 	ret = loadConfig(cfgPath, 0);
-	if (!ret)
+	if (!ret) {
+		/* Limits are read once, and alarms only when crossed */
+		sensors_cache_set_flags(SENSORS_CACHE_SOFT_ALARMS);
 		ret = initKnownChips();
+		if (!ret)
+			ret = initReadGroups();
+	}
 	return ret;
 }
 
 int reloadLib(const char *cfgPath)
 {
 	int ret;
+	freeReadGroups();
 	freeKnownChips();
 	ret = loadConfig(cfgPath, 1);
-	if (!ret)
+	if (!ret) {
+		sensors_cache_set_flags(SENSORS_CACHE_SOFT_ALARMS);
 		ret = initKnownChips();
+		if (!ret)
+			ret = initReadGroups();
+	}
 	return ret;
 }
 
 int unloadLib(void)
 {
+	freeReadGroups();
 	freeKnownChips();
 	sensors_cleanup();
 	return 0;
@@ -0,0 +1,184 @@
+/*
+ * sensord
+ *
+ * A daemon that periodically logs sensor information to syslog.
+ *
+ * Copyright (c) 1999-2002 Merlin Hughes <merlin@merlin.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301 USA.
+ */
+
+/*
+ * The worker pool runs jobs in the background, so that the main loop
+ * never waits on a read for longer than it chooses to. Workers are
+ * started as jobs find none idle, up to MAX_WORKERS; a job which never
+ * returns only ties up its own worker.
+ */
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <syslog.h>
+
+#include "sensord.h"
+
+#define MAX_WORKERS 16
+
+typedef struct {
+	PoolFN fn;
+	void *data;
+	int nr;
+} Job;
+
+typedef struct {
+	pthread_t thread;
+	int busy;
+} Worker;
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t work = PTHREAD_COND_INITIALIZER;
+
+/* All protected by lock */
+static Worker *workers;
+static int workerCount, workerMax;
+static int idleCount;
+static Job *queue;
+static int queueHead, queueCount, queueMax;
+static int exiting;
+
+static void *worker(void *arg)
+{
+	int nr = (long)arg;
+	Job job;
+
+	pthread_mutex_lock(&lock);
+	for (;;) {
+		while (!exiting && queueHead == queueCount) {
+			idleCount++;
+			pthread_cond_wait(&work, &lock);
+			idleCount--;
+		}
+		if (exiting)
+			break;
+
+		job = queue[queueHead++];
+		if (queueHead == queueCount)
+			queueHead = queueCount = 0;
+		workers[nr].busy = 1;
+		pthread_mutex_unlock(&lock);
+		job.fn(job.data, job.nr);
+		pthread_mutex_lock(&lock);
+		workers[nr].busy = 0;
+	}
+	pthread_mutex_unlock(&lock);
+	return NULL;
+}
+
+/* Start a worker, with lock held. Returns 0 on success. */
+static int addWorker(void)
+{
+	Worker *grown;
+	int err;
+
+	if (workerCount == workerMax) {
+		grown = realloc(workers, MAX_WORKERS * sizeof(Worker));
+		if (!grown) {
+			sensorLog(LOG_ERR, "Out of memory");
+			return -1;
+		}
+		workers = grown;
+		workerMax = MAX_WORKERS;
+	}
+
+	workers[workerCount].busy = 0;
+	err = pthread_create(&workers[workerCount].thread, NULL, worker,
+			     (void *)(long)workerCount);
+	if (err) {
+		sensorLog(LOG_ERR, "Error starting worker: %s", strerror(err));
+		return -1;
+	}
+	workerCount++;
+	return 0;
+}
+
+void poolSubmit(PoolFN fn, void *data, int nr)
+{
+	Job *grown;
+
+	pthread_mutex_lock(&lock);
+	if (queueCount == queueMax) {
+		int max = queueMax ? 2 * queueMax : 16;
+
+		grown = realloc(queue, max * sizeof(Job));
+		if (!grown) {
+			sensorLog(LOG_ERR, "Out of memory");
+			goto runHere;
+		}
+		queue = grown;
+		queueMax = max;
+	}
+
+	if (queueCount - queueHead >= idleCount &&
+	    workerCount < MAX_WORKERS && addWorker() && !workerCount)
+		goto runHere;
+
+	queue[queueCount].fn = fn;
+	queue[queueCount].data = data;
+	queue[queueCount].nr = nr;
+	queueCount++;
+	pthread_cond_signal(&work);
+	pthread_mutex_unlock(&lock);
+	return;
+
+runHere:
+	/* Better late than never */
+	pthread_mutex_unlock(&lock);
+	fn(data, nr);
+}
+
+int poolExit(void)
+{
+	int i, busy = 0;
+
+	pthread_mutex_lock(&lock);
+	exiting = 1;
+	pthread_cond_broadcast(&work);
+	pthread_mutex_unlock(&lock);
+
+	/* Workers stuck in a job are left behind */
+	for (i = 0; i < workerCount; i++) {
+		pthread_mutex_lock(&lock);
+		if (workers[i].busy) {
+			busy++;
+			pthread_detach(workers[i].thread);
+			pthread_mutex_unlock(&lock);
+			continue;
+		}
+		pthread_mutex_unlock(&lock);
+		pthread_join(workers[i].thread, NULL);
+	}
+	if (busy)
+		return busy;
+
+	free(workers);
+	free(queue);
+	workers = NULL;
+	queue = NULL;
+	workerCount = workerMax = idleCount = 0;
+	queueHead = queueCount = queueMax = 0;
+	exiting = 0;
+	return 0;
+}
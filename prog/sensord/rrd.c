@@ -245,7 +245,7 @@ static void rrdGetSensors_DS(void *_data, const char *rawLabel,
 		 * instead of unknown
 		 */
 		sprintf(ptr, "DS:%s:GAUGE:%d:%s:%s", rawLabel, 5 *
-			sensord_args.rrdTime, min, max);
+			(sensord_args.rrdTime / 1000), min, max);
 	}
 }
 
@@ -287,10 +287,10 @@ int rrdInit(void)
 			return -1;
 		}
 
-		sprintf(stepBuff, "%d", sensord_args.rrdTime);
+		sprintf(stepBuff, "%d", sensord_args.rrdTime / 1000);
 		sprintf(rraBuff, "RRA:%s:%f:%d:%d",
 			sensord_args.rrdNoAverage ? "LAST" :"AVERAGE",
-			0.5, 1, 7 * 24 * 60 * 60 / sensord_args.rrdTime);
+			0.5, 1, 7 * 24 * 60 * 60 * 1000 / sensord_args.rrdTime);
 
 		argc += num;
 		argv[argc++] = rraBuff;
@@ -426,21 +426,27 @@ static struct gr graphs[] = {
 
 int rrdUpdate(void)
 {
-	int ret = rrdChips ();
+	/* Values which couldn't be read are logged as unknown, so the
+	   others still get in */
+	int err, ret = rrdChips ();
+	const char *argv[4];
 
-	if (!ret && sensord_args.doLoad) {
+	if (sensord_args.doLoad) {
 		FILE *loadavg;
+		float value;
+
 		if (!(loadavg = fopen("/proc/loadavg", "r"))) {
 			sensorLog(LOG_ERR,
 				  "Error opening `/proc/loadavg': %s",
 				  strerror(errno));
 			ret = 1;
+			strcat(rrdBuff, ":U");
 		} else {
-			float value;
 			if (fscanf(loadavg, "%f", &value) != 1) {
 				sensorLog(LOG_ERR,
 					  "Error reading load average");
 				ret = 2;
+				strcat(rrdBuff, ":U");
 			} else {
 				sprintf(rrdBuff + strlen(rrdBuff), ":%f",
 					value);
@@ -448,14 +454,15 @@ int rrdUpdate(void)
 			fclose(loadavg);
 		}
 	}
-	if (!ret) {
-		const char *argv[] = {
-			"sensord", sensord_args.rrdFile, rrdBuff, NULL
-		};
-		if ((ret = rrd_update(3, (char **) /* WEAK */ argv))) {
-			sensorLog(LOG_ERR, "Error updating RRD file: %s: %s",
-				  sensord_args.rrdFile, rrd_get_error());
-		}
+
+	argv[0] = "sensord";
+	argv[1] = sensord_args.rrdFile;
+	argv[2] = rrdBuff;
+	argv[3] = NULL;
+	if ((err = rrd_update(3, (char **) /* WEAK */ argv))) {
+		sensorLog(LOG_ERR, "Error updating RRD file: %s: %s",
+			  sensord_args.rrdFile, rrd_get_error());
+		ret = err;
 	}
 	sensorLog(LOG_DEBUG, "sensor rrd updated");
 
@@ -0,0 +1,307 @@
+/*
+ * sensord
+ *
+ * A daemon that periodically logs sensor information to syslog.
+ *
+ * Copyright (c) 1999-2002 Merlin Hughes <merlin@merlin.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301 USA.
+ */
+
+/*
+ * The scheduler runs periodic tasks off a single timerfd, and delivers
+ * signals through a signalfd, both waited for with epoll.
+ *
+ * Each task has a cadence on the monotonic clock: its next run is due
+ * one period after the previous one was due, not after it ended, so
+ * the time tasks take doesn't accumulate. A task which falls behind by
+ * more than a period skips the runs it missed instead of catching up.
+ *
+ * A task may run up to its slack late, never early, so that the runs
+ * due close to each other share a wakeup. The slack is a small part of
+ * the period, so an idle daemon wakes about once per period of its
+ * most frequent task, and no more.
+ */
+
+#include <errno.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <syslog.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
+#include <sys/timerfd.h>
+
+#include "sensord.h"
+
+#define NS_PER_MS 1000000ULL
+
+/* Slack, as a fraction of the period, and its maximum */
+#define SLACK_DIVISOR 50
+#define SLACK_MAX (1000 * NS_PER_MS)
+
+#define MAX_EVENTS 4
+
+typedef struct {
+	const char *name;
+	SchedFN fn;
+	void *data;
+	unsigned long long period;	/* ns */
+	unsigned long long slack;	/* ns */
+	unsigned long long next;	/* ns, monotonic */
+	int align;
+} Task;
+
+static Task *tasks;
+static int taskCount, taskMax;
+
+static int epollFd = -1;
+static int timerFd = -1;
+static int signalFd = -1;
+static int stopping;
+static const Task *current;
+
+static unsigned long long clockNs(clockid_t clock)
+{
+	struct timespec ts;
+
+	clock_gettime(clock, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/*
+ * Aligned tasks run at multiples of their period on the wall clock, as
+ * RRD expects of its updates
+ */
+static unsigned long long alignedNext(const Task *task,
+				      unsigned long long now)
+{
+	return now + task->period - clockNs(CLOCK_REALTIME) % task->period;
+}
+
+static int addFd(int fd)
+{
+	struct epoll_event ev;
+
+	memset(&ev, 0, sizeof(ev));
+	ev.events = EPOLLIN;
+	ev.data.fd = fd;
+	return epoll_ctl(epollFd, EPOLL_CTL_ADD, fd, &ev);
+}
+
+void schedBlockSignals(void)
+{
+	sigset_t mask;
+
+	sigemptyset(&mask);
+	sigaddset(&mask, SIGTERM);
+	sigaddset(&mask, SIGHUP);
+	sigprocmask(SIG_BLOCK, &mask, NULL);
+}
+
+int schedInit(void)
+{
+	sigset_t mask;
+
+	sigemptyset(&mask);
+	sigaddset(&mask, SIGTERM);
+	sigaddset(&mask, SIGHUP);
+
+	epollFd = epoll_create1(EPOLL_CLOEXEC);
+	timerFd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+	signalFd = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+	if (epollFd < 0 || timerFd < 0 || signalFd < 0 ||
+	    addFd(timerFd) || addFd(signalFd)) {
+		sensorLog(LOG_ERR, "Error initializing scheduler: %s",
+			  strerror(errno));
+		schedExit();
+		return -1;
+	}
+
+	stopping = 0;
+	return 0;
+}
+
+void schedExit(void)
+{
+	if (signalFd >= 0)
+		close(signalFd);
+	if (timerFd >= 0)
+		close(timerFd);
+	if (epollFd >= 0)
+		close(epollFd);
+	signalFd = timerFd = epollFd = -1;
+
+	free(tasks);
+	tasks = NULL;
+	current = NULL;
+	taskCount = taskMax = 0;
+}
+
+int schedAdd(const char *name, SchedFN fn, void *data, int period, int align)
+{
+	Task *task;
+	unsigned long long now = clockNs(CLOCK_MONOTONIC);
+
+	if (taskCount == taskMax) {
+		int max = taskMax ? 2 * taskMax : 8;
+
+		task = realloc(tasks, max * sizeof(Task));
+		if (!task) {
+			sensorLog(LOG_ERR, "Out of memory");
+			return -1;
+		}
+		tasks = task;
+		taskMax = max;
+	}
+
+	task = &tasks[taskCount++];
+	task->name = name;
+	task->fn = fn;
+	task->data = data;
+	task->period = period * NS_PER_MS;
+	task->slack = task->period / SLACK_DIVISOR;
+	if (task->slack > SLACK_MAX)
+		task->slack = SLACK_MAX;
+	task->align = align;
+	/* Unaligned tasks run right away */
+	task->next = align ? alignedNext(task, now) : now;
+
+	return 0;
+}
+
+/* Remove all the tasks running fn */
+void schedRemove(SchedFN fn)
+{
+	int i, count = 0;
+
+	for (i = 0; i < taskCount; i++)
+		if (tasks[i].fn != fn)
+			tasks[count++] = tasks[i];
+	taskCount = count;
+}
+
+void schedStop(void)
+{
+	stopping = 1;
+}
+
+/* The period of the task running, in ms, or 0 outside of tasks */
+int schedPeriod(void)
+{
+	return current ? current->period / NS_PER_MS : 0;
+}
+
+/* Arm the timer for the latest time the earliest task can run */
+static int armTimer(void)
+{
+	struct itimerspec its;
+	unsigned long long wake = 0;
+	int i;
+
+	for (i = 0; i < taskCount; i++)
+		if (!i || tasks[i].next + tasks[i].slack < wake)
+			wake = tasks[i].next + tasks[i].slack;
+
+	/* A zero time disarms the timer */
+	memset(&its, 0, sizeof(its));
+	if (taskCount) {
+		its.it_value.tv_sec = wake / 1000000000ULL;
+		its.it_value.tv_nsec = wake % 1000000000ULL;
+		if (!its.it_value.tv_sec && !its.it_value.tv_nsec)
+			its.it_value.tv_nsec = 1;
+	}
+	return timerfd_settime(timerFd, TFD_TIMER_ABSTIME, &its, NULL);
+}
+
+/* Run the tasks which are due, and schedule their next run */
+static void runDue(void)
+{
+	unsigned long long now = clockNs(CLOCK_MONOTONIC), skipped;
+	Task *task;
+	int i;
+
+	for (i = 0; i < taskCount && !stopping; i++) {
+		task = &tasks[i];
+		if (task->next > now)
+			continue;
+
+		current = task;
+		task->fn(task->data);
+		current = NULL;
+
+		now = clockNs(CLOCK_MONOTONIC);
+		if (task->align) {
+			task->next = alignedNext(task, now);
+			continue;
+		}
+		task->next += task->period;
+		if (task->next <= now) {
+			skipped = (now - task->next) / task->period + 1;
+			task->next += skipped * task->period;
+			sensorLog(LOG_DEBUG, "%s: skipped %llu run(s)",
+				  task->name, skipped);
+		}
+	}
+}
+
+static void readSignals(SignalFN sigFn)
+{
+	struct signalfd_siginfo si;
+
+	while (read(signalFd, &si, sizeof(si)) == sizeof(si))
+		sigFn(si.ssi_signo);
+}
+
+int schedRun(SignalFN sigFn)
+{
+	struct epoll_event events[MAX_EVENTS];
+	uint64_t expirations;
+	int i, n;
+
+	while (!stopping) {
+		if (armTimer()) {
+			sensorLog(LOG_ERR, "Error arming timer: %s",
+				  strerror(errno));
+			return -1;
+		}
+
+		n = epoll_wait(epollFd, events, MAX_EVENTS, -1);
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			sensorLog(LOG_ERR, "Error waiting for events: %s",
+				  strerror(errno));
+			return -1;
+		}
+
+		for (i = 0; i < n; i++) {
+			if (events[i].data.fd == signalFd)
+				readSignals(sigFn);
+			else if (events[i].data.fd == timerFd)
+				while (read(timerFd, &expirations,
+					    sizeof(expirations)) > 0)
+					;
+		}
+
+		runDue();
+	}
+
+	return 0;
+}
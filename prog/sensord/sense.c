@@ -21,10 +21,13 @@
  * MA 02110-1301 USA.
  */
 
+#include <errno.h>
+#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <syslog.h>
+#include <time.h>
 
 #include "args.h"
 #include "sensord.h"
@@ -34,6 +37,10 @@
 #define DO_SCAN 1
 #define DO_SET 2
 #define DO_RRD 3
+#define DO_SAMPLE 4
+
+/* The interval sampled by DO_SAMPLE */
+static int sampleInterval;
 
 static const char *chipName(const sensors_chip_name *chip)
 {
@@ -64,112 +71,173 @@ static int idChip(const sensors_chip_name *chip)
 	return 0;
 }
 
-static int get_flag(const sensors_chip_name *chip, int num)
+static int get_flag(const sensors_chip_name *chip, int num, int *flag)
 {
 	double val;
 	int ret;
 
+	*flag = 0;
 	if (num == -1)
 		return 0;
 
 	ret = sensors_get_value(chip, num, &val);
-	if (ret) {
-		sensorLog(LOG_ERR, "Error getting sensor data: %s/#%d: %s",
-			  chip->prefix, num, sensors_strerror(ret));
-		return -1;
+	if (!ret)
+		*flag = (int) (val + 0.5);
+	return ret;
+}
+
+/*
+ * Read the values of a feature, and the flags action needs, into its
+ * next reading. Features with an interval of their own are only read when
+ * sampled, at that interval, with all their flags, and otherwise report
+ * their last sample. The others are read whenever needed.
+ *
+ * This runs on the workers, so errors are only recorded here, and logged
+ * along with the rest by reportFeature().
+ */
+static void readFeature(const sensors_chip_name *chip,
+			FeatureDescriptor *feature, int action)
+{
+	Reading *next = &feature->next;
+	int i, num, ret = 0;
+
+	next->valid = 0;
+	next->alrm = next->beep = 0;
+
+	for (i = 0; (num = feature->dataNumbers[i]) >= 0; i++) {
+		ret = sensors_get_value(chip, num, next->values + i);
+		if (ret)
+			goto exit;
 	}
+	next->valid = 1;
+
+	/* Flags aren't logged to RRD */
+	if (action == DO_RRD)
+		goto exit;
 
-	return (int) (val + 0.5);
+	num = feature->alarmNumber;
+	ret = get_flag(chip, num, &next->alrm);
+	if (ret || (action == DO_SCAN && !next->alrm))
+		goto exit;
+
+	num = feature->beepNumber;
+	ret = get_flag(chip, num, &next->beep);
+
+exit:
+	next->err = ret;
+	next->errNumber = num;
 }
 
-static int get_features(const sensors_chip_name *chip,
-			const FeatureDescriptor *feature, int action,
-			char *label, int alrm, int beep)
+/* Whether a feature is read for action, rather than reported from its
+   last sample, or not at all */
+static int readsFeature(const FeatureDescriptor *feature, int action)
 {
-	int i, ret;
-	double val[MAX_DATA];
-
-	for (i = 0; feature->dataNumbers[i] >= 0; i++) {
-		ret = sensors_get_value(chip, feature->dataNumbers[i],
-					val + i);
-		if (ret) {
-			sensorLog(LOG_ERR,
-				  "Error getting sensor data: %s/#%d: %s",
-				  chip->prefix, feature->dataNumbers[i],
-				  sensors_strerror(ret));
-			return -1;
-		}
-	}
+	if (action == DO_SAMPLE)
+		return feature->interval == sampleInterval;
+	if (feature->interval)
+		return action != DO_SCAN && !feature->read;
+	return 1;
+}
+
+static unsigned long long clockMs(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000ULL + ts.tv_nsec / 1000000;
+}
+
+static int reportFeature(const ChipDescriptor *chip,
+			 FeatureDescriptor *feature, int action)
+{
+	const sensors_chip_name *name = chip->name;
+	const Reading *last = &feature->last;
+	const char *formatted;
+	char *label;
+	int ret;
 
+	/* Sampled features are scanned for alarms when sampled */
+	if (action == DO_SAMPLE ? feature->interval != sampleInterval :
+	    action == DO_SCAN && feature->interval)
+		return 0;
+
+	/* A sample is reported more than once, but its error only once */
+	if (feature->fresh && last->err)
+		sensorLog(LOG_ERR, "Error getting sensor data: %s/#%d: %s",
+			  name->prefix, last->errNumber,
+			  sensors_strerror(last->err));
+	feature->fresh = 0;
+
+	/* Stale values are unknown to RRD, and the chip was reported late
+	   once already */
 	if (action == DO_RRD) {
 		if (feature->rrd) {
-			const char *rrded = feature->rrd(val);
+			const char *rrded = last->valid && !chip->late ?
+				feature->rrd(last->values) : NULL;
 
 			/* FIXME: Jean's review comment:
 			 * sprintf would me more efficient.
 			 */
 			strcat(strcat (rrdBuff, ":"), rrded ? rrded : "U");
 		}
-	} else {
-		const char *formatted = feature->format(val, alrm, beep);
-
-		if (!formatted) {
-			sensorLog(LOG_ERR, "Error formatting sensor data");
-			return -1;
-		}
-
-		if (action == DO_READ) {
-			sensorLog(LOG_INFO, "  %s: %s", label, formatted);
-		} else {
-			sensorLog(LOG_ALERT, "Sensor alarm: Chip %s: %s: %s",
-				  chipName(chip), label, formatted);
-		}
+		return last->valid || chip->late ? 0 : -1;
 	}
-	return 0;
-}
 
-static int do_features(const sensors_chip_name *chip,
-		       const FeatureDescriptor *feature, int action)
-{
-	char *label;
-	int alrm, beep;
+	/* Stale values aren't scanned for alarms again */
+	if (action != DO_READ && chip->late)
+		return 0;
+	ret = last->err ? -1 : 0;
+	if (ret || (action == DO_SAMPLE && !sensord_args.scanTime))
+		return chip->late ? 0 : ret;
 
-	label = sensors_get_label(chip, feature->feature);
+	if (action != DO_READ && !last->alrm)
+		return 0;
+
+	label = sensors_get_label(name, feature->feature);
 	if (!label) {
 		sensorLog(LOG_ERR, "Error getting sensor label: %s/%s",
-			  chip->prefix, feature->feature->name);
+			  name->prefix, feature->feature->name);
 		return -1;
 	}
 
-	alrm = get_flag(chip, feature->alarmNumber);
-	if (alrm == -1)
-		return -1;
-	else if (action == DO_SCAN && !alrm)
+	if (!feature->read) {
+		sensorLog(LOG_INFO, "  %s: no reading yet", label);
+		free(label);
 		return 0;
+	}
 
-	beep = get_flag(chip, feature->beepNumber);
-	if (beep == -1)
-		return -1;
-
-	return get_features(chip, feature, action, label, alrm, beep);
+	formatted = feature->format(last->values, last->alrm, last->beep);
+	if (!formatted) {
+		sensorLog(LOG_ERR, "Error formatting sensor data");
+		ret = -1;
+	} else if (action == DO_READ && chip->late) {
+		sensorLog(LOG_INFO, "  %s: %s (stale, %.1f s old)", label,
+			  formatted, (clockMs() - chip->readTime) / 1000.0);
+	} else if (action == DO_READ) {
+		sensorLog(LOG_INFO, "  %s: %s", label, formatted);
+	} else {
+		sensorLog(LOG_ALERT, "Sensor alarm: Chip %s: %s: %s",
+			  chipName(name), label, formatted);
+	}
+	free(label);
+	return ret;
 }
 
-static int doKnownChip(const sensors_chip_name *chip,
-		       const ChipDescriptor *descriptor, int action)
+static int reportChip(const ChipDescriptor *descriptor, int action)
 {
-	const FeatureDescriptor *features = descriptor->features;
+	FeatureDescriptor *features = descriptor->features;
 	int i, ret = 0;
 
 	if (action == DO_READ) {
-		ret = idChip(chip);
+		ret = idChip(descriptor->name);
 		if (ret)
 			return ret;
 	}
 
+	/* A failing feature, or chip, must not hide the others */
 	for (i = 0; features[i].format; i++) {
-		ret = do_features(chip, features + i, action);
-		if (ret == -1)
-			break;
+		if (reportFeature(descriptor, features + i, action) == -1)
+			ret = -1;
 	}
 
 	return ret;
@@ -191,47 +259,375 @@ static int setChip(const sensors_chip_name *chip)
 	return ret;
 }
 
-static int doChip(const sensors_chip_name *chip, int action)
+static ChipDescriptor *findKnownChip(const sensors_chip_name *chip)
 {
-	int ret = 0;
-	if (action == DO_SET) {
-		ret = setChip(chip);
-	} else {
-		int index0, chipindex = -1;
-		for (index0 = 0; knownChips[index0].features; ++index0) {
-			/*
-			 * Trick: we compare addresses here. We know it works
-			 * because both pointers were returned by
-			 * sensors_get_detected_chips(), so they refer to
-			 * libsensors internal structures, which do not move.
-			 */
-			if (knownChips[index0].name == chip) {
-				chipindex = index0;
-				break;
-			}
-		}
+	int index0;
+
+	for (index0 = 0; knownChips[index0].features; ++index0) {
+		/*
+		 * Trick: we compare addresses here. We know it works
+		 * because both pointers were returned by
+		 * sensors_get_detected_chips(), so they refer to
+		 * libsensors internal structures, which do not move.
+		 */
+		if (knownChips[index0].name == chip)
+			return &knownChips[index0];
+	}
+	return NULL;
+}
 
-		if (chipindex >= 0) {
-			ret = doKnownChip(chip, &knownChips[chipindex],
-					  action);
-		}
+/*
+ * The chips we watch, in the order they are reported, and the same chips
+ * grouped by bus. The groups are read in parallel, and the chips of a
+ * group one after the other: chips on the same I2C adapter would only
+ * contend for its lock, while chips on other busses don't share
+ * anything.
+ */
+typedef struct {
+	ChipDescriptor **chips;
+	int count;
+	int action;		/* The action the chips are read for */
+	int submit;
+	int inFlight;		/* Handed to a worker, which isn't done */
+} ReadGroup;
+
+static ChipDescriptor **watched;
+static int watchedCount;
+static ReadGroup *groups;
+static int groupCount;
+
+/*
+ * The chips are read on the workers, into the next reading of their
+ * features, and are busy until done. The main thread then publishes the
+ * next readings as the last ones, which are all it ever reports. So it
+ * only waits for a read until the deadline, and a chip which misses it
+ * is reported late, from its last readings, until its read completes.
+ *
+ * readLock protects the busy flags and read times of the chips, and the
+ * in flight flags of the groups.
+ */
+static pthread_mutex_t readLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t readDone;
+static pthread_once_t readOnce = PTHREAD_ONCE_INIT;
+static int readRun;
+
+static void initReadDone(void)
+{
+	pthread_condattr_t attr;
+
+	pthread_condattr_init(&attr);
+	pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+	pthread_cond_init(&readDone, &attr);
+	pthread_condattr_destroy(&attr);
+}
+
+static int sameGroup(const sensors_chip_name *a, const sensors_chip_name *b)
+{
+	if (a == b)
+		return 1;
+	return a->bus.type == SENSORS_BUS_TYPE_I2C &&
+	       b->bus.type == SENSORS_BUS_TYPE_I2C && a->bus.nr == b->bus.nr;
+}
+
+static int addChip(ChipDescriptor ***chips, int *count,
+		   ChipDescriptor *descriptor)
+{
+	ChipDescriptor **grown;
+
+	grown = realloc(*chips, (*count + 1) * sizeof(ChipDescriptor *));
+	if (!grown) {
+		sensorLog(LOG_ERR, "Out of memory");
+		return -1;
 	}
-	return ret;
+	*chips = grown;
+	grown[(*count)++] = descriptor;
+	return 0;
 }
 
-static int doChips(int action)
+static int addWatched(ChipDescriptor *descriptor)
+{
+	ReadGroup *group;
+	int i, j;
+
+	if (addChip(&watched, &watchedCount, descriptor))
+		return -1;
+
+	for (i = 0; i < groupCount; i++) {
+		group = &groups[i];
+		if (!sameGroup(group->chips[0]->name, descriptor->name))
+			continue;
+		/* A chip given twice is still read once */
+		for (j = 0; j < group->count; j++)
+			if (group->chips[j] == descriptor)
+				return 0;
+		return addChip(&group->chips, &group->count, descriptor);
+	}
+
+	group = realloc(groups, (groupCount + 1) * sizeof(ReadGroup));
+	if (!group) {
+		sensorLog(LOG_ERR, "Out of memory");
+		return -1;
+	}
+	groups = group;
+	group = &groups[groupCount++];
+	group->chips = NULL;
+	group->count = 0;
+	group->inFlight = 0;
+	return addChip(&group->chips, &group->count, descriptor);
+}
+
+int initReadGroups(void)
 {
 	const sensors_chip_name *chip, *chip_arg;
-	int i, j, ret = 0;
+	ChipDescriptor *descriptor;
+	int i, j;
+
+	pthread_once(&readOnce, initReadDone);
 
 	for (j = 0; j < sensord_args.numChipNames; j++) {
 		chip_arg = &sensord_args.chipNames[j];
 		i = 0;
 		while ((chip = sensors_get_detected_chips(chip_arg, &i))) {
-			ret = doChip(chip, action);
-			if (ret)
-				return ret;
+			descriptor = findKnownChip(chip);
+			if (descriptor && addWatched(descriptor)) {
+				freeReadGroups();
+				return -1;
+			}
+		}
+	}
+
+	sensorLog(LOG_DEBUG, "%d chip(s) in %d read group(s)", watchedCount,
+		  groupCount);
+	return 0;
+}
+
+void freeReadGroups(void)
+{
+	int i;
+
+	for (i = 0; i < groupCount; i++)
+		free(groups[i].chips);
+	free(groups);
+	free(watched);
+	groups = NULL;
+	watched = NULL;
+	groupCount = watchedCount = 0;
+}
+
+/* Reads are only in progress while groups are in flight, which is when
+   their chips can't be freed */
+int readsInProgress(void)
+{
+	int i, busy = 0;
+
+	pthread_mutex_lock(&readLock);
+	for (i = 0; i < groupCount; i++)
+		busy |= groups[i].inFlight;
+	pthread_mutex_unlock(&readLock);
+	return busy;
+}
+
+/*
+ * The group, and the pending flags of its chips, are left alone by the
+ * main thread until the group is no longer in flight
+ */
+static void readGroup(void *data, int nr)
+{
+	ReadGroup *group = (ReadGroup *)data + nr;
+	ChipDescriptor *chip;
+	FeatureDescriptor *features;
+	int i, j;
+
+	for (i = 0; i < group->count; i++) {
+		chip = group->chips[i];
+		if (!chip->pending)
+			continue;
+
+		features = chip->features;
+		for (j = 0; features[j].format; j++) {
+			if (!features[j].pending)
+				continue;
+			readFeature(chip->name, &features[j],
+				    features[j].interval ? DO_SAMPLE :
+				    group->action);
+		}
+
+		pthread_mutex_lock(&readLock);
+		chip->busy = 0;
+		chip->readTime = clockMs();
+		pthread_cond_broadcast(&readDone);
+		pthread_mutex_unlock(&readLock);
+	}
+
+	pthread_mutex_lock(&readLock);
+	group->inFlight = 0;
+	pthread_mutex_unlock(&readLock);
+}
+
+/* Publish the readings of the chips done, and with late set, report the
+   chips read in this run and still busy as late. Called with readLock
+   held. */
+static void collect(int late)
+{
+	ChipDescriptor *chip;
+	FeatureDescriptor *features;
+	int i, j, k;
+
+	for (i = 0; i < groupCount; i++) {
+		for (j = 0; j < groups[i].count; j++) {
+			chip = groups[i].chips[j];
+			if (chip->busy) {
+				if (late && chip->run == readRun && !chip->late) {
+					chip->late = 1;
+					sensorLog(LOG_WARNING, "Chip %s: no "
+						  "reading within %llu ms, "
+						  "reporting stale values",
+						  chipName(chip->name),
+						  clockMs() - chip->startTime);
+				}
+				continue;
+			}
+			if (!chip->pending)
+				continue;
+
+			features = chip->features;
+			for (k = 0; features[k].format; k++) {
+				if (!features[k].pending)
+					continue;
+				features[k].last = features[k].next;
+				features[k].read = features[k].fresh = 1;
+				features[k].pending = 0;
+			}
+			chip->pending = 0;
+
+			if (chip->late) {
+				chip->late = 0;
+				sensorLog(LOG_NOTICE, "Chip %s: read in %llu ms",
+					  chipName(chip->name),
+					  chip->readTime - chip->startTime);
+			}
+		}
+	}
+}
+
+/* Mark the chips of the groups not busy which have features to read, and
+   return the number of groups to submit. Called with readLock held. */
+static int dispatch(int action)
+{
+	ReadGroup *group;
+	ChipDescriptor *chip;
+	FeatureDescriptor *features;
+	int i, j, k, count = 0;
+	unsigned long long now = clockMs();
+
+	readRun++;
+	for (i = 0; i < groupCount; i++) {
+		group = &groups[i];
+		group->submit = 0;
+		if (group->inFlight)
+			continue;
+
+		group->action = action;
+		for (j = 0; j < group->count; j++) {
+			chip = group->chips[j];
+			features = chip->features;
+			chip->pending = 0;
+			for (k = 0; features[k].format; k++) {
+				features[k].pending =
+					readsFeature(&features[k], action);
+				chip->pending |= features[k].pending;
+			}
+			if (!chip->pending)
+				continue;
+			chip->busy = 1;
+			chip->run = readRun;
+			chip->startTime = now;
+			group->submit = 1;
 		}
+		group->inFlight = group->submit;
+		count += group->submit;
+	}
+	return count;
+}
+
+/* Whether chips read in this run are still busy. Called with readLock
+   held. */
+static int waiting(void)
+{
+	int i;
+
+	for (i = 0; i < watchedCount; i++)
+		if (watched[i]->busy && watched[i]->run == readRun)
+			return 1;
+	return 0;
+}
+
+/*
+ * Read the chips which aren't late, until the deadline: the read deadline
+ * given, but no more than half the period of the task we run for, so that
+ * the schedule never slips
+ */
+static void readChipsUntilDeadline(int action)
+{
+	unsigned long long deadline;
+	struct timespec ts;
+	int i, wait, period;
+
+	wait = sensord_args.readDeadline;
+	period = schedPeriod();
+	if (period && period / 2 < wait)
+		wait = period / 2;
+
+	pthread_mutex_lock(&readLock);
+	collect(0);
+	if (!dispatch(action)) {
+		pthread_mutex_unlock(&readLock);
+		return;
+	}
+	pthread_mutex_unlock(&readLock);
+
+	for (i = 0; i < groupCount; i++)
+		if (groups[i].submit)
+			poolSubmit(readGroup, groups, i);
+
+	deadline = clockMs() + wait;
+	ts.tv_sec = deadline / 1000;
+	ts.tv_nsec = deadline % 1000 * 1000000;
+
+	pthread_mutex_lock(&readLock);
+	while (waiting())
+		if (pthread_cond_timedwait(&readDone, &readLock, &ts) ==
+		    ETIMEDOUT)
+			break;
+	collect(1);
+	pthread_mutex_unlock(&readLock);
+}
+
+static int doChips(int action)
+{
+	const sensors_chip_name *chip, *chip_arg;
+	int i, j, err, ret = 0;
+
+	if (action == DO_SET) {
+		for (j = 0; j < sensord_args.numChipNames; j++) {
+			chip_arg = &sensord_args.chipNames[j];
+			i = 0;
+			while ((chip = sensors_get_detected_chips(chip_arg, &i))) {
+				err = setChip(chip);
+				if (err && !ret)
+					ret = err;
+			}
+		}
+		return ret;
+	}
+
+	/* All the chips are read first, then reported in order */
+	readChipsUntilDeadline(action);
+
+	for (i = 0; i < watchedCount; i++) {
+		err = reportChip(watched[i], action);
+		if (err && !ret)
+			ret = err;
 	}
 	return ret;
 }
@@ -283,3 +679,58 @@ int rrdChips(void)
 
 	return ret;
 }
+
+int sampleChips(int interval)
+{
+	int ret = 0;
+
+	sampleInterval = interval;
+
+	sensorLog(LOG_DEBUG, "sensor sample (%d ms) started", interval);
+	ret = doChips(DO_SAMPLE);
+	sensorLog(LOG_DEBUG, "sensor sample (%d ms) finished", interval);
+
+	return ret;
+}
+
+static int addInterval(int **intervals, int *count, int interval)
+{
+	int i, *grown;
+
+	for (i = 0; i < *count; i++)
+		if ((*intervals)[i] == interval)
+			return 0;
+
+	grown = realloc(*intervals, (*count + 1) * sizeof(int));
+	if (!grown) {
+		sensorLog(LOG_ERR, "Out of memory");
+		return -1;
+	}
+	*intervals = grown;
+	grown[(*count)++] = interval;
+	return 0;
+}
+
+/* The distinct sampling intervals of the features of the chips we
+   watch. Returns their number, or -1 on error. */
+int getIntervals(int **intervals)
+{
+	const FeatureDescriptor *features;
+	int i, j, count = 0;
+
+	*intervals = NULL;
+	for (i = 0; i < watchedCount; i++) {
+		features = watched[i]->features;
+		for (j = 0; features[j].format; j++) {
+			if (!features[j].interval)
+				continue;
+			if (addInterval(intervals, &count,
+					features[j].interval)) {
+				free(*intervals);
+				*intervals = NULL;
+				return -1;
+			}
+		}
+	}
+	return count;
+}
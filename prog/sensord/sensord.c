@@ -24,12 +24,10 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <errno.h>
-#include <limits.h>
 #include <string.h>
 #include <signal.h>
 #include <syslog.h>
 #include <unistd.h>
-#include <time.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 
@@ -38,9 +36,6 @@
 
 static int logOpened = 0;
 
-static volatile sig_atomic_t done = 0;
-static volatile sig_atomic_t reload = 0;
-
 #define LOG_BUFFER 4096
 
 #include <stdarg.h>
@@ -63,112 +58,145 @@ void sensorLog(int priority, const char *fmt, ...)
 	}
 }
 
+/* Workers left reading on exit, which the library must outlive */
+static int abandoned;
+
+/* The sampling intervals of the sample tasks */
+static int *intervals;
+static int intervalCount;
+
+static int doSample(void *data)
+{
+	int ret;
+
+	if ((ret = sampleChips(*(int *)data)))
+		sensorLog(LOG_NOTICE, "sensor sample error (%d)", ret);
+	return ret;
+}
+
+/* Features with an interval of their own are sampled by one task per
+   distinct interval */
+static int addSampleTasks(void)
+{
+	int i;
+
+	free(intervals);
+	intervalCount = getIntervals(&intervals);
+	if (intervalCount < 0) {
+		intervalCount = 0;
+		return -1;
+	}
+
+	for (i = 0; i < intervalCount; i++) {
+		sensorLog(LOG_DEBUG, "sampling every %d ms", intervals[i]);
+		if (schedAdd("sample", doSample, &intervals[i], intervals[i],
+			     0))
+			return -1;
+	}
+	return 0;
+}
+
 static void signalHandler(int sig)
 {
+	int ret;
+
 	switch (sig) {
 	case SIGTERM:
-		done = 1;
+		schedStop();
 		break;
 	case SIGHUP:
-		reload = 1;
+		/* Late chips are still being read, and can't be freed */
+		if (readsInProgress()) {
+			sensorLog(LOG_NOTICE, "configuration reload refused: "
+				  "reads in progress");
+			break;
+		}
+		schedRemove(doSample);
+		ret = reloadLib(sensord_args.cfgFile);
+		if (!ret)
+			ret = addSampleTasks();
+		if (ret)
+			sensorLog(LOG_NOTICE, "configuration reload error");
 		break;
 	}
 }
 
-static int sensord(void)
+static int doScan(void *data)
 {
-	int ret = 0;
-	int scanValue = 0, logValue = 0;
-	/*
-	 * First RRD update at next RRD timeslot to prevent failures due
-	 * one timeslot updated twice on restart for example.
-	 */
-	int rrdValue = sensord_args.rrdTime - time(NULL) %
-		sensord_args.rrdTime;
-
-	sensorLog(LOG_INFO, "sensord started");
+	int ret;
 
-	while (!done) {
-		if (reload) {
-			ret = reloadLib(sensord_args.cfgFile);
-			if (ret)
-				sensorLog(LOG_NOTICE, "configuration reload"
-					  " error");
-			reload = 0;
-		}
-		if (sensord_args.scanTime && (scanValue <= 0)) {
-			if ((ret = scanChips()))
-				sensorLog(LOG_NOTICE,
-					  "sensor scan error (%d)", ret);
-			scanValue += sensord_args.scanTime;
-		}
-		if (sensord_args.logTime && (logValue <= 0)) {
-			if ((ret = readChips()))
-				sensorLog(LOG_NOTICE,
-					  "sensor read error (%d)", ret);
-			logValue += sensord_args.logTime;
-		}
-		if (sensord_args.rrdTime && sensord_args.rrdFile &&
-		    (rrdValue <= 0)) {
-			if ((ret = rrdUpdate()))
-				sensorLog(LOG_NOTICE,
-					  "rrd update error (%d)", ret);
-			/*
-			 * The amount of time to wait is computed using the
-			 * same method as in RRD instead of simply adding the
-			 * interval.
-			 */
-			rrdValue = sensord_args.rrdTime - time(NULL) %
-				sensord_args.rrdTime;
-		}
-		if (!done) {
-			int a = sensord_args.logTime ? logValue : INT_MAX;
-			int b = sensord_args.scanTime ? scanValue : INT_MAX;
-			int c = (sensord_args.rrdTime && sensord_args.rrdFile)
-				? rrdValue : INT_MAX;
-			int sleepTime = (a < b) ? ((a < c) ? a : c) :
-				((b < c) ? b : c);
-			sleep(sleepTime);
-			scanValue -= sleepTime;
-			logValue -= sleepTime;
-			rrdValue -= sleepTime;
-		}
-	}
+	(void)data;
+	if ((ret = scanChips()))
+		sensorLog(LOG_NOTICE, "sensor scan error (%d)", ret);
+	return ret;
+}
 
-	sensorLog(LOG_INFO, "sensord stopped");
+static int doLog(void *data)
+{
+	int ret;
 
+	(void)data;
+	if ((ret = readChips()))
+		sensorLog(LOG_NOTICE, "sensor read error (%d)", ret);
 	return ret;
 }
 
-static void openLog(void)
+static int doRRD(void *data)
 {
-	openlog("sensord", 0, sensord_args.syslogFacility);
-	logOpened = 1;
+	int ret;
+
+	(void)data;
+	if ((ret = rrdUpdate()))
+		sensorLog(LOG_NOTICE, "rrd update error (%d)", ret);
+	return ret;
 }
 
-static void install_sighandler(void)
+static int sensord(void)
 {
-	struct sigaction new;
 	int ret;
 
-	memset(&new, 0, sizeof(struct sigaction));
-	new.sa_handler = signalHandler;
-	sigemptyset(&new.sa_mask);
-	new.sa_flags = SA_RESTART;
+	if (schedInit())
+		return 1;
 
-	ret = sigaction(SIGTERM, &new, NULL);
-	if (ret == -1) {
-		fprintf(stderr, "Could not set sighandler for SIGTERM: %s\n",
-			strerror(errno));
-		exit(EXIT_FAILURE);
+	/* Sampled first, so that the first log uses fresh samples */
+	if (addSampleTasks()) {
+		schedExit();
+		return 1;
 	}
 
-	ret = sigaction(SIGHUP, &new, NULL);
-	if (ret == -1) {
-		fprintf(stderr, "Could not set sighandler for SIGHUP: %s\n",
-			strerror(errno));
-		exit(EXIT_FAILURE);
+	/*
+	 * Alarms are scanned and readings logged right away, but the first
+	 * RRD update waits for the next RRD timeslot, to prevent failures
+	 * due to one timeslot updated twice on restart for example.
+	 */
+	if ((sensord_args.scanTime &&
+	     schedAdd("scan", doScan, NULL, sensord_args.scanTime, 0)) ||
+	    (sensord_args.logTime &&
+	     schedAdd("log", doLog, NULL, sensord_args.logTime, 0)) ||
+	    (sensord_args.rrdTime && sensord_args.rrdFile &&
+	     schedAdd("rrd", doRRD, NULL, sensord_args.rrdTime, 1))) {
+		schedExit();
+		return 1;
 	}
+
+	sensorLog(LOG_INFO, "sensord started");
+	ret = schedRun(signalHandler);
+	sensorLog(LOG_INFO, "sensord stopped");
+
+	abandoned = poolExit();
+	if (abandoned)
+		sensorLog(LOG_NOTICE, "%d read(s) still in progress", abandoned);
+	schedExit();
+	free(intervals);
+	intervals = NULL;
+	intervalCount = 0;
+	return ret;
+}
+
+static void openLog(void)
+{
+	openlog("sensord", 0, sensord_args.syslogFacility);
+	logOpened = 1;
 }
 
 static void daemonize(void)
@@ -196,7 +224,8 @@ static void daemonize(void)
 		exit(EXIT_FAILURE);
 	}
 
-	install_sighandler();
+	/* Signals are read from a signalfd, once blocked */
+	schedBlockSignals();
 
 	if ((pid = fork()) == -1) {
 		perror("fork()");
@@ -258,7 +287,7 @@ int main(int argc, char **argv)
 	}
 
 	freeChips();
-	if (unloadLib())
+	if (!abandoned && unloadLib())
 		exit(EXIT_FAILURE);
 
 	return ret;
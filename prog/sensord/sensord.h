@@ -45,6 +45,33 @@ extern int readChips(void);
 extern int scanChips(void);
 extern int setChips(void);
 extern int rrdChips(void);
+extern int sampleChips(int interval);
+extern int getIntervals(int **intervals);
+extern int initReadGroups(void);
+extern void freeReadGroups(void);
+extern int readsInProgress(void);
+
+/* from sched.c */
+
+typedef int (*SchedFN) (void *data);
+typedef void (*SignalFN) (int sig);
+
+extern void schedBlockSignals(void);
+extern int schedInit(void);
+extern void schedExit(void);
+extern int schedAdd(const char *name, SchedFN fn, void *data, int period,
+		    int align);
+extern void schedRemove(SchedFN fn);
+extern int schedPeriod(void);
+extern int schedRun(SignalFN sigFn);
+extern void schedStop(void);
+
+/* from pool.c */
+
+typedef void (*PoolFN) (void *data, int nr);
+
+extern void poolSubmit(PoolFN fn, void *data, int nr);
+extern int poolExit(void);
 
 /* from rrd.c */
 
@@ -69,6 +96,15 @@ typedef enum {
 	DataType_other = -1
 } DataType;
 
+typedef struct {
+	int valid;		/* The values were read */
+	int err;		/* Error of the first failed read, or 0 */
+	int errNumber;		/* The subfeature which failed */
+	int alrm;
+	int beep;
+	double values[MAX_DATA];
+} Reading;
+
 typedef struct {
 	FormatterFN format;
 	RRDFN rrd;
@@ -77,11 +113,25 @@ typedef struct {
 	int beepNumber;
 	const sensors_feature *feature;
 	int dataNumbers[MAX_DATA + 1];
+	int interval;		/* Sampling interval in ms, 0 if none */
+	/* The readings, see sense.c */
+	int pending;		/* Being read into next */
+	int read;		/* last is set */
+	int fresh;		/* last not reported yet */
+	Reading last;
+	Reading next;
 } FeatureDescriptor;
 
 typedef struct {
 	const sensors_chip_name *name;
 	FeatureDescriptor *features;
+	/* Read state, see sense.c */
+	int pending;		/* Features are being read */
+	int busy;		/* Not done with them yet */
+	int late;		/* Missed the deadline */
+	int run;
+	unsigned long long startTime;	/* ms, monotonic */
+	unsigned long long readTime;
 } ChipDescriptor;
 
 extern ChipDescriptor * knownChips;
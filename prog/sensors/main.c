@@ -41,7 +41,9 @@
 #define PROGRAM			"sensors"
 #define VERSION			LM_VERSION
 
-static int do_sets, do_raw, hide_adapter;
+static int do_sets, do_raw, hide_adapter, profile_init;
+static const char *record_file, *replay_file;
+static unsigned int replay_speed;
 
 int fahrenheit;
 char degstr[5]; /* store the correct string to print degrees */
@@ -60,6 +62,10 @@ static void print_long_help(void)
 	     "  -f, --fahrenheit      Show temperatures in degrees fahrenheit\n"
 	     "  -A, --no-adapter      Do not show adapter for each chip\n"
 	     "      --bus-list        Generate bus statements for sensors.conf\n"
+	     "      --record=FILE     Record the chips and readings to a trace\n"
+	     "      --replay=FILE     Show the chips and readings of a trace\n"
+	     "      --replay-speed=N  Replay N times faster than real time\n"
+	     "      --profile-init    Profile the initialization, in JSON\n"
 	     "  -u                    Raw output (debugging only)\n"
 	     "  -v, --version         Display the program version\n"
 	     "\n"
@@ -103,6 +109,24 @@ static int read_config_file(const char *config_file_name)
 		config_file = NULL;
 	}
 
+	if (record_file)
+		err = sensors_trace_record(record_file);
+	else if (replay_file)
+		err = sensors_trace_replay(replay_file, replay_speed);
+	else
+		err = 0;
+	if (err) {
+		fprintf(stderr, "%s: %s\n", record_file ? record_file :
+			replay_file, sensors_strerror(err));
+		if (config_file)
+			fclose(config_file);
+		return 1;
+	}
+
+	/* Chips not asked for are never read, but all of them are when
+	   profiling, so that their discovery is part of the profile */
+	sensors_set_lazy_discovery(!profile_init);
+	sensors_set_init_profiling(profile_init);
 	err = sensors_init(config_file);
 	if (err) {
 		fprintf(stderr, "sensors_init: %s\n", sensors_strerror(err));
@@ -242,6 +266,126 @@ static void print_bus_list(void)
 	}
 }
 
+#define PROFILE_TOP	10	/* Slowest chips and files to show */
+
+struct profile_entry {
+	const sensors_chip_name *chip;	/* NULL for a file */
+	const char *file;
+	sensors_init_stats stats;
+};
+
+static const char *init_phase_names[SENSORS_INIT_PHASES] = {
+	"other", "chips", "busses", "parse", "config_dir", "subst"
+};
+
+static void print_json_string(const char *s)
+{
+	if (!s) {
+		printf("null");
+		return;
+	}
+
+	putchar('"');
+	for (; *s; s++) {
+		if (*s == '"' || *s == '\\')
+			printf("\\%c", *s);
+		else if ((unsigned char)*s < 0x20)
+			printf("\\u%04x", *s);
+		else
+			putchar(*s);
+	}
+	putchar('"');
+}
+
+/* Slowest first */
+static int cmp_profile_entry(const void *a, const void *b)
+{
+	const struct profile_entry *ea = a, *eb = b;
+
+	if (ea->stats.ns != eb->stats.ns)
+		return ea->stats.ns < eb->stats.ns ? 1 : -1;
+	return 0;
+}
+
+static void print_profile_entries(struct profile_entry *entries, int count)
+{
+	int i;
+
+	qsort(entries, count, sizeof(struct profile_entry),
+	      cmp_profile_entry);
+	for (i = 0; i < count && i < PROFILE_TOP; i++) {
+		printf("%s\n    { \"name\": ", i ? "," : "");
+		if (entries[i].chip) {
+			print_json_string(sprintf_chip_name(entries[i].chip));
+			printf(", \"path\": ");
+			print_json_string(entries[i].chip->path);
+		} else
+			print_json_string(entries[i].file);
+		printf(", \"ns\": %llu, \"est_syscalls\": %llu }",
+		       entries[i].stats.ns, entries[i].stats.est_syscalls);
+	}
+	printf("%s]", count ? "\n  " : "");
+}
+
+/* Return 0 on success, and an exit error code otherwise */
+static int print_init_profile(void)
+{
+	const sensors_chip_name *chip;
+	sensors_init_stats stats;
+	struct profile_entry *entries;
+	unsigned long long total_ns = 0;
+	int chip_nr, count, i;
+	const char *name;
+
+	/* The i2c adapters are only enumerated when first needed */
+	chip_nr = 0;
+	while ((chip = sensors_get_detected_chips(NULL, &chip_nr)))
+		sensors_get_adapter_name(&chip->bus);
+
+	printf("{\n  \"phases\": {");
+	for (i = 0; i < SENSORS_INIT_PHASES; i++) {
+		sensors_get_init_stats(i, &stats);
+		printf("%s\n    \"%s\": { \"ns\": %llu, \"est_syscalls\": %llu, "
+		       "\"count\": %u }", i ? "," : "", init_phase_names[i],
+		       stats.ns, stats.est_syscalls, stats.count);
+		total_ns += stats.ns;
+	}
+	printf("\n  },\n  \"total_ns\": %llu,\n", total_ns);
+
+	for (count = 0; sensors_get_detected_chips(NULL, &count); )
+		;
+	for (i = 0; !sensors_get_init_file_stats(i, &name, &stats); i++)
+		;
+	if (i > count)
+		count = i;
+	entries = malloc((count + 1) * sizeof(struct profile_entry));
+	if (!entries) {
+		fprintf(stderr, "Out of memory\n");
+		return 1;
+	}
+
+	printf("  \"chips\": [");
+	chip_nr = count = 0;
+	while ((chip = sensors_get_detected_chips(NULL, &chip_nr))) {
+		entries[count].chip = chip;
+		sensors_get_init_chip_stats(chip, &entries[count].stats);
+		count++;
+	}
+	print_profile_entries(entries, count);
+
+	printf(",\n  \"files\": [");
+	for (count = 0; !sensors_get_init_file_stats(count,
+						     &entries[count].file,
+						     &entries[count].stats);
+	     count++)
+		entries[count].chip = NULL;
+	print_profile_entries(entries, count);
+	printf("\n}\n");
+
+	free(entries);
+	return 0;
+}
+
 int main(int argc, char *argv[])
 {
 	int c, i, err, do_bus_list;
@@ -255,6 +399,10 @@ int main(int argc, char *argv[])
 		{ "no-adapter", no_argument, NULL, 'A' },
 		{ "config-file", required_argument, NULL, 'c' },
 		{ "bus-list", no_argument, NULL, 'B' },
+		{ "record", required_argument, NULL, 'R' },
+		{ "replay", required_argument, NULL, 'P' },
+		{ "replay-speed", required_argument, NULL, 'S' },
+		{ "profile-init", no_argument, NULL, 'I' },
 		{ 0, 0, 0, 0 }
 	};
 
@@ -297,6 +445,18 @@ int main(int argc, char *argv[])
 		case 'B':
 			do_bus_list = 1;
 			break;
+		case 'R':
+			record_file = optarg;
+			break;
+		case 'P':
+			replay_file = optarg;
+			break;
+		case 'S':
+			replay_speed = strtoul(optarg, NULL, 10);
+			break;
+		case 'I':
+			profile_init = 1;
+			break;
 		default:
 			fprintf(stderr,
 				"Internal error while parsing options!\n");
@@ -304,6 +464,11 @@ int main(int argc, char *argv[])
 		}
 	}
 
+	if (record_file && replay_file) {
+		fprintf(stderr, "Can't record and replay at the same time\n");
+		exit(1);
+	}
+
 	err = read_config_file(config_file_name);
 	if (err)
 		exit(err);
@@ -311,7 +476,9 @@ int main(int argc, char *argv[])
 	/* build the degrees string */
 	set_degstr();
 
-	if (do_bus_list) {
+	if (profile_init) {
+		err = print_init_profile();
+	} else if (do_bus_list) {
 		print_bus_list();
 	} else if (optind == argc) { /* No chip name on command line */
 		if (!do_the_real_work(NULL, &err)) {